@@ -83,6 +83,12 @@ public:
                   std::vector<std::string> *p_ModelNames,
                   const char *p_Filename);
 
+  // Imports every file not already loaded on the engine's workers, then
+  // uploads them in order on the calling thread
+  void loadModels (std::vector<Model> *p_Models,
+                   std::vector<std::string> *p_ModelNames,
+                   const std::vector<std::string> &p_Filenames);
+
   // Creates object with specified model data
   void createObject (std::vector<Model> *p_Models, std::string p_ModelName);
 
@@ -94,7 +100,7 @@ public:
   Container *allocatePool (uint32_t p_Count);
 
   void createLayout (vk::DescriptorType p_DescriptorType, uint32_t p_Count,
-                     vk::ShaderStageFlagBits p_ShaderStageFlags,
+                     vk::ShaderStageFlags p_ShaderStageFlags,
                      uint32_t p_Binding);
 
   void createLayout (vk::DescriptorSetLayoutCreateInfo &p_CreateInfo);
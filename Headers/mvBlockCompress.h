@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+
+/*
+  BC1 & BC3 block compression of RGBA8 texels
+
+  Colour endpoints start at the extremes of the block's principal axis &
+  are refined once by least squares against the chosen indices. sRGB
+  textures are encoded as stored, in gamma space, like every BC encoder
+*/
+namespace BlockCompress
+{
+  // Texels per block side
+  static constexpr uint32_t BLOCK_DIM = 4;
+
+  enum class Format
+  {
+    // opaque colour, 8 bytes per block
+    eBC1,
+    // colour plus interpolated alpha, 16 bytes per block
+    eBC3,
+  };
+
+  size_t blockBytes (Format p_Format);
+
+  inline uint32_t
+  blockCount (uint32_t p_Texels)
+  {
+    return (p_Texels + BLOCK_DIM - 1) / BLOCK_DIM;
+  }
+
+  // Bytes of a p_Width x p_Height image in p_Format
+  size_t imageBytes (Format p_Format, uint32_t p_Width, uint32_t p_Height);
+
+  // true => every alpha is 255 & BC1 loses nothing over BC3
+  bool isOpaque (const uint8_t *p_Rgba, size_t p_TexelCount);
+
+  // p_Rgba is 16 texels row major
+  void encodeBC1Block (const uint8_t *p_Rgba, uint8_t *p_Block);
+  void encodeBC3Block (const uint8_t *p_Rgba, uint8_t *p_Block);
+  void decodeBC1Block (const uint8_t *p_Block, uint8_t *p_Rgba);
+  void decodeBC3Block (const uint8_t *p_Block, uint8_t *p_Rgba);
+
+  // Whole image; blocks past the edge repeat the last row/column
+  // Block rows run on p_Workers
+  std::vector<uint8_t> encode (WorkerPool &p_Workers, Format p_Format,
+                               const uint8_t *p_Rgba, uint32_t p_Width,
+                               uint32_t p_Height);
+
+  // Tightly packed RGBA8 texels of an encoded image
+  std::vector<uint8_t> decode (Format p_Format, const uint8_t *p_Blocks,
+                               uint32_t p_Width, uint32_t p_Height);
+}; // namespace BlockCompress
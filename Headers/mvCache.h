@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+/*
+  On disk caches for baked data
+
+  Files are written once by the generator & memory mapped on load so the
+  payload can be copied straight into mapped vulkan memory without any
+  per element parsing
+*/
+namespace Cache
+{
+  // Read only memory mapping of an entire file; unmapped on destruction
+  class MappedFile
+  {
+  public:
+    MappedFile (void) {}
+    explicit MappedFile (const std::string &p_Filename);
+    ~MappedFile ();
+
+    // allow move
+    MappedFile (MappedFile &&p_Other) noexcept;
+    MappedFile &operator= (MappedFile &&p_Other) noexcept;
+
+    // delete copy
+    MappedFile (const MappedFile &) = delete;
+    MappedFile &operator= (const MappedFile &) = delete;
+
+    void open (const std::string &p_Filename);
+    void close (void) noexcept;
+
+    inline bool
+    isOpen (void) const noexcept
+    {
+      return mapping != nullptr;
+    }
+
+    inline const std::byte *
+    data (void) const noexcept
+    {
+      return static_cast<const std::byte *> (mapping);
+    }
+
+    inline size_t
+    size (void) const noexcept
+    {
+      return length;
+    }
+
+  private:
+    void *mapping = nullptr;
+    size_t length = 0;
+  };
+
+  // 64 bit checksum; consumes 32 bytes per iteration over 4 independent
+  // lanes so it runs near memory bandwidth on large payloads
+  uint64_t checksum (const void *p_Data, size_t p_Size) noexcept;
+
+  // "MVTC" little endian
+  static constexpr uint32_t TERRAIN_MAGIC = 0x4354564d;
+  static constexpr uint32_t TERRAIN_VERSION = 8;
+
+  // Geomipmap levels baked per render chunk; level l samples every 2^l
+  // texels
+  static constexpr uint32_t TERRAIN_LOD_LEVELS = 6;
+
+  // File layout
+  // [ TerrainHeader ][ vertices : vertexCount * vertexStride ]
+  // [ indices : indexCount * indexStride ]
+  // [ render chunks : renderChunkCount * sizeof (TerrainRenderChunk) ]
+  struct TerrainHeader
+  {
+    uint32_t magic = TERRAIN_MAGIC;
+    uint32_t version = TERRAIN_VERSION;
+    uint32_t vertexStride = 0;
+    uint32_t indexStride = 0;
+    uint32_t chunkIndex = 0;
+    uint32_t chunkCount = 0;
+    uint64_t vertexCount = 0;
+    uint64_t indexCount = 0;
+    // xyz bounds of chunk vertex positions; w unused
+    float boundsMin[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float boundsMax[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    // combined checksum of vertex, index & render chunk payloads
+    uint64_t payloadChecksum = 0;
+    uint32_t renderChunkCount = 0;
+    // vertical error level 0 was decimated to; 0 => full grid
+    float maxError = 0.0f;
+    // Terrain::tileKey of the source texels & parameters baked from
+    uint64_t sourceKey = 0;
+  };
+  static_assert (sizeof (TerrainHeader) == 96,
+                 "Terrain cache header layout changed; bump TERRAIN_VERSION");
+
+  // Culling & LOD unit of a tile; every level is one contiguous index range
+  struct TerrainRenderChunk
+  {
+    // relative to tile's first index
+    uint32_t firstIndex[TERRAIN_LOD_LEVELS] = {};
+    uint32_t indexCount[TERRAIN_LOD_LEVELS] = {};
+    // max vertical distance of each level from the full resolution surface
+    float error[TERRAIN_LOD_LEVELS] = {};
+    float boundsMin[3] = { 0.0f, 0.0f, 0.0f };
+    float boundsMax[3] = { 0.0f, 0.0f, 0.0f };
+    // vertex block the chunk's indices are local to; relative to tile's
+    // first vertex
+    uint32_t firstVertex = 0;
+    uint32_t vertexCount = 0;
+  };
+  static_assert (sizeof (TerrainRenderChunk) == 104,
+                 "Terrain render chunk layout changed; bump TERRAIN_VERSION");
+
+  // Validated view into a mapped terrain chunk file
+  // vertices/indices point into the mapping & are only valid while the
+  // chunk is alive
+  struct TerrainChunk
+  {
+    MappedFile file;
+    const TerrainHeader *header = nullptr;
+    const std::byte *vertices = nullptr;
+    const uint32_t *indices = nullptr;
+    const TerrainRenderChunk *renderChunks = nullptr;
+  };
+
+  // <base><chunk index>.mvtc
+  std::string terrainChunkFilename (const std::string &p_BaseFilename,
+                                    size_t p_ChunkIndex);
+
+  // Reads only the header; returns false if the file is missing or was
+  // written by a different version/vertex layout
+  bool peekTerrainHeader (const std::string &p_Filename,
+                          uint32_t p_VertexStride, TerrainHeader &p_Header);
+
+  // Maps & validates magic, version, strides, size & checksum
+  // Throws std::runtime_error on any mismatch
+  void readTerrainChunk (const std::string &p_Filename,
+                         uint32_t p_VertexStride, TerrainChunk &p_Chunk);
+
+  // Fills in stride, counts & checksum in p_Header then writes atomically
+  // (temporary file + rename)
+  void writeTerrainChunk (const std::string &p_Filename,
+                          TerrainHeader &p_Header, const void *p_Vertices,
+                          size_t p_VertexCount, uint32_t p_VertexStride,
+                          const uint32_t *p_Indices, size_t p_IndexCount,
+                          const TerrainRenderChunk *p_RenderChunks,
+                          size_t p_RenderChunkCount);
+
+  // "MVMC" little endian
+  static constexpr uint32_t MODEL_MAGIC = 0x434d564d;
+  static constexpr uint32_t MODEL_VERSION = 2;
+
+  // File layout
+  // [ ModelHeader ][ meshes : meshCount * sizeof (ModelMesh) ]
+  // [ textures : textureCount * sizeof (ModelTexture) ]
+  // [ materials : materialCount * sizeof (ModelMaterial) ]
+  // [ vertices : vertexCount * vertexStride ]
+  // [ indices : indexCount * indexStride ]
+  struct ModelHeader
+  {
+    uint32_t magic = MODEL_MAGIC;
+    uint32_t version = MODEL_VERSION;
+    uint32_t vertexStride = 0;
+    uint32_t indexStride = 0;
+    uint32_t meshCount = 0;
+    uint32_t textureCount = 0;
+    uint32_t materialCount = 0;
+    uint32_t reserved = 0;
+    uint64_t vertexCount = 0;
+    uint64_t indexCount = 0;
+    // Model::sourceKey of the file & importer imported from
+    uint64_t sourceKey = 0;
+    // combined checksum of every section after the header
+    uint64_t payloadChecksum = 0;
+    // FIFO vertex cache misses of indices as imported & as reordered
+    uint64_t cacheMissesBefore = 0;
+    uint64_t cacheMissesAfter = 0;
+  };
+  static_assert (sizeof (ModelHeader) == 80,
+                 "Model cache header layout changed; bump MODEL_VERSION");
+
+  // One draw range of the flattened model geometry
+  struct ModelMesh
+  {
+    uint32_t firstVertex = 0;
+    uint32_t vertexCount = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    // index into the file's textures or -1
+    int32_t mtlIndex = -1;
+    // index into the file's materials
+    uint32_t materialIndex = 0;
+  };
+  static_assert (sizeof (ModelMesh) == 24,
+                 "Model cache mesh layout changed; bump MODEL_VERSION");
+
+  // Texture reference only; texels are decoded from path on load
+  struct ModelTexture
+  {
+    // aiTextureType
+    uint32_t type = 0;
+    // null terminated
+    char path[252] = {};
+  };
+  static_assert (sizeof (ModelTexture) == 256,
+                 "Model cache texture layout changed; bump MODEL_VERSION");
+
+  // Per material constants; vertices carry none
+  struct ModelMaterial
+  {
+    // diffuse rgba
+    float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  };
+  static_assert (sizeof (ModelMaterial) == 16,
+                 "Model cache material layout changed; bump MODEL_VERSION");
+
+  // Validated view into a mapped model cache file; pointers are only valid
+  // while it is alive
+  struct ModelFile
+  {
+    MappedFile file;
+    const ModelHeader *header = nullptr;
+    const ModelMesh *meshes = nullptr;
+    const ModelTexture *textures = nullptr;
+    const ModelMaterial *materials = nullptr;
+    const std::byte *vertices = nullptr;
+    const uint32_t *indices = nullptr;
+  };
+
+  // <model filename>.mvmc
+  std::string modelCacheFilename (const std::string &p_Filename);
+
+  // Reads only the header; returns false if the file is missing or was
+  // written by a different version/vertex layout
+  bool peekModelHeader (const std::string &p_Filename,
+                        uint32_t p_VertexStride, ModelHeader &p_Header);
+
+  // Maps & validates magic, version, strides, size & checksum
+  // Throws std::runtime_error on any mismatch
+  void readModelFile (const std::string &p_Filename, uint32_t p_VertexStride,
+                      ModelFile &p_File);
+
+  // Fills in stride, counts & checksum in p_Header then writes atomically
+  // (temporary file + rename)
+  void writeModelFile (const std::string &p_Filename, ModelHeader &p_Header,
+                       const ModelMesh *p_Meshes, size_t p_MeshCount,
+                       const ModelTexture *p_Textures, size_t p_TextureCount,
+                       const ModelMaterial *p_Materials,
+                       size_t p_MaterialCount, const void *p_Vertices,
+                       size_t p_VertexCount, uint32_t p_VertexStride,
+                       const uint32_t *p_Indices, size_t p_IndexCount);
+}; // namespace Cache
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <memory>
+#include <utility>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -108,6 +110,22 @@ struct Camera
     // Updates view matrix
     void update(void);
 
+    // World space planes of current view frustum as { normal, distance }
+    // A point p is inside when dot(normal, p) + distance >= 0 for all six
+    std::array<glm::vec4, 6> getFrustumPlanes(void) const;
+
+    // Vertical field of view in degrees
+    float getFov(void) const;
+
+    // World space eye position; differs from position in third person
+    glm::vec3 getEyePosition(void) const;
+
+    // World space ray through window point x, y of a p_Width x p_Height
+    // window as { point on the near plane, unit direction }
+    std::pair<glm::vec3, glm::vec3> getPickRay(float p_X, float p_Y,
+                                               float p_Width,
+                                               float p_Height) const;
+
     void adjustMovement(glm::vec3 p_Delta);
 
     // Third person
@@ -1,7 +1,12 @@
 #pragma once
 #include <ostream>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
 struct UniformObject;
 class Model;
 class Engine;
@@ -10,6 +15,9 @@ struct Collection
 {
     bool shouldOutputDebug = false;
 
+    // Snap every object onto the loaded terrain before updating it
+    bool groundObjects = true;
+
     // owns
     std::unique_ptr<std::vector<Model>> models;
 
@@ -24,13 +32,21 @@ struct Collection
     Collection(Engine *p_Engine);
     ~Collection();
 
-    // Calls update for each object
+    // Grounds then calls update for each object
     void update(void);
 
+    // One batched height query for all objects; no-op without a map
+    void groundToTerrain(void);
+
     // Destroys Vulkan resources allocated by this handler
     void cleanup(void);
 
     uint32_t getObjectCount(void);
     uint32_t getTriangleCount(void);
     uint32_t getVertexCount(void);
+
+  private:
+    // reused by groundToTerrain to avoid allocating every tick
+    std::vector<glm::vec2> groundPoints;
+    std::vector<float> groundHeights;
 };
@@ -12,11 +12,14 @@
 #include "mvMap.h"
 #include "mvTimer.h"
 #include "mvWindow.h"
+#include "mvWorker.h"
 
 class Allocator;
 struct Collection;
 class Container;
 class MvBuffer;
+class TextureRegistry;
+class UploadBatcher;
 
 using namespace std::chrono_literals;
 
@@ -33,17 +36,26 @@ public:
   Timer timer;
   Timer fps;
 
+  WorkerPool workers;    // shared job threads; constructed before users
   Camera camera;         // camera manager(view/proj matrix handler)
   MapHandler mapHandler; // Map related methods
   std::unique_ptr<Allocator> allocator;          // descriptor pool/set manager
   std::unique_ptr<Collection> collectionHandler; // model/obj manager
   std::unique_ptr<GuiHandler> gui;               // ImGui manager
+  std::unique_ptr<UploadBatcher> uploads;        // batched texture staging
+  std::unique_ptr<TextureRegistry> textures;     // shared model/map textures
 
   std::unordered_map<PipelineTypes, vk::Pipeline> pipelines;
   std::unordered_map<PipelineTypes, vk::PipelineLayout> pipelineLayouts;
 
   PipelineTypes currentlyBound;
 
+  // Frames handed to the queue & frames known complete on the GPU
+  // Resources tagged with a submitted count may be freed once completed
+  // reaches it
+  uint64_t submittedFrames = 0;
+  uint64_t completedFrames = 0;
+
   void addNewModel (Container *pool, const char *filename);
 
   void recreateSwapchain (void);
@@ -68,6 +80,9 @@ public:
                      void *p_InitialData = nullptr) const;
 
 protected:
+  // submittedFrames value of the last submit using each in flight fence
+  std::array<uint64_t, MAX_IN_FLIGHT> frameSerials = {};
+
   void prepareUniforms (void);
 
   void prepareLayouts (void);
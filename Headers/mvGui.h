@@ -193,7 +193,7 @@ private:
     } selectTerrainModal;
 
     const int width = 300;
-    const int height = 100;
+    const int height = 205;
     // Parent modal
     ImGuiWindowFlags windowFlags
         = ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize
@@ -249,7 +249,8 @@ public:
   ImGuiIO &getIO (void);
   void update (const vk::Extent2D &p_SwapExtent, float p_RenderDelta,
                float p_FrameDelta, uint32_t p_ModelCount,
-               uint32_t p_ObjectCount, uint32_t p_VertexCount);
+               uint32_t p_ObjectCount, uint32_t p_VertexCount,
+               uint32_t p_VisibleChunkCount, uint32_t p_CulledChunkCount);
 
   std::vector<vk::Framebuffer>
   createFramebuffers (const vk::Device &p_LogicalDevice,
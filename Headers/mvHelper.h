@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <regex>
 #include <queue>
@@ -33,14 +34,14 @@ class LogHandler
         return;
     }
 
-    // TODO
-    // Add multi thread support
+    // Safe to call from worker threads
     void logMessage(std::pair<MessagePriority, std::string> p_Message);
     void logMessage(MessagePriority p_MessagePriority, std::string p_Message);
     void logMessage(std::string p_Message);
     std::vector<std::pair<MessagePriority, std::string>> getMessages(void);
 
   private:
+    std::mutex mtx;
     std::vector<std::pair<MessagePriority, std::string>> messages;
 }; // End class LogHandler
 
@@ -6,6 +6,7 @@
 #include "stb_image.h"
 
 #include "mvEngine.h"
+#include "mvKtx.h"
 
 #include <iostream>
 
@@ -21,6 +22,7 @@ class Image
     vk::ImageView imageView;
     vk::Sampler sampler;
     vk::DeviceMemory memory;
+    uint32_t mipLevels = 1;
 
     // info structs
     vk::DescriptorImageInfo descriptor;
@@ -33,23 +35,36 @@ class Image
             vk::MemoryPropertyFlags memoryProperties;
             vk::Format              format = vk::Format::eR8G8B8A8Srgb;
             vk::ImageTiling         tiling = vk::ImageTiling::eOptimal;
+            vk::Filter              filter = vk::Filter::eLinear;
+            vk::SamplerAddressMode  addressMode = vk::SamplerAddressMode::eRepeat;
+            // full chain down to 1x1; 8 bit per channel formats only
+            bool                    generateMipmaps = true;
         // clang-format on
     };
 
+    // Uses <base>.ktx2 from texbake in place of the image when it is current
+    // & matches the colour space of p_ImageCreateInfo.format
     void create(Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
                 std::string p_ImageFilename);
 
-    void createStagingBuffer(vk::DeviceSize &p_BufferSize,
-                             vk::Buffer &p_StagingBuffer,
-                             vk::DeviceMemory &p_StagingMemory);
+    // Uploads a baked chain; format comes from the file. Block compressed
+    // chains the device cannot sample are decoded to RGBA8
+    void create(Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
+                const Ktx::Texture &p_Texture);
 
-    void transitionImageLayout(vk::Image *p_TargetImage,
-                               vk::ImageLayout p_StartingLayout,
-                               vk::ImageLayout p_EndingLayout);
+    // Uploads tightly packed texels already in p_ImageCreateInfo.format
+    // Copy is batched by Engine::uploads & runs before the next frame
+    void create(Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
+                const void *p_Texels, uint32_t p_Width, uint32_t p_Height,
+                size_t p_BytesPerTexel);
 
-    vk::CommandBuffer beginCommandBuffer(void);
+    void destroy(void);
 
-    void endCommandBuffer(vk::CommandBuffer p_CommandBuffer);
+  private:
+    // Image & memory for mipLevels levels of p_ImageCreateInfo.format
+    void allocate(Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
+                  uint32_t p_Width, uint32_t p_Height);
 
-    void destroy(void);
+    // View, sampler & descriptor over every level
+    void createView(ImageCreateInfo &p_ImageCreateInfo);
 };
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mvBlockCompress.h"
+#include "mvCache.h"
+
+/*
+  KTX2 textures baked by texbake
+
+  Only the subset texbake writes is read back: one 2D layer & face, no
+  supercompression, RGBA8 or BC1/BC3 in either colour space. Formats are
+  VkFormat values so the file format stays vulkan free; the engine casts
+  them to vk::Format
+*/
+namespace Ktx
+{
+  static constexpr uint32_t FORMAT_R8G8B8A8_UNORM = 37;
+  static constexpr uint32_t FORMAT_R8G8B8A8_SRGB = 43;
+  static constexpr uint32_t FORMAT_BC1_RGB_UNORM = 131;
+  static constexpr uint32_t FORMAT_BC1_RGB_SRGB = 132;
+  static constexpr uint32_t FORMAT_BC3_UNORM = 137;
+  static constexpr uint32_t FORMAT_BC3_SRGB = 138;
+
+  // Bumped whenever texbake's output for the same source changes
+  static constexpr uint64_t BAKE_VERSION = 1;
+
+  bool isSupported (uint32_t p_VkFormat);
+  bool isSrgb (uint32_t p_VkFormat);
+
+  // true => block compressed & p_Format set
+  bool blockFormat (uint32_t p_VkFormat, BlockCompress::Format &p_Format);
+
+  uint32_t compressedFormat (BlockCompress::Format p_Format, bool p_Srgb);
+
+  // Bytes of one p_Width x p_Height level
+  size_t levelBytes (uint32_t p_VkFormat, uint32_t p_Width,
+                     uint32_t p_Height);
+
+  struct Level
+  {
+    const std::byte *data = nullptr;
+    size_t size = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+  };
+
+  // Validated view into a mapped texture; levels point into the mapping &
+  // are only valid while it is alive
+  struct Texture
+  {
+    Cache::MappedFile file;
+    uint32_t vkFormat = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // sourceKey of the image baked from
+    uint64_t sourceKey = 0;
+    // level 0 first
+    std::vector<Level> levels;
+  };
+
+  // <image filename without extension>.ktx2
+  std::string textureFilename (const std::string &p_ImageFilename);
+
+  // Identifies the source image bytes & bake version; 0 => unreadable
+  uint64_t sourceKey (const std::string &p_ImageFilename);
+
+  // Maps & validates identifier, format, level sizes & checksum
+  // Throws std::runtime_error on any mismatch
+  void readTexture (const std::string &p_Filename, Texture &p_Texture);
+
+  // Finds the bake of p_ImageFilename; false if there is none or it was
+  // baked from different source texels. A bake without its source image
+  // is used as is
+  bool findTexture (const std::string &p_ImageFilename, Texture &p_Texture);
+
+  // p_Levels are level 0 first; each must be levelBytes of its size
+  // Writes atomically (temporary file + rename)
+  void writeTexture (const std::string &p_Filename, uint32_t p_VkFormat,
+                     uint32_t p_Width, uint32_t p_Height,
+                     const std::vector<std::vector<uint8_t>> &p_Levels,
+                     uint64_t p_SourceKey);
+}; // namespace Ktx
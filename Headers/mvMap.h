@@ -2,20 +2,41 @@
 
 #include <vulkan/vulkan.hpp>
 
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <ranges>
+#include <span>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "mvCache.h"
+#include "mvTerrain.h"
+
 class GuiHandler;
+struct Camera;
 struct Vertex;
 class Engine;
 class Image;
+struct SharedTexture;
 
 class MapHandler
 {
@@ -25,6 +46,25 @@ public:
 
   bool isMapLoaded = false;
 
+  // Background load state; written by the loading worker, read by the gui
+  std::atomic<bool> isLoading = false;
+  std::atomic<float> loadProgress = 0.0f;
+  std::atomic<const char *> loadStage = "";
+  // Reason the last background load failed; render thread only
+  std::string loadError;
+
+  // eMesh        => vertex mesh generated on the CPU & cached on disk
+  // eHeightfield => heightmap uploaded as an R8 image & displaced in
+  //                 vsTerrain; no vertex buffer, one shared 16 bit patch
+  enum class TerrainMode
+  {
+    eMesh,
+    eHeightfield,
+  };
+  // Mode of the map currently drawn; a load in another mode switches it
+  // when the new map is swapped in
+  TerrainMode terrainMode = TerrainMode::eMesh;
+
   std::string filename = "None";
 
   std::unique_ptr<vk::Buffer> vertexBuffer;
@@ -33,96 +73,288 @@ public:
   std::unique_ptr<vk::Buffer> indexBuffer;
   std::unique_ptr<vk::DeviceMemory> indexMemory;
 
-  std::unique_ptr<Image> defaultTexture;
+  // held in Engine::textures; terrainDescriptor is its set
+  SharedTexture *defaultTexture = nullptr;
   vk::DescriptorSet terrainDescriptor;
 
+  // heightfield mode only; one of heightfieldSets
+  std::unique_ptr<Image> heightTexture;
+  vk::DescriptorSet heightfieldDescriptor;
+
+  vk::IndexType indexType = vk::IndexType::eUint32;
+
   size_t vertexCount = 0;
   size_t indexCount = 0;
 
-  // offset of vertices each index start/count correspond to
-  // std::vector<size_t> vertexOffsets;
-  // { index start, index count }
-  // std::vector<std::pair<uint32_t, uint32_t>> indexOffsets;
+  // Generated maps are split into tilesPerSide x tilesPerSide tiles, each
+  // built on a worker & cached in its own file
+  // 0 => ceil(sqrt(worker count))
+  size_t tilesPerSide = 0;
+
+  // Quads per side of a render chunk; the unit of culling & LOD selection
+  static constexpr size_t RENDER_CHUNK_QUADS = Terrain::RENDER_CHUNK_QUADS;
+  static constexpr uint32_t LOD_LEVELS = Terrain::LOD_LEVELS;
+
+  // Largest on screen height error in pixels a coarser level may introduce
+  float lodErrorThreshold = 2.0f;
+
+  // Largest vertical error level 0 of full size render chunks may be
+  // simplified to when baking the cache; 0 keeps the full grid
+  // Caches baked with another value are regenerated
+  float decimationError = 0.0f;
+
+  struct RenderChunk
+  {
+    // absolute index ranges per level, finest first
+    std::array<uint32_t, LOD_LEVELS> firstIndex = {};
+    std::array<uint32_t, LOD_LEVELS> indexCount = {};
+    std::array<float, LOD_LEVELS> error = {};
+    glm::vec3 boundsMin = glm::vec3 (0.0f);
+    glm::vec3 boundsMax = glm::vec3 (0.0f);
+    // mesh mode only; vertex the chunk's indices are relative to
+    int32_t vertexOffset = 0;
+    // heightfield mode only; first texel & size in quads
+    glm::ivec2 origin = glm::ivec2 (0);
+    glm::ivec2 quads = glm::ivec2 (0);
+    float skirtDepth = 0.0f;
+  };
+  std::vector<RenderChunk> renderChunks;
+
+  // { first index, index count } of every level in the patch index buffer
+  std::array<std::pair<uint32_t, uint32_t>, LOD_LEVELS> patchLevels = {};
+
+  // Push constant block of vsVP.vert
+  // Vertices dropped by the next level slide toward it as morph -> 1
+  struct LodPushConstant
+  {
+    int32_t level = 0;
+    float morph = 0.0f;
+  };
+
+  // Push constant block of vsTerrain.vert; starts with LodPushConstant
+  struct HeightfieldPushConstant
+  {
+    int32_t level = 0;
+    float morph = 0.0f;
+    glm::ivec2 origin = glm::ivec2 (0);
+    glm::ivec2 quads = glm::ivec2 (0);
+    float skirtDepth = 0.0f;
+  };
+
+  struct ChunkDraw
+  {
+    uint32_t chunk = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    int32_t vertexOffset = 0;
+    LodPushConstant lod;
+  };
+  std::vector<ChunkDraw> visibleDraws;
+
+  uint32_t visibleChunkCount = 0;
+  uint32_t culledChunkCount = 0;
 
   Engine *ptrEngine = nullptr;
 
   // Load map file while also updating Gui
+  // Blocks until the map is on the GPU; only used before the render loop
   void readHeightMap (GuiHandler *p_Gui, std::string p_Filename);
 
-  // Load map file without updating gui
-  std::pair<std::vector<Vertex>, std::vector<uint32_t>>
-  readHeightMap (std::string p_Filename);
+  // Builds the map on a worker; the current map keeps drawing until update
+  // swaps the new one in. False if a load is already running
+  bool requestHeightMap (std::string p_Filename, TerrainMode p_Mode);
+
+  // Called by the engine once per frame once the frame's fence signalled
+  // Starts the device copy of a built map, swaps it in when the copy is
+  // done & frees retired buffers no frame in flight still uses
+  void update (GuiHandler *p_Gui);
 
   void bindBuffer (vk::CommandBuffer &p_CommandBuffer);
 
-  void cleanup (const vk::Device &p_LogicalDevice);
+  // Height of the drawn map at world x, z; bilinear between texels &
+  // clamped to the map edges. The surface sits at y = -height
+  // 0 while no map or no height grid is loaded
+  float heightAt (float p_X, float p_Z) const;
 
-private:
-  // Generates array of quads from array of xyz points
-  std::vector<Vertex> generateMesh (size_t p_XLength, size_t p_ZLength,
-                                    std::vector<Vertex> &p_HeightValues);
+  // p_Heights[i] = heightAt (p_Points[i].x, p_Points[i].y); eight points
+  // per step when the CPU has AVX2
+  void heightsAt (std::span<const glm::vec2> p_Points,
+                  std::span<float> p_Heights) const;
+
+  struct RayHit
+  {
+    glm::vec3 position = glm::vec3 (0.0f);
+    // unit length; points away from the terrain (-y is up)
+    glm::vec3 normal = glm::vec3 (0.0f, -1.0f, 0.0f);
+    // along the normalized ray direction
+    float distance = 0.0f;
+  };
 
-  std::pair<std::vector<Vertex>, std::vector<uint32_t>>
-  optimize (std::vector<Vertex> &p_Vertices);
+  // First hit of a world space ray with the full resolution surface
+  // Steps through heightPyramid top down, skipping cells the ray passes
+  // above or below. False on a miss or while no height grid is loaded
+  bool raycast (glm::vec3 p_Origin, glm::vec3 p_Direction, RayHit &p_Hit,
+                float p_MaxDistance
+                = std::numeric_limits<float>::max ()) const;
 
-  void writeRaw (std::string p_FilenameIndexAppended,
-                 std::vector<Vertex> &p_VertexContainer,
-                 std::vector<uint32_t> &p_IndexContainer);
+  // Heightfield pipeline is only built when shaders/vsTerrain.spv exists
+  bool isHeightfieldSupported (void) const;
 
-  void writeVertexFile (std::string p_FilenameIndexAppended,
-                        std::vector<Vertex> &p_VertexContainer);
+  // Tests chunk bounds against the camera frustum, picks a level per
+  // visible chunk from its distance & rebuilds visibleDraws
+  void cull (const Camera &p_Camera, float p_ViewportHeight);
 
-  void writeIndexFile (std::string p_FilenameIndexAppended,
-                       std::vector<uint32_t> &p_IndexContainer);
+  // One drawIndexed per visible draw; expects buffers, pipeline &
+  // descriptors bound
+  void draw (vk::CommandBuffer &p_CommandBuffer,
+             const vk::PipelineLayout &p_PipelineLayout);
 
-  // Manipulates the filename that was originally requested by load
-  // removes extension and appends _v.bin && _i.bin to look for the optimized
-  // file Vertices file & indices file
-  bool isAlreadyOptimized (std::string p_OriginalFilenameRequested);
+  void cleanup (const vk::Device &p_LogicalDevice);
 
-  void readVertexFile (std::string p_FinalFilename,
-                       std::vector<Vertex> &p_VertexContainer);
+private:
+  struct MapBuffer
+  {
+    vk::Buffer buffer;
+    vk::DeviceMemory memory;
+    vk::DeviceSize size = 0;
+  };
 
-  void readIndexFile (std::string p_FinalFilename,
-                      std::vector<uint32_t> &p_IndexContainer);
+  // Lowest & highest texel of a cell
+  struct HeightBounds
+  {
+    uint8_t min = 0;
+    uint8_t max = 0;
+  };
+  using HeightPyramid = std::vector<std::vector<HeightBounds>>;
 
-  void allocate (std::vector<Vertex> &p_VertexContainer,
-                 std::vector<uint32_t> &p_IndexContainer);
+  // Map built off the render thread; contents sit in host visible staging
+  // buffers until update copies them into device local ones
+  struct PendingMap
+  {
+    std::string filename;
+    TerrainMode mode = TerrainMode::eMesh;
+    // decimationError when the load was requested
+    float maxError = 0.0f;
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    vk::IndexType indexType = vk::IndexType::eUint32;
+    std::vector<RenderChunk> renderChunks;
+    std::array<std::pair<uint32_t, uint32_t>, LOD_LEVELS> patchLevels = {};
 
-  // Removes duplicate values; if horizontal|vertical -> prunes x|z axis
-  // This method also sorts the vertices based on target axis
-  // Does not manipulate splitValues container so ptrs are still valid
-  void cleanEdge (std::vector<Vertex *> &p_Edge, bool isHorizontal);
+    // Becomes the query grid on swap in & heightTexture in heightfield
+    // mode; empty if the source image could not be read
+    std::vector<uint8_t> heights;
+    size_t xLength = 0;
+    size_t zLength = 0;
+    HeightPyramid heightPyramid;
 
-  // Provide edge params left->right or top->bottom
-  // creates quads between two provided edges
-  void stitchEdge (std::vector<Vertex *> &p_FirstEdge,
-                   std::vector<Vertex *> &p_SecondEdge,
-                   std::vector<Vertex> &p_Vertices, bool isVertical);
+    MapBuffer stagingVertices;
+    MapBuffer stagingIndices;
+    MapBuffer vertices;
+    MapBuffer indices;
+    vk::CommandBuffer commandBuffer;
+    vk::Fence fence;
+  };
 
-  enum WindingStyle
+  // Resources of a replaced map; destroyed once the engine has completed
+  // every frame submitted before the swap
+  struct RetiredMap
   {
-    eFirstCornerToFirstEdge = 0,
-    eFirstCornerToSecondCorner,
-    eFirstCornerToSecondEdge,
-    eFirstEdgeToFirstCorner,
-    eFirstEdgeToSecondEdge,
-    eCenter
+    uint64_t frame = 0;
+    std::vector<MapBuffer> buffers;
+    std::unique_ptr<Image> heightTexture;
   };
-  // Needs first vertex that starts the edge
-  void stitchCorner (Vertex *p_FirstCorner, Vertex *p_FirstEdgeVertex,
-                     Vertex *p_SecondCorner, Vertex *p_SecondEdgeVertex,
-                     std::vector<Vertex> &p_Vertices, WindingStyle p_Style);
-
-  // stitch center corners where chunks intersect
-  // void stitchCorner (Vertex *p_TLCorner, Vertex *p_TRCorner,
-  //                    Vertex *p_BRCorner, Vertex *p_BLCorner,
-  //                    std::vector<Vertex> &p_Vertices);
-
-  std::string getBaseFilename (const std::string &p_Filename);
-
-  // converts to _v.bin filename
-  std::string filenameToBinV (const std::string &p_Filename);
-  // converts to _i.bin filename
-  std::string filenameToBinI (const std::string &p_Filename);
+
+  // CPU copy of the drawn map's heights for queries; row major, one byte
+  // per texel plus padding so 4 byte gathers of the last cell stay inside
+  std::vector<uint8_t> heightGrid;
+  size_t gridWidth = 0;
+  size_t gridDepth = 0;
+  static constexpr size_t HEIGHT_GRID_PADDING = 4;
+
+  // Level l holds bounds of 2^(l + 1) quad wide cells, the last level is a
+  // single cell. One quad cells are read from heightGrid directly
+  HeightPyramid heightPyramid;
+
+  static HeightPyramid
+  buildHeightPyramid (const std::vector<uint8_t> &p_Heights, size_t p_Width,
+                      size_t p_Depth);
+
+  // Cells of 2^p_Level quads covering p_Quads
+  static size_t levelCells (size_t p_Level, size_t p_Quads);
+
+  static HeightBounds quadBounds (const uint8_t *p_Heights, size_t p_Width,
+                                  size_t p_X, size_t p_Z);
+
+  // Bounds of cell x, z on pyramid level p_Level; level 0 is one quad
+  HeightBounds cellBounds (size_t p_Level, size_t p_X, size_t p_Z) const;
+
+  // Ray against both triangles of quad x, z in height space (y up)
+  // Keeps the nearest hit in [p_TMin, p_T]
+  bool intersectQuad (size_t p_X, size_t p_Z, const glm::vec3 &p_Origin,
+                      const glm::vec3 &p_Direction, float p_TMin, float &p_T,
+                      glm::vec3 &p_Normal) const;
+
+#if defined(__x86_64__) || defined(__i386__)
+  // Fills heights of the leading multiple of 8 points; returns its size
+  __attribute__ ((target ("avx2"))) size_t
+  heightsAtAvx2 (std::span<const glm::vec2> p_Points,
+                 std::span<float> p_Heights) const;
+#endif
+
+  std::future<std::unique_ptr<PendingMap>> loadJob;
+  std::unique_ptr<PendingMap> uploading;
+  std::vector<RetiredMap> retired;
+
+  // A set may still be bound by a frame in flight so a new height image
+  // goes into the other one; frame it was last used by
+  std::array<vk::DescriptorSet, 2> heightfieldSets = {};
+  std::array<uint64_t, 2> heightfieldSetFrames = {};
+
+  // Reads & stages a map in p_Mode; safe to run on a worker
+  // Uses binary cache if present, otherwise generates & writes it
+  std::unique_ptr<PendingMap> buildMap (const std::string &p_Filename,
+                                        TerrainMode p_Mode,
+                                        float p_MaxError);
+  void buildMesh (PendingMap &p_Map);
+
+  // Render thread; records & submits the staging -> device local copy
+  void submitCopy (PendingMap &p_Map);
+
+  // False while the descriptor set a new height image needs is in flight
+  bool canSwap (const PendingMap &p_Map) const;
+
+  // Render thread; retires the current map & takes over p_Map's resources
+  void swapIn (GuiHandler *p_Gui, PendingMap &p_Map);
+
+  // Destroys whatever p_Map still owns
+  void destroyPending (PendingMap &p_Map);
+
+  // p_All ignores frame tags; device must be idle
+  void releaseRetired (bool p_All);
+
+  void destroyBuffer (MapBuffer &p_Buffer);
+
+  void loadDefaultTexture (void);
+
+  // Creates host visible staging buffers sized for the map
+  void allocate (PendingMap &p_Map, size_t p_VertexBytes,
+                 size_t p_IndexBytes);
+
+  // Fills p_Levels; ids past (n + 1)^2 are the skirt copies
+  static std::vector<uint16_t> generatePatchIndices (
+      std::array<std::pair<uint32_t, uint32_t>, LOD_LEVELS> &p_Levels);
+
+  // Stages the patch & builds chunk bounds/errors; no mesh
+  // Heights are kept for the image created on swap in
+  void loadHeightfield (PendingMap &p_Map);
+
+  // Concatenates tiles into the staging buffers, rebasing render chunk
+  // ranges & vertex blocks; 16 bit indices when every block fits
+  void uploadTiles (PendingMap &p_Map,
+                    const std::vector<Terrain::TileView> &p_Tiles);
+
+  // Maps each chunk file & copies directly into the staging buffers
+  void loadCache (PendingMap &p_Map, const std::string &p_BaseFilename,
+                  size_t p_ChunkCount);
 };
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/*
+  Index & vertex buffer reordering for triangle lists
+
+  optimizeVertexCache reorders triangles for the post transform vertex
+  cache (Forsyth, "Linear-Speed Vertex Cache Optimisation");
+  optimizeVertexFetch then renumbers vertices in the order the reordered
+  indices first use them so fetches walk memory forward
+*/
+namespace MeshOpt
+{
+  // FIFO size cacheMisses simulates when reporting ACMR
+  static constexpr size_t REPORT_CACHE_SIZE = 16;
+
+  // optimizeVertexFetch remap entry of a vertex no index references
+  static constexpr uint32_t UNUSED = std::numeric_limits<uint32_t>::max ();
+
+  // Reorders the triangles of p_Indices in place; vertices are untouched
+  void optimizeVertexCache (uint32_t *p_Indices, size_t p_IndexCount,
+                            size_t p_VertexCount);
+
+  // Renumbers vertices in order of first use & rewrites p_Indices
+  // Returns remap[old] = new, UNUSED for unreferenced vertices
+  std::vector<uint32_t> optimizeVertexFetch (uint32_t *p_Indices,
+                                             size_t p_IndexCount,
+                                             size_t p_VertexCount);
+
+  // Vertex transforms of p_Indices with a p_CacheSize entry FIFO cache
+  // ACMR is this divided by the triangle count
+  size_t cacheMisses (const uint32_t *p_Indices, size_t p_IndexCount,
+                      size_t p_VertexCount,
+                      size_t p_CacheSize = REPORT_CACHE_SIZE);
+
+  // Moves vertices to their optimizeVertexFetch slot; unused ones are
+  // dropped
+  template <typename T>
+  void
+  remapVertices (std::vector<T> &p_Vertices,
+                 const std::vector<uint32_t> &p_Remap)
+  {
+    size_t kept = 0;
+    for (uint32_t slot : p_Remap)
+      if (slot != UNUSED)
+        kept++;
+
+    std::vector<T> remapped (kept);
+    for (size_t v = 0; v < p_Vertices.size (); v++)
+      if (p_Remap[v] != UNUSED)
+        remapped[p_Remap[v]] = p_Vertices[v];
+
+    p_Vertices = std::move (remapped);
+    return;
+  }
+}; // namespace MeshOpt
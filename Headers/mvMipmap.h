@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+
+/*
+  CPU mip chain generation for 8 bit per channel textures
+
+  Used where the GPU cannot blit a format & by anything that stores whole
+  chains. Each level is a 2x2 box filter of the one above; sRGB colour
+  channels are averaged in linear space
+*/
+namespace Mipmap
+{
+  struct Level
+  {
+    std::vector<uint8_t> texels;
+    uint32_t width = 0;
+    uint32_t height = 0;
+  };
+
+  // Levels of a full chain down to 1x1, including level 0
+  uint32_t levelCount (uint32_t p_Width, uint32_t p_Height);
+
+  // Every level below level 0, largest first; rows run on p_Workers
+  // p_Srgb => channels past the third (alpha) stay linear
+  std::vector<Level> generate (WorkerPool &p_Workers, const uint8_t *p_Texels,
+                               uint32_t p_Width, uint32_t p_Height,
+                               size_t p_Channels, bool p_Srgb);
+}; // namespace Mipmap
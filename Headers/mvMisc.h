@@ -20,5 +20,7 @@ enum PipelineTypes
     eMVPWSamplerDynamic,    // M/V/P uniforms + color, uv, sampler & dynamic states
     eMVPNoSamplerDynamic,   // M/V/P uniforms + color, uv & dynamic states
     eVPSamplerDynamic,      // V/P uniforms + color, uv, sampler & dynamic states
-    eVPNoSamplerDynamic     // V/P uniforms + color, uv & dynamic states
+    eVPNoSamplerDynamic,    // V/P uniforms + color, uv & dynamic states
+
+    eTerrainHeightfield     // V/P uniforms + sampler, vertices displaced from heightmap sampler
 };
\ No newline at end of file
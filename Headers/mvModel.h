@@ -23,7 +23,10 @@
 
 #include "mvAllocator.h"
 #include "mvBuffer.h"
+#include "mvCache.h"
 #include "mvImage.h"
+#include "mvTextures.h"
+#include "mvVertex.h"
 
 static constexpr float MOVESPEED = 0.05f;
 
@@ -34,7 +37,8 @@ public:
   ~Texture (){};
   std::string type;
   std::string path;
-  Image mvImage;
+  // one reference per model, released in Model::cleanup
+  SharedTexture *shared = nullptr;
   vk::DescriptorSet descriptor;
 };
 
@@ -176,76 +180,41 @@ public:
   }
 };
 
-// Contains...
-// glm::vec4 position
-// glm::vec4 color
-// glm::vec4 uv
-struct Vertex
+static inline vk::VertexInputBindingDescription
+getVertexBindingDescription (void)
 {
-  glm::vec4 position = { 0.0f, 0.0f, 0.0f, 0.0f };
-  glm::vec4 color = { 0.0f, 0.0f, 0.0f, 0.0f };
-  glm::vec4 uv = { 0.0f, 0.0f, 0.0f, 0.0f };
+  vk::VertexInputBindingDescription bindingDescription;
+  bindingDescription.binding = 0;
+  bindingDescription.stride = sizeof (Vertex);
+  bindingDescription.inputRate = vk::VertexInputRate::eVertex;
+  return bindingDescription;
+}
+
+static inline std::array<vk::VertexInputAttributeDescription, 3>
+getVertexAttributeDescriptions (void)
+{
+  std::array<vk::VertexInputAttributeDescription, 3> attributeDescriptions;
 
-  // For copying directly to/from file streams
-  Vertex &
-  operator= (Vertex &rhs)
-  {
-    this->position = rhs.position;
-    this->color = rhs.color;
-    this->uv = rhs.uv;
-    return *this;
-  }
+  // position
+  attributeDescriptions[0].binding = 0;
+  attributeDescriptions[0].location = 0;
+  attributeDescriptions[0].format = vk::Format::eR32G32B32Sfloat;
+  attributeDescriptions[0].offset = offsetof (Vertex, position);
 
-  Vertex &
-  operator= (const Vertex &rhs)
-  {
-    this->position = rhs.position;
-    this->color = rhs.color;
-    this->uv = rhs.uv;
-    return *this;
-  }
+  // texture uv coordinates; terrain morph offset & level
+  attributeDescriptions[1].binding = 0;
+  attributeDescriptions[1].location = 1;
+  attributeDescriptions[1].format = vk::Format::eR16G16Sfloat;
+  attributeDescriptions[1].offset = offsetof (Vertex, uv);
 
-  friend std::ostream &operator<< (std::ostream &p_OutputStream,
-                                   const Vertex &p_Vertex);
-  friend std::istream &operator>> (std::istream &p_InputStream,
-                                   Vertex &p_Vertex);
+  // packed normal; read by the terrain shaders only
+  attributeDescriptions[2].binding = 0;
+  attributeDescriptions[2].location = 2;
+  attributeDescriptions[2].format = vk::Format::eR16G16Snorm;
+  attributeDescriptions[2].offset = offsetof (Vertex, normal);
 
-  static vk::VertexInputBindingDescription
-  getBindingDescription ()
-  {
-    vk::VertexInputBindingDescription bindingDescription;
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof (Vertex);
-    bindingDescription.inputRate = vk::VertexInputRate::eVertex;
-    return bindingDescription;
-  }
-
-  static std::array<vk::VertexInputAttributeDescription, 3>
-  getAttributeDescriptions ()
-  {
-    std::array<vk::VertexInputAttributeDescription, 3> attributeDescriptions;
-
-    // position
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = vk::Format::eR32G32B32A32Sfloat;
-    attributeDescriptions[0].offset = offsetof (Vertex, position);
-
-    // texture uv coordinates
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = vk::Format::eR32G32B32A32Sfloat;
-    attributeDescriptions[1].offset = offsetof (Vertex, uv);
-
-    // color
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = vk::Format::eR32G32B32A32Sfloat;
-    attributeDescriptions[2].offset = offsetof (Vertex, color);
-
-    return attributeDescriptions;
-  }
-};
+  return attributeDescriptions;
+}
 
 // Collection of data that makes up the various components of a model
 struct Mesh
@@ -266,12 +235,70 @@ struct Mesh
   vk::DeviceMemory indexMemory;
 
   int mtlIndex = -1;
+  uint32_t materialIndex = 0;
 
   // Bind vertex & index buffers if exist
   void bindBuffers (vk::CommandBuffer &p_CommandBuffer);
   void cleanup (const vk::Device &p_LogicalDevice);
 };
 
+// One material texture; the texbake chain if current, else decoded RGBA8
+// texels
+struct TextureData
+{
+  aiTextureType type = aiTextureType_NONE;
+  std::string path;
+  // TextureRegistry::contentChecksum of path
+  uint64_t checksum = 0;
+  Ktx::Texture baked;
+  std::vector<uint8_t> texels;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+// Everything Model::upload needs from a model file; built without vulkan so
+// files can be imported on worker threads
+struct ModelData
+{
+  std::string filename;
+  // draw ranges of the flattened geometry; mtlIndex indexes textures or -1
+  std::vector<Cache::ModelMesh> meshes;
+  std::vector<TextureData> textures;
+  // one per scene material; indexed by ModelMesh::materialIndex
+  std::vector<Cache::ModelMaterial> materials;
+  // flattened geometry as imported; empty when read from cache
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  Cache::ModelFile cached;
+  size_t missesBefore = 0;
+  size_t missesAfter = 0;
+
+  inline const Vertex *
+  getVertices (void) const noexcept
+  {
+    return cached.header ? reinterpret_cast<const Vertex *> (cached.vertices)
+                         : vertices.data ();
+  }
+
+  inline const uint32_t *
+  getIndices (void) const noexcept
+  {
+    return cached.header ? cached.indices : indices.data ();
+  }
+
+  inline size_t
+  getVertexCount (void) const noexcept
+  {
+    return cached.header ? cached.header->vertexCount : vertices.size ();
+  }
+
+  inline size_t
+  getIndexCount (void) const noexcept
+  {
+    return cached.header ? cached.header->indexCount : indices.size ();
+  }
+};
+
 class Model
 {
 public:
@@ -306,26 +333,83 @@ public:
   bool hasTexture = false; // do not assume model has texture
   std::unique_ptr<std::vector<Object>> objects;
 
-  // { {vertex offset, Texture vkDescriptorSet index}, { Index start,
-  // Index count } } texture descriptor set is either a valid index to
-  // textureDescriptors or -1
-  std::vector<
-      std::pair<std::pair<uint32_t, int>, std::pair<uint32_t, uint32_t>>>
-      bufferOffsets;
+  // Material constants pushed to the vertex stage per draw range
+  struct MaterialPushConstant
+  {
+    glm::vec4 color;
+  };
+  std::vector<MaterialPushConstant> materials;
+
+  struct DrawRange
+  {
+    uint32_t vertexOffset = 0;
+    // index to textureDescriptors or -1
+    int textureIndex = -1;
+    // index to materials
+    uint32_t materialIndex = 0;
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+  };
+  std::vector<DrawRange> bufferOffsets;
   std::unique_ptr<std::vector<struct Mesh>> loadedMeshes;
   std::unique_ptr<std::vector<Texture>> loadedTextures;
 
-  void load (Engine *p_Engine, Allocator &p_DescriptorAllocator,
-             const char *p_Filename, bool p_OutputDebug = true);
-
-  void processNode (Engine *p_Engine, aiNode *p_Node, const aiScene *p_Scene);
-
-  Mesh processMesh (Engine *p_Engine, aiMesh *p_Mesh, const aiScene *p_Scene);
-
-  std::vector<Texture> loadMaterialTextures (
-      Engine *p_Engine, aiMaterial *p_Material, aiTextureType p_Type,
-      [[maybe_unused]] std::string p_TypeName,
-      [[maybe_unused]] const aiScene *p_Scene, int &p_MtlIndex);
+  // Bump when import output changes for the same source file; invalidates
+  // every model cache
+  static constexpr uint32_t IMPORT_VERSION = 2;
+
+  // Import then upload on the calling thread
+  void load (Engine *p_Engine, const char *p_Filename,
+             bool p_OutputDebug = true);
+
+  // Maps <file>.mvmc if it was written from the same source bytes, else
+  // reads the file with its own Assimp::Importer & writes the cache
+  // Textures are checksummed, not decoded. No engine access so it is safe
+  // to call from any thread
+  static ModelData import (const char *p_Filename);
+
+  // Maps the texbake output if current, else decodes the image; any thread
+  static void decodeTexture (TextureData &p_Texture);
+
+  // Settings every model texture is registered with
+  static Image::ImageCreateInfo textureCreateInfo (void);
+
+  // Hash of the file bytes & IMPORT_VERSION; files assimp pulls in
+  // alongside (.mtl) are not included
+  static uint64_t sourceKey (const char *p_Filename);
+
+  static void writeCache (const std::string &p_Filename,
+                          const ModelData &p_Data, uint64_t p_Key);
+
+  // Acquires textures from Engine::textures, decoding those not yet
+  // registered, & creates buffers from imported data; render thread only
+  void upload (Engine *p_Engine, ModelData &p_Data,
+               bool p_OutputDebug = true);
+
+  // p_Parent is the accumulated transform of p_Node's ancestors
+  static void processNode (ModelData &p_Data, std::vector<Mesh> &p_Meshes,
+                           aiNode *p_Node, const aiScene *p_Scene,
+                           const aiMatrix4x4 &p_Parent);
+
+  // Vertices are transformed into model space by p_Transform
+  static Mesh processMesh (ModelData &p_Data, aiMesh *p_Mesh,
+                           const aiScene *p_Scene,
+                           const aiMatrix4x4 &p_Transform);
+
+  // Concatenates meshes with the same texture & material colour into one
+  // draw range each, in order of first use
+  static std::vector<Mesh> mergeMeshes (const ModelData &p_Data,
+                                        std::vector<Mesh> &p_Meshes);
+
+  // Fills p_Data.materials from every scene material
+  static void processMaterials (ModelData &p_Data, const aiScene *p_Scene);
+
+  // Adds textures not already in p_Data & points p_MtlIndex at the last
+  static void loadMaterialTextures (ModelData &p_Data, aiMaterial *p_Material,
+                                    aiTextureType p_Type,
+                                    [[maybe_unused]] std::string p_TypeName,
+                                    [[maybe_unused]] const aiScene *p_Scene,
+                                    int &p_MtlIndex);
 
   void bindBuffers (vk::CommandBuffer &p_CommandBuffer);
   void cleanup (Engine *p_Engine);
@@ -0,0 +1,220 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mvCache.h"
+#include "mvVertex.h"
+
+class WorkerPool;
+
+/*
+  Terrain mesh generation & cache baking
+
+  No vulkan or window dependency; MapHandler stages the result for the GPU
+  & the offline bake tool only writes the cache
+*/
+namespace Terrain
+{
+  // Quads per side of a render chunk; the unit of culling & LOD selection
+  static constexpr size_t RENDER_CHUNK_QUADS = 64;
+  static constexpr uint32_t LOD_LEVELS = Cache::TERRAIN_LOD_LEVELS;
+
+  // Vertices a block of render chunks may span so its chunk local indices
+  // fit 16 bits
+  static constexpr size_t VERTEX_BLOCK_SIZE = 65536;
+
+  // Bump when generateGrid output changes for the same source pixels &
+  // parameters; invalidates every cached tile
+  static constexpr uint32_t TERRAIN_GENERATOR_VERSION = 1;
+
+  // Load state shared with the gui; either pointer may be null
+  struct Progress
+  {
+    std::atomic<float> *value = nullptr;
+    std::atomic<const char *> *stage = nullptr;
+
+    void setStage (const char *p_Stage) const;
+    void set (float p_Value) const;
+    void add (float p_Value) const;
+  };
+
+  // CPU side mesh of a single tile as generated or read from disk
+  struct TileMesh
+  {
+    std::vector<Vertex> vertices;
+    // local to the vertex block of their render chunk
+    std::vector<uint32_t> indices;
+    // ranges relative to tile's indices
+    std::vector<Cache::TerrainRenderChunk> renderChunks;
+    // level 0 surface triangles of the full grid & as baked
+    size_t gridTriangles = 0;
+    size_t bakedTriangles = 0;
+    // FIFO vertex cache transforms of indices as emitted & as reordered
+    size_t cacheMissesBefore = 0;
+    size_t cacheMissesAfter = 0;
+  };
+
+  // Non owning view of a tile, either a TileMesh or a mapped cache file
+  struct TileView
+  {
+    const void *vertices = nullptr;
+    size_t vertexCount = 0;
+    const uint32_t *indices = nullptr;
+    size_t indexCount = 0;
+    const Cache::TerrainRenderChunk *renderChunks = nullptr;
+    size_t renderChunkCount = 0;
+  };
+
+  // Texel range of one tile; see tileRegions
+  struct TileRegion
+  {
+    size_t x0 = 0;
+    size_t z0 = 0;
+    size_t xCount = 0;
+    size_t zCount = 0;
+  };
+
+  // Map texels covered by one render chunk
+  struct ChunkRegion
+  {
+    size_t x0 = 0;
+    size_t z0 = 0;
+    size_t xQuads = 0;
+    size_t zQuads = 0;
+  };
+
+  // Every tile of one heightmap, mapped from an up to date cache file or
+  // freshly generated; mappings stay valid while this is alive
+  struct BakedTerrain
+  {
+    std::vector<TileRegion> regions;
+    std::vector<Cache::TerrainChunk> cached;
+    std::vector<TileMesh> generated;
+    // per tile; 1 => cached, otherwise generated
+    std::vector<uint8_t> reused;
+    size_t staleCount = 0;
+
+    std::vector<TileView> views (void) const;
+  };
+
+  // Reads the first channel of the heightmap; at least 2x2 texels
+  std::vector<uint8_t> readHeights (const std::string &p_Filename,
+                                    size_t &p_XLength, size_t &p_ZLength);
+
+  // Heightmap path without extension; cache files are named after it
+  std::string getBaseFilename (const std::string &p_Filename);
+
+  // Generates or reuses every tile of <base>N.mvtc & writes the stale ones
+  // p_TilesPerSide 0 follows the tile count of an existing cache, else
+  // ceil(sqrt(worker count)), so a cache baked elsewhere stays valid
+  BakedTerrain bake (WorkerPool &p_Workers, const std::string &p_BaseFilename,
+                     const std::vector<uint8_t> &p_Heights, size_t p_XLength,
+                     size_t p_ZLength, size_t p_TilesPerSide,
+                     float p_MaxError, const Progress &p_Progress = {});
+
+  // Resolves a requested tiles per side against map size & worker count
+  size_t tilesPerSide (size_t p_Requested, size_t p_Workers,
+                       size_t p_XLength, size_t p_ZLength);
+
+  // Splits into p_Tiles x p_Tiles regions; every tile after the first on
+  // an axis starts on the last column/row of its neighbour so the shared
+  // border is emitted by both & no stitching is required
+  // Tiles start on render chunk boundaries so LOD sample points line up
+  // across tiles
+  std::vector<TileRegion> tileRegions (size_t p_XLength, size_t p_ZLength,
+                                       size_t p_Tiles);
+
+  // Hash of the source texels a tile is generated from, including the
+  // neighbouring row & column its edge normals read, combined with the
+  // generator version & parameters
+  uint64_t tileKey (const std::vector<uint8_t> &p_Heights, size_t p_XLength,
+                    size_t p_ZLength, const TileRegion &p_Region,
+                    size_t p_Tiles, float p_MaxError);
+
+  // Maps <base><idx>.mvtc if it was baked for this tile from the same
+  // source key; false => tile must be re-baked
+  bool readCachedTile (const std::string &p_BaseFilename, size_t p_Idx,
+                       size_t p_ChunkCount, uint64_t p_Key,
+                       Cache::TerrainChunk &p_Chunk);
+
+  // Looks for a complete set of <base>N.mvtc & reads chunk count from the
+  // first header; used only when the source image is unreadable
+  bool hasBinaryCache (const std::string &p_BaseFilename,
+                       size_t &p_ChunkCount);
+
+  // Writes <base><idx>.mvtc for each of p_Stale
+  void writeCache (WorkerPool &p_Workers, const std::string &p_BaseFilename,
+                   std::vector<TileMesh> &p_Tiles,
+                   const std::vector<size_t> &p_Stale,
+                   const std::vector<uint64_t> &p_Keys, float p_MaxError);
+
+  // Removes chunk files past p_ChunkCount left by a different tile layout
+  // & text caches <base>0_v.bin..<base>3_i.bin of older builds, which
+  // carry no source key
+  void removeStaleCache (const std::string &p_BaseFilename,
+                         size_t p_ChunkCount);
+
+  // converts to _v.bin filename
+  std::string filenameToBinV (const std::string &p_Filename);
+  // converts to _i.bin filename
+  std::string filenameToBinI (const std::string &p_Filename);
+
+  std::pair<glm::vec3, glm::vec3> getBounds (const Vertex *p_Vertices,
+                                             size_t p_VertexCount);
+
+  // Height of the level with p_Step quad wide cells at a chunk local texel
+  // Cells are split along the same diagonal as full resolution quads
+  float levelHeight (const std::vector<uint8_t> &p_Heights,
+                     size_t p_MapWidth, const ChunkRegion &p_Region,
+                     size_t p_Step, size_t p_X, size_t p_Z);
+
+  // Max height difference of every level from full resolution
+  void levelErrors (const std::vector<uint8_t> &p_Heights, size_t p_MapWidth,
+                    const ChunkRegion &p_Region, float *p_Errors);
+
+  // Chunk local positions sampled by a level with p_Step quad wide cells
+  std::vector<size_t> levelSamples (size_t p_Step, size_t p_Quads);
+
+  // Emits one vertex per texel of the inclusive region plus skirt vertices
+  // around every render chunk. Indices are local to the chunk's vertex
+  // block & grouped by level then render chunk so neighbouring chunks on
+  // the same level & block form one range
+  // p_MaxError > 0 decimates level 0 of full size chunks & drops texels
+  // no level references
+  TileMesh generateGrid (const std::vector<uint8_t> &p_Heights,
+                         size_t p_MapWidth, size_t p_X0, size_t p_Z0,
+                         size_t p_XCount, size_t p_ZCount, float p_MaxError);
+
+  // Gives consecutive render chunks their own vertex block of at most
+  // VERTEX_BLOCK_SIZE vertices & rewrites their indices relative to it
+  // Vertices shared across a block border are duplicated
+  void splitVertexBlocks (TileMesh &p_Tile);
+
+  // Packed Vertex::normal from height slopes p_Gx = dh/dx & p_Gz = dh/dz
+  // Up is -y so the surface normal is (-gx, -1, -gz)
+  uint32_t packTerrainNormal (float p_Gx, float p_Gz);
+
+  // Central difference normals of p_Count texels of map row p_Z starting
+  // at x = p_X0; one sided on the map edges. AVX2 when available
+  void packNormalRow (const std::vector<uint8_t> &p_Heights,
+                      size_t p_MapWidth, size_t p_Z, size_t p_X0,
+                      size_t p_Count, uint32_t *p_Out);
+
+#if defined(__x86_64__) || defined(__i386__)
+  // Interior texels from map x p_X, eight per step; p_X - 1 & every
+  // p_X + p_Count must be on the map. Returns texels done
+  __attribute__ ((target ("avx2"))) size_t
+  packNormalsAvx2 (const uint8_t *p_Row, const uint8_t *p_Above,
+                   const uint8_t *p_Below, float p_ZScale, size_t p_X,
+                   size_t p_Count, uint32_t *p_Out);
+#endif
+}; // namespace Terrain
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "mvImage.h"
+
+class Engine;
+
+// One texture shared by every model & map using it; owned by the registry
+struct SharedTexture
+{
+  // canonical path first loaded from
+  std::string path;
+  // content checksum & sampling settings
+  uint64_t key = 0;
+  Image image;
+  // combined image sampler at binding 0
+  vk::DescriptorSet descriptor;
+  size_t references = 0;
+  // last frame that may sample a released texture
+  uint64_t releasedFrame = 0;
+};
+
+/*
+  Engine wide texture registry
+
+  Textures are found by canonical path, then by a checksum of the file so
+  copies under other names are decoded & uploaded once. The last release
+  keeps a texture until frames submitted before it complete; acquiring it
+  again meanwhile revives it without a reload. Files are not watched, a path
+  already registered is never reread
+*/
+class TextureRegistry
+{
+public:
+  TextureRegistry (Engine *p_Engine);
+  ~TextureRegistry ();
+
+  // delete copy
+  TextureRegistry (const TextureRegistry &) = delete;
+  TextureRegistry &operator= (const TextureRegistry &) = delete;
+
+  static std::string canonicalPath (const std::string &p_Path);
+
+  // Checksum of the file, else of its texbake output; 0 => neither readable
+  // Vulkan free; callers may compute it on worker threads
+  static uint64_t contentChecksum (const std::string &p_Path);
+
+  // Adds a reference; loads p_Path with Image::create on a miss
+  SharedTexture *acquire (const std::string &p_Path,
+                          Image::ImageCreateInfo &p_ImageCreateInfo);
+
+  // As above; p_Create fills the image on a miss. p_Checksum is
+  // contentChecksum of p_Path
+  SharedTexture *acquire (const std::string &p_Path, uint64_t p_Checksum,
+                          Image::ImageCreateInfo &p_ImageCreateInfo,
+                          const std::function<void (Image &)> &p_Create);
+
+  // true => acquire would not load; takes no reference
+  bool contains (const std::string &p_Path, uint64_t p_Checksum,
+                 const Image::ImageCreateInfo &p_ImageCreateInfo) const;
+
+  void release (SharedTexture *p_Texture);
+
+  // Destroys released textures no frame in flight samples; frame boundary
+  void collect (void);
+
+  // Destroys everything; device must be idle
+  void cleanup (void);
+
+private:
+  Engine *engine = nullptr;
+
+  std::unordered_map<uint64_t, std::unique_ptr<SharedTexture>> textures;
+  // canonical path & settings => key
+  std::unordered_map<std::string, uint64_t> paths;
+  // sets of destroyed textures; pools never free single sets
+  std::vector<vk::DescriptorSet> spareSets;
+
+  static uint64_t settingsKey (const Image::ImageCreateInfo &p_Info);
+  static std::string pathKey (const std::string &p_CanonicalPath,
+                              const Image::ImageCreateInfo &p_Info);
+
+  // Live texture registered under p_PathKey; nullptr if none
+  SharedTexture *findPath (const std::string &p_PathKey) const;
+
+  void destroy (SharedTexture &p_Texture);
+};
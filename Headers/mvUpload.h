@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+class Engine;
+
+/*
+  Batched texture uploads
+
+  Texels are copied into one persistently mapped staging ring & every
+  transition & copy until the next submit is recorded into a single command
+  buffer. Each submit signals a fence that releases its part of the ring, so
+  the queue is never idled. The engine submits pending work ahead of every
+  frame on the same queue, which orders uploads before any draw sampling
+  the images
+*/
+class UploadBatcher
+{
+public:
+  static constexpr vk::DeviceSize DEFAULT_RING_SIZE = 32ull << 20;
+
+  // copyBufferToImage offsets must be a multiple of 4 & of the texel or
+  // block size
+  static constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+  UploadBatcher (Engine *p_Engine,
+                 vk::DeviceSize p_RingSize = DEFAULT_RING_SIZE);
+  ~UploadBatcher ();
+
+  // delete copy
+  UploadBatcher (const UploadBatcher &) = delete;
+  UploadBatcher &operator= (const UploadBatcher &) = delete;
+
+  // One level of a precomputed mip chain; tightly packed texels or blocks
+  struct MipLevel
+  {
+    const void *texels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+  };
+
+  // Records p_Image eUndefined -> transfer dst -> shader read only with
+  // level 0's tightly packed texels copied in. Levels past 0 are blitted
+  // from the one above; the format must support linear blits & the image
+  // transfer src usage
+  // Images larger than the free part of the ring are copied in bands of
+  // rows, submitting & waiting on older batches only when the ring is full
+  void uploadImage (vk::Image p_Image, uint32_t p_Width, uint32_t p_Height,
+                    size_t p_BytesPerTexel, const void *p_Texels,
+                    uint32_t p_MipLevels = 1);
+
+  // As above with every level of the chain given
+  // Block compressed levels pass the block size in texels per side & bytes
+  // per block in place of bytes per texel
+  void uploadImage (vk::Image p_Image, size_t p_BytesPerBlock,
+                    const std::vector<MipLevel> &p_Levels,
+                    uint32_t p_BlockDim = 1);
+
+  // Releases completed batches then submits recorded work if any; never
+  // waits
+  void submit (void);
+
+  // Submits then waits on every batch
+  void flush (void);
+
+  // Waits on outstanding batches & destroys the ring
+  void cleanup (void);
+
+private:
+  struct Batch
+  {
+    vk::CommandBuffer commandBuffer;
+    vk::Fence fence;
+    // ring position one past the batch's last staged byte
+    vk::DeviceSize end = 0;
+    // ring bytes held, including alignment & wrap padding
+    vk::DeviceSize bytes = 0;
+  };
+
+  Engine *engine = nullptr;
+  vk::CommandPool commandPool;
+  vk::Buffer ring;
+  vk::DeviceMemory ringMemory;
+  std::byte *mapped = nullptr;
+  vk::DeviceSize ringSize = 0;
+
+  // staged bytes are [tail, head) wrapping at ringSize
+  vk::DeviceSize head = 0;
+  vk::DeviceSize tail = 0;
+  vk::DeviceSize used = 0;
+
+  // commandBuffer is null until something is recorded
+  Batch recording;
+  std::deque<Batch> inFlight;
+
+  // Transitions levels [p_BaseLevel, p_BaseLevel + p_LevelCount)
+  void barrier (vk::Image p_Image, uint32_t p_BaseLevel,
+                uint32_t p_LevelCount, vk::ImageLayout p_OldLayout,
+                vk::ImageLayout p_NewLayout);
+
+  // Copies one level through the ring in bands of block rows
+  void stageLevel (vk::Image p_Image, uint32_t p_MipLevel, uint32_t p_Width,
+                   uint32_t p_Height, size_t p_BytesPerBlock,
+                   const void *p_Texels, uint32_t p_BlockDim = 1);
+
+  // Command buffer of the batch being recorded; begins one if needed
+  vk::CommandBuffer record (void);
+
+  // Largest contiguous free span of at least p_MinBytes; 0 => none
+  vk::DeviceSize available (vk::DeviceSize p_MinBytes,
+                            vk::DeviceSize &p_Offset) const;
+
+  // Marks [p_Offset, p_Offset + p_Bytes) staged by the recording batch
+  void commit (vk::DeviceSize p_Offset, vk::DeviceSize p_Bytes);
+
+  // Submits then waits on the oldest batch to free ring space
+  void makeRoom (void);
+
+  // Frees the oldest batch; it must have completed
+  void release (void);
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// Vertex layout shared by models & terrain; no vulkan dependency so the
+// offline bake tool can use it. Vulkan input descriptions are in mvModel.h
+
+// Contains...
+// glm::vec3 position
+// uint32_t uv
+// uint32_t normal
+// Colour is per material; see ModelData::materials
+struct Vertex
+{
+  // Float; terrain coordinates run past what half precision holds exactly
+  glm::vec3 position = { 0.0f, 0.0f, 0.0f };
+  // Two halfs, u | v << 16; half not unorm so model uvs may tile
+  // Terrain stores y offset to the next level & the level dropped after
+  uint32_t uv = 0;
+  // Octahedral unit normal folded about y as two snorm16, x | z << 16
+  // 0 decodes to -y (up)
+  uint32_t normal = 0;
+
+  inline void
+  setUV (glm::vec2 p_UV)
+  {
+    uv = glm::packHalf2x16 (p_UV);
+    return;
+  }
+
+  inline glm::vec2
+  getUV (void) const
+  {
+    return glm::unpackHalf2x16 (uv);
+  }
+
+  // Packs any non zero direction; y > 0 is folded onto the outer triangles
+  static inline uint32_t
+  packNormal (glm::vec3 p_Normal)
+  {
+    float l1 = std::abs (p_Normal.x) + std::abs (p_Normal.y)
+               + std::abs (p_Normal.z);
+    glm::vec2 p = glm::vec2 (p_Normal.x, p_Normal.z) / l1;
+    if (p_Normal.y > 0.0f)
+      {
+        glm::vec2 folded = glm::vec2 (1.0f) - glm::abs (glm::vec2 (p.y, p.x));
+        p.x = (p.x >= 0.0f) ? folded.x : -folded.x;
+        p.y = (p.y >= 0.0f) ? folded.y : -folded.y;
+      }
+    return glm::packSnorm2x16 (p);
+  }
+};
+static_assert (sizeof (Vertex) == 20, "Vertex layout changed; update "
+                                      "getVertexAttributeDescriptions");
@@ -48,6 +48,7 @@ class Window
   friend struct Collection;
   friend class Image;
   friend class Swap;
+  friend class UploadBatcher;
 
 public:
   // delete copy operations
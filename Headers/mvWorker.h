@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of threads pulling jobs from a shared queue
+// Created once & reused by every subsystem that needs parallel work
+class WorkerPool
+{
+public:
+  // 0 => one thread per hardware thread
+  explicit WorkerPool (size_t p_ThreadCount = 0);
+  // Finishes queued jobs then joins
+  ~WorkerPool ();
+
+  // delete copy
+  WorkerPool (const WorkerPool &) = delete;
+  WorkerPool &operator= (const WorkerPool &) = delete;
+
+  inline size_t
+  size (void) const noexcept
+  {
+    return threads.size ();
+  }
+
+  // Queue a job; exceptions are delivered through the future
+  template <typename Job>
+  auto
+  submit (Job &&p_Job) -> std::future<std::invoke_result_t<Job>>
+  {
+    using Result = std::invoke_result_t<Job>;
+
+    auto task = std::make_shared<std::packaged_task<Result ()>> (
+        std::forward<Job> (p_Job));
+    std::future<Result> result = task->get_future ();
+
+    enqueue ([task] () { (*task) (); });
+    return result;
+  }
+
+  // Calls p_Job (idx) for every idx in [0, p_Count) & blocks until all
+  // complete. Calling thread takes part so it is safe to nest inside a job.
+  // Rethrows the first exception raised by any index
+  void parallelFor (size_t p_Count, const std::function<void (size_t)> &p_Job);
+
+private:
+  std::vector<std::thread> threads;
+  std::queue<std::function<void ()>> jobs;
+  std::mutex mtx;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void enqueue (std::function<void ()> p_Job);
+  void workerLoop (void);
+};
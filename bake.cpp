@@ -0,0 +1,145 @@
+// Image decoding for Terrain::readHeights; the engine gets it from mvImage
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "mvTerrain.h"
+#include "mvWorker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+  Offline terrain bake
+
+  Writes the runtime cache (<base>N.mvtc) of every heightmap given or found
+  in a given directory, no vulkan or window required. Tiles whose source
+  texels & parameters match an existing cache are skipped
+
+  bake [--max-error e] [--tiles n] [--threads n] <heightmap|directory>...
+*/
+
+static void
+usage (void)
+{
+  std::cout << "usage: bake [--max-error e] [--tiles n] [--threads n] "
+               "<heightmap|directory>...\n"
+               "  --max-error  vertical error level 0 is decimated to; "
+               "must match the\n"
+               "               engine's decimation error (default 0)\n"
+               "  --tiles      tiles per side (default follows an existing "
+               "cache)\n"
+               "  --threads    worker threads (default one per hardware "
+               "thread)\n";
+  return;
+}
+
+// Extensions stb_image reads
+static bool
+isHeightmap (const std::filesystem::path &p_Path)
+{
+  auto extension = p_Path.extension ().string ();
+  std::transform (extension.begin (), extension.end (), extension.begin (),
+                  [] (unsigned char c) { return std::tolower (c); });
+  return extension == ".png" || extension == ".jpg" || extension == ".jpeg"
+         || extension == ".bmp" || extension == ".tga";
+}
+
+int
+main (int argc, char *argv[])
+{
+  float maxError = 0.0f;
+  size_t tiles = 0;
+  size_t threads = 0;
+  std::vector<std::filesystem::path> inputs;
+
+  try
+    {
+      for (int a = 1; a < argc; a++)
+        {
+          std::string arg = argv[a];
+          bool hasValue = a + 1 < argc;
+          if (arg == "--max-error" && hasValue)
+            maxError = std::max (std::stof (argv[++a]), 0.0f);
+          else if (arg == "--tiles" && hasValue)
+            tiles = std::stoul (argv[++a]);
+          else if (arg == "--threads" && hasValue)
+            threads = std::stoul (argv[++a]);
+          else if (arg.starts_with ("--"))
+            {
+              usage ();
+              return 1;
+            }
+          else
+            inputs.push_back (arg);
+        }
+    }
+  catch (std::exception &e)
+    {
+      std::cout << "Invalid argument => " << e.what () << "\n";
+      usage ();
+      return 1;
+    }
+
+  if (inputs.empty ())
+    {
+      usage ();
+      return 1;
+    }
+
+  // Directories are searched recursively
+  std::vector<std::filesystem::path> heightmaps;
+  for (const auto &input : inputs)
+    {
+      std::error_code error;
+      if (std::filesystem::is_directory (input, error))
+        {
+          for (const auto &entry :
+               std::filesystem::recursive_directory_iterator (input))
+            if (entry.is_regular_file () && isHeightmap (entry.path ()))
+              heightmaps.push_back (entry.path ());
+        }
+      else
+        {
+          heightmaps.push_back (input);
+        }
+    }
+  std::sort (heightmaps.begin (), heightmaps.end ());
+
+  WorkerPool workers (threads);
+  std::cout << "Baking " << heightmaps.size () << " heightmaps on "
+            << workers.size () << " workers\n";
+
+  // Maps bake side by side; each map's tiles nest on the same pool
+  auto start = std::chrono::steady_clock::now ();
+  std::atomic<size_t> failed = 0;
+  workers.parallelFor (heightmaps.size (), [&] (size_t idx) {
+    const std::string filename = heightmaps.at (idx).string ();
+    try
+      {
+        size_t xLength = 0;
+        size_t zLength = 0;
+        auto heights = Terrain::readHeights (filename, xLength, zLength);
+        Terrain::bake (workers, Terrain::getBaseFilename (filename), heights,
+                       xLength, zLength, tiles, maxError);
+      }
+    catch (std::exception &e)
+      {
+        std::cout << "Failed to bake " << filename << " => " << e.what ()
+                  << "\n";
+        failed++;
+      }
+  });
+
+  std::chrono::duration<double, std::milli> elapsed
+      = std::chrono::steady_clock::now () - start;
+  std::cout << "Baked " << heightmaps.size () - failed << " of "
+            << heightmaps.size () << " heightmaps in " << elapsed.count ()
+            << " ms\n";
+  return failed == 0 ? 0 : 1;
+}
@@ -3,10 +3,15 @@
 
 layout(location = 0) in vec4 in_color;
 layout(location = 1) in vec4 in_uv;
+layout(location = 2) in vec3 in_normal;
 
 layout(location = 0) out vec4 out_color;
 
+// Direction toward the sun; -y is up
+const vec3 to_sun = normalize(vec3(0.3, -1.0, 0.4));
+const float ambient = 0.25;
+
 void main() {
-    
-    out_color = in_color;
+    float lambert = max(dot(normalize(in_normal), to_sun), 0.0);
+    out_color = vec4(in_color.rgb * (ambient + (1.0 - ambient) * lambert), in_color.a);
 }
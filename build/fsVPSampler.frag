@@ -5,12 +5,19 @@ layout(set = 2, binding = 0) uniform sampler2D texture_sampler;
 
 layout(location = 0) in vec4 in_color;
 layout(location = 1) in vec4 in_uv;
+layout(location = 2) in vec3 in_normal;
 
 layout(location = 0) out vec4 out_color;
 
+// Direction toward the sun; -y is up
+const vec3 to_sun = normalize(vec3(0.3, -1.0, 0.4));
+const float ambient = 0.25;
+
 void main() {
     vec2 uv_formatted = vec2(in_uv.x, in_uv.y);
-    out_color = texture(texture_sampler, uv_formatted);
+    float lambert = max(dot(normalize(in_normal), to_sun), 0.0);
+    vec4 albedo = texture(texture_sampler, uv_formatted);
+    out_color = vec4(albedo.rgb * (ambient + (1.0 - ambient) * lambert), albedo.a);
 }
 
 
@@ -13,18 +13,22 @@ layout(set = 2, binding = 0) uniform ProjectionUniform {
     mat4 mat;
 } ubo_proj;
 
-layout(location = 0) in vec4 in_position;
-layout(location = 1) in vec4 in_uv;
-layout(location = 2) in vec4 in_color;
+// Diffuse colour of the material being drawn
+layout(push_constant) uniform Material {
+    vec4 color;
+} material;
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec2 in_uv;
 
 layout(location = 0) out vec4 out_color;
 layout(location = 1) out vec4 out_uv;
 
 void main() {
     gl_PointSize = 2.0f;
-    gl_Position = ubo_proj.mat * ubo_view.mat * ubo_obj.model * in_position;
-    out_color = in_color;
-    out_uv = in_uv;
+    gl_Position = ubo_proj.mat * ubo_view.mat * ubo_obj.model * vec4(in_position, 1.0);
+    out_color = material.color;
+    out_uv = vec4(in_uv, 0.0, 0.0);
 }
 
 
@@ -0,0 +1,72 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Heightfield terrain; no vertex buffer, positions come from gl_VertexIndex
+// into a flat patch & heights from the heightmap
+
+layout(set = 0, binding = 0) uniform ViewUniform {
+    mat4 mat;
+} ubo_view;
+
+layout(set = 1, binding = 0) uniform ProjectionUniform {
+    mat4 mat;
+} ubo_proj;
+
+// R8 unorm heightmap, one texel per map vertex
+layout(set = 3, binding = 0) uniform sampler2D height_sampler;
+
+// Chunk being drawn
+// Patch at level l is (64 >> l) + 1 vertices per side; ids past the patch
+// are the same vertices repeated as skirts
+layout(push_constant) uniform TerrainPatch {
+    int level;
+    float morph;
+    ivec2 origin;
+    ivec2 quads;
+    float skirt_depth;
+} chunk;
+
+layout(location = 0) out vec4 out_color;
+layout(location = 1) out vec4 out_uv;
+layout(location = 2) out vec3 out_normal;
+
+const int CHUNK_QUADS = 64;
+
+float height_at(ivec2 texel) {
+    ivec2 size = textureSize(height_sampler, 0);
+    return texelFetch(height_sampler, clamp(texel, ivec2(0), size - 1), 0).r * 255.0;
+}
+
+void main() {
+    int side = (CHUNK_QUADS >> chunk.level) + 1;
+    int id = gl_VertexIndex;
+    bool is_skirt = id >= side * side;
+    if (is_skirt)
+        id -= side * side;
+
+    // odd vertices slide onto their even neighbour so at morph 1 the patch
+    // matches the next level
+    vec2 grid = vec2(id % side, id / side);
+    grid -= fract(grid * 0.5) * 2.0 * chunk.morph;
+
+    // partial chunks on the map edge collapse the overhang onto the edge
+    vec2 texel = vec2(chunk.origin) + min(grid * float(1 << chunk.level), vec2(chunk.quads));
+
+    vec2 size = vec2(textureSize(height_sampler, 0));
+    float height = textureLod(height_sampler, (texel + 0.5) / size, 0.0).r * 255.0;
+
+    vec4 position = vec4(texel.x, -height, texel.y, 1.0);
+    if (is_skirt)
+        position.y += chunk.skirt_depth;
+
+    // central differences like the mesh normals; up is -y
+    ivec2 t = ivec2(texel);
+    float gx = (height_at(t + ivec2(1, 0)) - height_at(t - ivec2(1, 0))) * 0.5;
+    float gz = (height_at(t + ivec2(0, 1)) - height_at(t - ivec2(0, 1))) * 0.5;
+
+    gl_Position = ubo_proj.mat * ubo_view.mat * position;
+    out_color = vec4(1.0);
+    out_uv = vec4(0.0);
+    out_normal = normalize(vec3(-gx, -1.0, -gz));
+}
+
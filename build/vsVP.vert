@@ -9,18 +9,40 @@ layout(set = 1, binding = 0) uniform ProjectionUniform {
     mat4 mat;
 } ubo_proj;
 
-layout(location = 0) in vec4 in_position;
-layout(location = 1) in vec4 in_uv;
-layout(location = 2) in vec4 in_color;
+// Level of detail of the chunk being drawn
+// Vertices dropped by the next level slide onto it as morph goes 0 -> 1
+layout(push_constant) uniform TerrainLod {
+    int level;
+    float morph;
+} lod;
+
+layout(location = 0) in vec3 in_position;
+// x height offset on next level, y level vertex is dropped after
+layout(location = 1) in vec2 in_lod;
+// octahedral, folded about y
+layout(location = 2) in vec2 in_normal;
 
 layout(location = 0) out vec4 out_color;
 layout(location = 1) out vec4 out_uv;
+layout(location = 2) out vec3 out_normal;
+
+vec3 decode_normal(vec2 p) {
+    vec3 n = vec3(p.x, -(1.0 - abs(p.x) - abs(p.y)), p.y);
+    float t = max(n.y, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.z += n.z >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main() {
+    vec4 position = vec4(in_position, 1.0);
+    if (int(in_lod.y) == lod.level)
+        position.y += in_lod.x * lod.morph;
+
     gl_PointSize = 2.0f;
-    gl_Position = ubo_proj.mat * ubo_view.mat * mat4(1.0) * in_position;
-    out_color = in_color;
-    out_uv = in_uv;
+    gl_Position = ubo_proj.mat * ubo_view.mat * mat4(1.0) * position;
+    out_color = vec4(1.0);
+    out_uv = vec4(0.0);
+    out_normal = decode_normal(in_normal);
 }
 
-
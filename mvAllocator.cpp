@@ -2,6 +2,8 @@
 #include "mvEngine.h"
 #include "mvModel.h"
 
+#include <unordered_set>
+
 extern LogHandler logger;
 
 Allocator::Allocator (Engine *p_Engine)
@@ -64,7 +66,7 @@ Allocator::getLayout (vk::DescriptorType p_LayoutType)
 
 void
 Allocator::createLayout (vk::DescriptorType p_DescriptorType, uint32_t p_Count,
-                         vk::ShaderStageFlagBits p_ShaderStageFlags,
+                         vk::ShaderStageFlags p_ShaderStageFlags,
                          uint32_t p_Binding)
 {
   vk::DescriptorSetLayoutBinding bindInfo;
@@ -425,29 +427,64 @@ Allocator::loadModel (std::vector<Model> *p_Models,
                       std::vector<std::string> *p_ModelNames,
                       const char *p_Filename)
 {
-  bool alreadyLoaded = false;
-  for (const auto &name : *p_ModelNames)
+  loadModels (p_Models, p_ModelNames, { p_Filename });
+  return;
+}
+
+void
+Allocator::loadModels (std::vector<Model> *p_Models,
+                       std::vector<std::string> *p_ModelNames,
+                       const std::vector<std::string> &p_Filenames)
+{
+  std::vector<std::string> pending;
+  for (const auto &filename : p_Filenames)
     {
-      if (name.compare (p_Filename) == 0) // if same
+      if (std::find (p_ModelNames->begin (), p_ModelNames->end (), filename)
+              != p_ModelNames->end ()
+          || std::find (pending.begin (), pending.end (), filename)
+                 != pending.end ())
         {
           logger.logMessage (LogHandler::MessagePriority::eWarning,
                              "Skipping already loaded model name => "
-                                 + std::string (p_Filename));
-          alreadyLoaded = true;
-          break;
+                                 + filename);
+          continue;
         }
+      logger.logMessage ("Loading model => " + filename);
+      pending.push_back (filename);
     }
 
-  if (!alreadyLoaded)
+  // CPU side import; each job owns its assimp importer
+  std::vector<ModelData> imported (pending.size ());
+  engine->workers.parallelFor (pending.size (), [&] (size_t idx) {
+    imported.at (idx) = Model::import (pending.at (idx).c_str ());
+  });
+
+  // Only textures neither registered nor repeated within the batch are
+  // decoded; the rest resolve to the first copy at upload
+  const Image::ImageCreateInfo textureInfo = Model::textureCreateInfo ();
+  std::vector<TextureData *> decoding;
+  std::unordered_set<uint64_t> checksums;
+  for (auto &data : imported)
+    for (auto &tex : data.textures)
+      if (!engine->textures->contains (tex.path, tex.checksum, textureInfo)
+          && checksums.insert (tex.checksum).second)
+        decoding.push_back (&tex);
+  engine->workers.parallelFor (decoding.size (), [&] (size_t idx) {
+    Model::decodeTexture (*decoding.at (idx));
+  });
+
+  // GPU resources are created on this thread only
+  for (size_t idx = 0; idx < pending.size (); idx++)
     {
-      logger.logMessage ("Loading model => " + std::string (p_Filename));
       // make space for new model
       p_Models->push_back (Model ());
-      // call model routine _load
-      p_Models->back ().load (engine, *this, p_Filename, false);
+      p_Models->back ().upload (engine, imported.at (idx), false);
 
       // add filename to model_names container
-      p_ModelNames->push_back (p_Filename);
+      p_ModelNames->push_back (pending.at (idx));
+
+      // release CPU copy before the next upload
+      imported.at (idx) = {};
     }
   return;
 }
@@ -0,0 +1,448 @@
+#include "mvBlockCompress.h"
+#include "mvWorker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace BlockCompress
+{
+  namespace
+  {
+    constexpr size_t BLOCK_TEXELS = BLOCK_DIM * BLOCK_DIM;
+
+    // Principal axis iterations; converges well before this on 16 texels
+    constexpr int POWER_ITERATIONS = 8;
+
+    // Fraction of c0 in each 4 colour palette entry
+    constexpr float PALETTE_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f,
+                                           1.0f / 3.0f };
+
+    uint16_t
+    packColour (const float *p_Colour)
+    {
+      auto quantize = [] (float p_Value, float p_Max) {
+        return static_cast<uint16_t> (
+            std::clamp (std::round (p_Value * p_Max / 255.0f), 0.0f, p_Max));
+      };
+      return static_cast<uint16_t> (quantize (p_Colour[0], 31.0f) << 11
+                                    | quantize (p_Colour[1], 63.0f) << 5
+                                    | quantize (p_Colour[2], 31.0f));
+    }
+
+    void
+    unpackColour (uint16_t p_Packed, int *p_Colour)
+    {
+      int r = (p_Packed >> 11) & 31;
+      int g = (p_Packed >> 5) & 63;
+      int b = p_Packed & 31;
+      p_Colour[0] = (r << 3) | (r >> 2);
+      p_Colour[1] = (g << 2) | (g >> 4);
+      p_Colour[2] = (b << 3) | (b >> 2);
+      return;
+    }
+
+    // 4 colour palette of two endpoints
+    void
+    colourPalette (uint16_t p_C0, uint16_t p_C1, int p_Palette[4][3])
+    {
+      unpackColour (p_C0, p_Palette[0]);
+      unpackColour (p_C1, p_Palette[1]);
+      for (int c = 0; c < 3; c++)
+        {
+          p_Palette[2][c] = (2 * p_Palette[0][c] + p_Palette[1][c]) / 3;
+          p_Palette[3][c] = (p_Palette[0][c] + 2 * p_Palette[1][c]) / 3;
+        }
+      return;
+    }
+
+    // Nearest palette entry per texel; returns summed squared error
+    int
+    fitIndices (const uint8_t *p_Rgba, uint16_t p_C0, uint16_t p_C1,
+                uint8_t *p_Indices)
+    {
+      int palette[4][3];
+      colourPalette (p_C0, p_C1, palette);
+
+      int total = 0;
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        {
+          const uint8_t *texel = p_Rgba + i * 4;
+          int best = 0;
+          int bestError = INT32_MAX;
+          for (int p = 0; p < 4; p++)
+            {
+              int error = 0;
+              for (int c = 0; c < 3; c++)
+                {
+                  int d = texel[c] - palette[p][c];
+                  error += d * d;
+                }
+              if (error < bestError)
+                {
+                  best = p;
+                  bestError = error;
+                }
+            }
+          p_Indices[i] = static_cast<uint8_t> (best);
+          total += bestError;
+        }
+      return total;
+    }
+
+    // Least squares endpoints for fixed indices; false if degenerate
+    bool
+    refineEndpoints (const uint8_t *p_Rgba, const uint8_t *p_Indices,
+                     float *p_E0, float *p_E1)
+    {
+      float aa = 0.0f;
+      float bb = 0.0f;
+      float ab = 0.0f;
+      float ax[3] = {};
+      float bx[3] = {};
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        {
+          float w = PALETTE_WEIGHTS[p_Indices[i]];
+          aa += w * w;
+          bb += (1.0f - w) * (1.0f - w);
+          ab += w * (1.0f - w);
+          for (int c = 0; c < 3; c++)
+            {
+              ax[c] += w * p_Rgba[i * 4 + c];
+              bx[c] += (1.0f - w) * p_Rgba[i * 4 + c];
+            }
+        }
+
+      float det = aa * bb - ab * ab;
+      if (std::fabs (det) < 1e-6f)
+        return false;
+
+      for (int c = 0; c < 3; c++)
+        {
+          p_E0[c] = (bb * ax[c] - ab * bx[c]) / det;
+          p_E1[c] = (aa * bx[c] - ab * ax[c]) / det;
+        }
+      return true;
+    }
+
+    // 8 byte colour block; p_Rgba is 16 texels
+    void
+    encodeColour (const uint8_t *p_Rgba, uint8_t *p_Block)
+    {
+      float mean[3] = {};
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        for (int c = 0; c < 3; c++)
+          mean[c] += p_Rgba[i * 4 + c];
+      for (int c = 0; c < 3; c++)
+        mean[c] /= BLOCK_TEXELS;
+
+      float cov[6] = {};
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        {
+          float r = p_Rgba[i * 4 + 0] - mean[0];
+          float g = p_Rgba[i * 4 + 1] - mean[1];
+          float b = p_Rgba[i * 4 + 2] - mean[2];
+          cov[0] += r * r;
+          cov[1] += r * g;
+          cov[2] += r * b;
+          cov[3] += g * g;
+          cov[4] += g * b;
+          cov[5] += b * b;
+        }
+
+      float axis[3] = { 1.0f, 1.0f, 1.0f };
+      for (int it = 0; it < POWER_ITERATIONS; it++)
+        {
+          float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+          float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+          float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+          float length = std::max ({ std::fabs (x), std::fabs (y),
+                                     std::fabs (z) });
+          if (length < 1e-6f)
+            break;
+          axis[0] = x / length;
+          axis[1] = y / length;
+          axis[2] = z / length;
+        }
+
+      float minT = 0.0f;
+      float maxT = 0.0f;
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        {
+          float t = 0.0f;
+          for (int c = 0; c < 3; c++)
+            t += (p_Rgba[i * 4 + c] - mean[c]) * axis[c];
+          minT = std::min (minT, t);
+          maxT = std::max (maxT, t);
+        }
+
+      // inset by 1/16 of the range; extremes are rarely worth an endpoint
+      float inset = (maxT - minT) / 16.0f;
+      float e0[3];
+      float e1[3];
+      for (int c = 0; c < 3; c++)
+        {
+          e0[c] = mean[c] + axis[c] * (maxT - inset);
+          e1[c] = mean[c] + axis[c] * (minT + inset);
+        }
+
+      uint16_t c0 = packColour (e0);
+      uint16_t c1 = packColour (e1);
+      uint8_t indices[BLOCK_TEXELS];
+      int error = fitIndices (p_Rgba, c0, c1, indices);
+
+      if (c0 != c1 && refineEndpoints (p_Rgba, indices, e0, e1))
+        {
+          uint16_t r0 = packColour (e0);
+          uint16_t r1 = packColour (e1);
+          uint8_t refined[BLOCK_TEXELS];
+          if (fitIndices (p_Rgba, r0, r1, refined) < error)
+            {
+              c0 = r0;
+              c1 = r1;
+              std::memcpy (indices, refined, sizeof (indices));
+            }
+        }
+
+      // c0 > c1 selects 4 colour mode in BC1; equal endpoints would be 3
+      // colour mode where index 3 is transparent black
+      if (c0 < c1)
+        {
+          std::swap (c0, c1);
+          for (auto &idx : indices)
+            idx ^= 1;
+        }
+      if (c0 == c1)
+        std::fill (std::begin (indices), std::end (indices), 0);
+
+      uint32_t bits = 0;
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        bits |= uint32_t (indices[i]) << (i * 2);
+
+      p_Block[0] = c0 & 0xff;
+      p_Block[1] = c0 >> 8;
+      p_Block[2] = c1 & 0xff;
+      p_Block[3] = c1 >> 8;
+      for (int b = 0; b < 4; b++)
+        p_Block[4 + b] = (bits >> (b * 8)) & 0xff;
+      return;
+    }
+
+    void
+    decodeColour (const uint8_t *p_Block, uint8_t *p_Rgba,
+                  bool p_AllowTransparent)
+    {
+      uint16_t c0 = p_Block[0] | (p_Block[1] << 8);
+      uint16_t c1 = p_Block[2] | (p_Block[3] << 8);
+      int palette[4][3];
+      colourPalette (c0, c1, palette);
+
+      bool threeColour = p_AllowTransparent && c0 <= c1;
+      if (threeColour)
+        for (int c = 0; c < 3; c++)
+          {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+          }
+
+      uint32_t bits = p_Block[4] | (p_Block[5] << 8) | (p_Block[6] << 16)
+                      | (uint32_t (p_Block[7]) << 24);
+      for (size_t i = 0; i < BLOCK_TEXELS; i++)
+        {
+          int idx = (bits >> (i * 2)) & 3;
+          for (int c = 0; c < 3; c++)
+            p_Rgba[i * 4 + c] = static_cast<uint8_t> (palette[idx][c]);
+          p_Rgba[i * 4 + 3] = (threeColour && idx == 3) ? 0 : 255;
+        }
+      return;
+    }
+
+    // Gathers the 4x4 block at block (p_Bx, p_Bz), repeating edge texels
+    void
+    gatherBlock (const uint8_t *p_Rgba, uint32_t p_Width, uint32_t p_Height,
+                 uint32_t p_Bx, uint32_t p_Bz, uint8_t *p_Block)
+    {
+      for (uint32_t z = 0; z < BLOCK_DIM; z++)
+        {
+          uint32_t sz = std::min (p_Bz * BLOCK_DIM + z, p_Height - 1);
+          for (uint32_t x = 0; x < BLOCK_DIM; x++)
+            {
+              uint32_t sx = std::min (p_Bx * BLOCK_DIM + x, p_Width - 1);
+              std::memcpy (p_Block + (z * BLOCK_DIM + x) * 4,
+                           p_Rgba + (size_t (sz) * p_Width + sx) * 4, 4);
+            }
+        }
+      return;
+    }
+  }; // namespace
+
+  size_t
+  blockBytes (Format p_Format)
+  {
+    return p_Format == Format::eBC1 ? 8 : 16;
+  }
+
+  size_t
+  imageBytes (Format p_Format, uint32_t p_Width, uint32_t p_Height)
+  {
+    return size_t (blockCount (p_Width)) * blockCount (p_Height)
+           * blockBytes (p_Format);
+  }
+
+  bool
+  isOpaque (const uint8_t *p_Rgba, size_t p_TexelCount)
+  {
+    for (size_t i = 0; i < p_TexelCount; i++)
+      if (p_Rgba[i * 4 + 3] != 255)
+        return false;
+    return true;
+  }
+
+  void
+  encodeBC1Block (const uint8_t *p_Rgba, uint8_t *p_Block)
+  {
+    encodeColour (p_Rgba, p_Block);
+    return;
+  }
+
+  void
+  encodeBC3Block (const uint8_t *p_Rgba, uint8_t *p_Block)
+  {
+    uint8_t a0 = 0;
+    uint8_t a1 = 255;
+    for (size_t i = 0; i < BLOCK_TEXELS; i++)
+      {
+        a0 = std::max (a0, p_Rgba[i * 4 + 3]);
+        a1 = std::min (a1, p_Rgba[i * 4 + 3]);
+      }
+
+    // a0 > a1 selects 8 value mode; equal endpoints need index 0 only
+    uint64_t bits = 0;
+    if (a0 > a1)
+      {
+        int palette[8] = { a0, a1 };
+        for (int p = 1; p < 7; p++)
+          palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+
+        for (size_t i = 0; i < BLOCK_TEXELS; i++)
+          {
+            int alpha = p_Rgba[i * 4 + 3];
+            int best = 0;
+            for (int p = 1; p < 8; p++)
+              if (std::abs (palette[p] - alpha)
+                  < std::abs (palette[best] - alpha))
+                best = p;
+            bits |= uint64_t (best) << (i * 3);
+          }
+      }
+
+    p_Block[0] = a0;
+    p_Block[1] = a1;
+    for (int b = 0; b < 6; b++)
+      p_Block[2 + b] = (bits >> (b * 8)) & 0xff;
+
+    // BC3 colour is always 4 colour mode regardless of endpoint order
+    encodeColour (p_Rgba, p_Block + 8);
+    return;
+  }
+
+  void
+  decodeBC1Block (const uint8_t *p_Block, uint8_t *p_Rgba)
+  {
+    decodeColour (p_Block, p_Rgba, true);
+    return;
+  }
+
+  void
+  decodeBC3Block (const uint8_t *p_Block, uint8_t *p_Rgba)
+  {
+    decodeColour (p_Block + 8, p_Rgba, false);
+
+    int a0 = p_Block[0];
+    int a1 = p_Block[1];
+    int palette[8] = { a0, a1 };
+    if (a0 > a1)
+      {
+        for (int p = 1; p < 7; p++)
+          palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+      }
+    else
+      {
+        for (int p = 1; p < 5; p++)
+          palette[p + 1] = ((5 - p) * a0 + p * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+      }
+
+    uint64_t bits = 0;
+    for (int b = 0; b < 6; b++)
+      bits |= uint64_t (p_Block[2 + b]) << (b * 8);
+    for (size_t i = 0; i < BLOCK_TEXELS; i++)
+      p_Rgba[i * 4 + 3]
+          = static_cast<uint8_t> (palette[(bits >> (i * 3)) & 7]);
+    return;
+  }
+
+  std::vector<uint8_t>
+  encode (WorkerPool &p_Workers, Format p_Format, const uint8_t *p_Rgba,
+          uint32_t p_Width, uint32_t p_Height)
+  {
+    if (p_Width == 0 || p_Height == 0)
+      throw std::runtime_error ("Attempted to compress an empty image");
+
+    uint32_t xBlocks = blockCount (p_Width);
+    uint32_t zBlocks = blockCount (p_Height);
+    size_t bytes = blockBytes (p_Format);
+    std::vector<uint8_t> blocks (size_t (xBlocks) * zBlocks * bytes);
+
+    p_Workers.parallelFor (zBlocks, [&] (size_t bz) {
+      uint8_t texels[BLOCK_TEXELS * 4];
+      uint8_t *out = blocks.data () + bz * xBlocks * bytes;
+      for (uint32_t bx = 0; bx < xBlocks; bx++, out += bytes)
+        {
+          gatherBlock (p_Rgba, p_Width, p_Height, bx,
+                       static_cast<uint32_t> (bz), texels);
+          if (p_Format == Format::eBC1)
+            encodeBC1Block (texels, out);
+          else
+            encodeBC3Block (texels, out);
+        }
+    });
+    return blocks;
+  }
+
+  std::vector<uint8_t>
+  decode (Format p_Format, const uint8_t *p_Blocks, uint32_t p_Width,
+          uint32_t p_Height)
+  {
+    uint32_t xBlocks = blockCount (p_Width);
+    uint32_t zBlocks = blockCount (p_Height);
+    size_t bytes = blockBytes (p_Format);
+    std::vector<uint8_t> rgba (size_t (p_Width) * p_Height * 4);
+
+    uint8_t texels[BLOCK_TEXELS * 4];
+    for (uint32_t bz = 0; bz < zBlocks; bz++)
+      for (uint32_t bx = 0; bx < xBlocks; bx++)
+        {
+          const uint8_t *block
+              = p_Blocks + (size_t (bz) * xBlocks + bx) * bytes;
+          if (p_Format == Format::eBC1)
+            decodeBC1Block (block, texels);
+          else
+            decodeBC3Block (block, texels);
+
+          // drop texels past the edge
+          for (uint32_t z = 0; z < BLOCK_DIM; z++)
+            for (uint32_t x = 0; x < BLOCK_DIM; x++)
+              {
+                uint32_t tx = bx * BLOCK_DIM + x;
+                uint32_t tz = bz * BLOCK_DIM + z;
+                if (tx < p_Width && tz < p_Height)
+                  std::memcpy (&rgba[(size_t (tz) * p_Width + tx) * 4],
+                               texels + (z * BLOCK_DIM + x) * 4, 4);
+              }
+        }
+    return rgba;
+  }
+}; // namespace BlockCompress
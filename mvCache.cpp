@@ -0,0 +1,451 @@
+#include "mvCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Cache
+{
+  namespace
+  {
+    // sections are hashed separately so the writer does not need them in
+    // one contiguous allocation
+    uint64_t
+    payloadChecksum (const void *p_Vertices, size_t p_VertexBytes,
+                     const void *p_Indices, size_t p_IndexBytes,
+                     const void *p_RenderChunks,
+                     size_t p_RenderChunkBytes) noexcept
+    {
+      uint64_t v = checksum (p_Vertices, p_VertexBytes);
+      uint64_t i = checksum (p_Indices, p_IndexBytes);
+      uint64_t c = checksum (p_RenderChunks, p_RenderChunkBytes);
+      return v ^ ((i << 17) | (i >> 47)) ^ ((c << 34) | (c >> 30));
+    }
+
+    // model tables are hashed on top of the terrain sections
+    uint64_t
+    modelChecksum (const void *p_Meshes, size_t p_MeshBytes,
+                   const void *p_Textures, size_t p_TextureBytes,
+                   const void *p_Materials, size_t p_MaterialBytes,
+                   const void *p_Vertices, size_t p_VertexBytes,
+                   const void *p_Indices, size_t p_IndexBytes) noexcept
+    {
+      uint64_t t = checksum (p_Textures, p_TextureBytes);
+      uint64_t m = checksum (p_Materials, p_MaterialBytes);
+      return payloadChecksum (p_Vertices, p_VertexBytes, p_Indices,
+                              p_IndexBytes, p_Meshes, p_MeshBytes)
+             ^ ((t << 51) | (t >> 13)) ^ ((m << 29) | (m >> 35));
+    }
+  }; // namespace
+
+  MappedFile::MappedFile (const std::string &p_Filename)
+  {
+    open (p_Filename);
+    return;
+  }
+
+  MappedFile::~MappedFile () { close (); }
+
+  MappedFile::MappedFile (MappedFile &&p_Other) noexcept
+  {
+    mapping = p_Other.mapping;
+    length = p_Other.length;
+    p_Other.mapping = nullptr;
+    p_Other.length = 0;
+  }
+
+  MappedFile &
+  MappedFile::operator= (MappedFile &&p_Other) noexcept
+  {
+    if (this != &p_Other)
+      {
+        close ();
+        mapping = p_Other.mapping;
+        length = p_Other.length;
+        p_Other.mapping = nullptr;
+        p_Other.length = 0;
+      }
+    return *this;
+  }
+
+  void
+  MappedFile::open (const std::string &p_Filename)
+  {
+    close ();
+
+    int fd = ::open (p_Filename.c_str (), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error ("Failed to open cache file " + p_Filename);
+
+    struct stat fileInfo = {};
+    if (::fstat (fd, &fileInfo) != 0 || fileInfo.st_size <= 0)
+      {
+        ::close (fd);
+        throw std::runtime_error ("Cache file is empty or unreadable => "
+                                  + p_Filename);
+      }
+
+    length = static_cast<size_t> (fileInfo.st_size);
+    void *ptr = ::mmap (nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // mapping holds its own reference to the file
+    ::close (fd);
+
+    if (ptr == MAP_FAILED)
+      {
+        length = 0;
+        throw std::runtime_error ("Failed to memory map cache file => "
+                                  + p_Filename);
+      }
+
+    // payload is consumed front to back exactly once
+    ::madvise (ptr, length, MADV_SEQUENTIAL);
+    ::madvise (ptr, length, MADV_WILLNEED);
+
+    mapping = ptr;
+    return;
+  }
+
+  void
+  MappedFile::close (void) noexcept
+  {
+    if (mapping)
+      ::munmap (mapping, length);
+    mapping = nullptr;
+    length = 0;
+    return;
+  }
+
+  uint64_t
+  checksum (const void *p_Data, size_t p_Size) noexcept
+  {
+    constexpr uint64_t prime = 0x100000001b3ULL;
+    const auto *bytes = static_cast<const unsigned char *> (p_Data);
+
+    uint64_t lanes[4] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL,
+                          0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL };
+
+    size_t offset = 0;
+    for (; offset + 32 <= p_Size; offset += 32)
+      {
+        for (size_t l = 0; l < 4; l++)
+          {
+            uint64_t word;
+            std::memcpy (&word, bytes + offset + l * 8, sizeof (word));
+            lanes[l] = (lanes[l] ^ word) * prime;
+          }
+      }
+
+    uint64_t hash = p_Size * prime;
+    for (size_t l = 0; l < 4; l++)
+      {
+        hash = (hash ^ lanes[l]) * prime;
+        hash ^= hash >> 29;
+      }
+
+    // tail bytes
+    for (; offset < p_Size; offset++)
+      hash = (hash ^ bytes[offset]) * prime;
+
+    return hash ^ (hash >> 32);
+  }
+
+  std::string
+  terrainChunkFilename (const std::string &p_BaseFilename,
+                        size_t p_ChunkIndex)
+  {
+    return p_BaseFilename + std::to_string (p_ChunkIndex) + ".mvtc";
+  }
+
+  bool
+  peekTerrainHeader (const std::string &p_Filename, uint32_t p_VertexStride,
+                     TerrainHeader &p_Header)
+  {
+    std::ifstream file (p_Filename, std::ios::binary);
+    if (!file.is_open ())
+      return false;
+
+    TerrainHeader header;
+    if (!file.read (reinterpret_cast<char *> (&header), sizeof (header)))
+      return false;
+
+    if (header.magic != TERRAIN_MAGIC || header.version != TERRAIN_VERSION
+        || header.vertexStride != p_VertexStride
+        || header.indexStride != sizeof (uint32_t))
+      return false;
+
+    p_Header = header;
+    return true;
+  }
+
+  void
+  readTerrainChunk (const std::string &p_Filename, uint32_t p_VertexStride,
+                    TerrainChunk &p_Chunk)
+  {
+    p_Chunk.file.open (p_Filename);
+
+    const std::byte *base = p_Chunk.file.data ();
+    size_t size = p_Chunk.file.size ();
+
+    if (size < sizeof (TerrainHeader))
+      throw std::runtime_error ("Truncated terrain cache header => "
+                                + p_Filename);
+
+    const auto *header = reinterpret_cast<const TerrainHeader *> (base);
+
+    if (header->magic != TERRAIN_MAGIC)
+      throw std::runtime_error ("Not a terrain cache file => " + p_Filename);
+
+    if (header->version != TERRAIN_VERSION)
+      throw std::runtime_error ("Terrain cache version mismatch => "
+                                + p_Filename);
+
+    if (header->vertexStride != p_VertexStride
+        || header->indexStride != sizeof (uint32_t))
+      throw std::runtime_error ("Terrain cache vertex layout mismatch => "
+                                + p_Filename);
+
+    size_t vertexBytes = header->vertexCount * header->vertexStride;
+    size_t indexBytes = header->indexCount * header->indexStride;
+    size_t renderChunkBytes
+        = header->renderChunkCount * sizeof (TerrainRenderChunk);
+
+    if (size
+        != sizeof (TerrainHeader) + vertexBytes + indexBytes
+               + renderChunkBytes)
+      throw std::runtime_error ("Terrain cache size does not match header => "
+                                + p_Filename);
+
+    const std::byte *payload = base + sizeof (TerrainHeader);
+    if (payloadChecksum (payload, vertexBytes, payload + vertexBytes,
+                         indexBytes, payload + vertexBytes + indexBytes,
+                         renderChunkBytes)
+        != header->payloadChecksum)
+      throw std::runtime_error ("Terrain cache checksum mismatch => "
+                                + p_Filename);
+
+    p_Chunk.header = header;
+    p_Chunk.vertices = payload;
+    p_Chunk.indices
+        = reinterpret_cast<const uint32_t *> (payload + vertexBytes);
+    p_Chunk.renderChunks = reinterpret_cast<const TerrainRenderChunk *> (
+        payload + vertexBytes + indexBytes);
+    return;
+  }
+
+  void
+  writeTerrainChunk (const std::string &p_Filename, TerrainHeader &p_Header,
+                     const void *p_Vertices, size_t p_VertexCount,
+                     uint32_t p_VertexStride, const uint32_t *p_Indices,
+                     size_t p_IndexCount,
+                     const TerrainRenderChunk *p_RenderChunks,
+                     size_t p_RenderChunkCount)
+  {
+    size_t vertexBytes = p_VertexCount * p_VertexStride;
+    size_t indexBytes = p_IndexCount * sizeof (uint32_t);
+    size_t renderChunkBytes = p_RenderChunkCount * sizeof (TerrainRenderChunk);
+
+    p_Header.magic = TERRAIN_MAGIC;
+    p_Header.version = TERRAIN_VERSION;
+    p_Header.vertexStride = p_VertexStride;
+    p_Header.indexStride = sizeof (uint32_t);
+    p_Header.vertexCount = p_VertexCount;
+    p_Header.indexCount = p_IndexCount;
+    p_Header.renderChunkCount = static_cast<uint32_t> (p_RenderChunkCount);
+
+    p_Header.payloadChecksum
+        = payloadChecksum (p_Vertices, vertexBytes, p_Indices, indexBytes,
+                           p_RenderChunks, renderChunkBytes);
+
+    std::string tmpFilename = p_Filename + ".tmp";
+    {
+      std::ofstream file (tmpFilename, std::ios::binary | std::ios::trunc);
+      if (!file.is_open ())
+        throw std::runtime_error ("Failed to create terrain cache file => "
+                                  + tmpFilename);
+
+      file.write (reinterpret_cast<const char *> (&p_Header),
+                  sizeof (p_Header));
+      file.write (static_cast<const char *> (p_Vertices), vertexBytes);
+      file.write (reinterpret_cast<const char *> (p_Indices), indexBytes);
+      file.write (reinterpret_cast<const char *> (p_RenderChunks),
+                  renderChunkBytes);
+
+      if (!file)
+        throw std::runtime_error ("Failed writing terrain cache file => "
+                                  + tmpFilename);
+    }
+
+    std::filesystem::rename (tmpFilename, p_Filename);
+    return;
+  }
+
+  std::string
+  modelCacheFilename (const std::string &p_Filename)
+  {
+    return p_Filename + ".mvmc";
+  }
+
+  bool
+  peekModelHeader (const std::string &p_Filename, uint32_t p_VertexStride,
+                   ModelHeader &p_Header)
+  {
+    std::ifstream file (p_Filename, std::ios::binary);
+    if (!file.is_open ())
+      return false;
+
+    ModelHeader header;
+    if (!file.read (reinterpret_cast<char *> (&header), sizeof (header)))
+      return false;
+
+    if (header.magic != MODEL_MAGIC || header.version != MODEL_VERSION
+        || header.vertexStride != p_VertexStride
+        || header.indexStride != sizeof (uint32_t))
+      return false;
+
+    p_Header = header;
+    return true;
+  }
+
+  void
+  readModelFile (const std::string &p_Filename, uint32_t p_VertexStride,
+                 ModelFile &p_File)
+  {
+    p_File.file.open (p_Filename);
+
+    const std::byte *base = p_File.file.data ();
+    size_t size = p_File.file.size ();
+
+    if (size < sizeof (ModelHeader))
+      throw std::runtime_error ("Truncated model cache header => "
+                                + p_Filename);
+
+    const auto *header = reinterpret_cast<const ModelHeader *> (base);
+
+    if (header->magic != MODEL_MAGIC)
+      throw std::runtime_error ("Not a model cache file => " + p_Filename);
+
+    if (header->version != MODEL_VERSION)
+      throw std::runtime_error ("Model cache version mismatch => "
+                                + p_Filename);
+
+    if (header->vertexStride != p_VertexStride
+        || header->indexStride != sizeof (uint32_t))
+      throw std::runtime_error ("Model cache vertex layout mismatch => "
+                                + p_Filename);
+
+    size_t meshBytes = header->meshCount * sizeof (ModelMesh);
+    size_t textureBytes = header->textureCount * sizeof (ModelTexture);
+    size_t materialBytes = header->materialCount * sizeof (ModelMaterial);
+    size_t vertexBytes = header->vertexCount * header->vertexStride;
+    size_t indexBytes = header->indexCount * header->indexStride;
+
+    if (size
+        != sizeof (ModelHeader) + meshBytes + textureBytes + materialBytes
+               + vertexBytes + indexBytes)
+      throw std::runtime_error ("Model cache size does not match header => "
+                                + p_Filename);
+
+    const std::byte *meshes = base + sizeof (ModelHeader);
+    const std::byte *textures = meshes + meshBytes;
+    const std::byte *materials = textures + textureBytes;
+    const std::byte *vertices = materials + materialBytes;
+    const std::byte *indices = vertices + vertexBytes;
+    if (modelChecksum (meshes, meshBytes, textures, textureBytes, materials,
+                       materialBytes, vertices, vertexBytes, indices,
+                       indexBytes)
+        != header->payloadChecksum)
+      throw std::runtime_error ("Model cache checksum mismatch => "
+                                + p_Filename);
+
+    // ranges are trusted by the draw loop; reject any outside the payload
+    const auto *meshTable = reinterpret_cast<const ModelMesh *> (meshes);
+    for (uint32_t i = 0; i < header->meshCount; i++)
+      {
+        const ModelMesh &mesh = meshTable[i];
+        if (uint64_t (mesh.firstVertex) + mesh.vertexCount
+                > header->vertexCount
+            || uint64_t (mesh.firstIndex) + mesh.indexCount
+                   > header->indexCount
+            || mesh.mtlIndex >= static_cast<int32_t> (header->textureCount)
+            || mesh.materialIndex >= header->materialCount)
+          throw std::runtime_error ("Model cache mesh out of range => "
+                                    + p_Filename);
+      }
+
+    const auto *textureTable
+        = reinterpret_cast<const ModelTexture *> (textures);
+    for (uint32_t i = 0; i < header->textureCount; i++)
+      if (textureTable[i].path[sizeof (ModelTexture::path) - 1] != '\0')
+        throw std::runtime_error ("Model cache texture path unterminated => "
+                                  + p_Filename);
+
+    p_File.header = header;
+    p_File.meshes = meshTable;
+    p_File.textures = textureTable;
+    p_File.materials = reinterpret_cast<const ModelMaterial *> (materials);
+    p_File.vertices = vertices;
+    p_File.indices = reinterpret_cast<const uint32_t *> (indices);
+    return;
+  }
+
+  void
+  writeModelFile (const std::string &p_Filename, ModelHeader &p_Header,
+                  const ModelMesh *p_Meshes, size_t p_MeshCount,
+                  const ModelTexture *p_Textures, size_t p_TextureCount,
+                  const ModelMaterial *p_Materials, size_t p_MaterialCount,
+                  const void *p_Vertices, size_t p_VertexCount,
+                  uint32_t p_VertexStride, const uint32_t *p_Indices,
+                  size_t p_IndexCount)
+  {
+    size_t meshBytes = p_MeshCount * sizeof (ModelMesh);
+    size_t textureBytes = p_TextureCount * sizeof (ModelTexture);
+    size_t materialBytes = p_MaterialCount * sizeof (ModelMaterial);
+    size_t vertexBytes = p_VertexCount * p_VertexStride;
+    size_t indexBytes = p_IndexCount * sizeof (uint32_t);
+
+    p_Header.magic = MODEL_MAGIC;
+    p_Header.version = MODEL_VERSION;
+    p_Header.vertexStride = p_VertexStride;
+    p_Header.indexStride = sizeof (uint32_t);
+    p_Header.meshCount = static_cast<uint32_t> (p_MeshCount);
+    p_Header.textureCount = static_cast<uint32_t> (p_TextureCount);
+    p_Header.materialCount = static_cast<uint32_t> (p_MaterialCount);
+    p_Header.vertexCount = p_VertexCount;
+    p_Header.indexCount = p_IndexCount;
+
+    p_Header.payloadChecksum
+        = modelChecksum (p_Meshes, meshBytes, p_Textures, textureBytes,
+                         p_Materials, materialBytes, p_Vertices, vertexBytes,
+                         p_Indices, indexBytes);
+
+    std::string tmpFilename = p_Filename + ".tmp";
+    {
+      std::ofstream file (tmpFilename, std::ios::binary | std::ios::trunc);
+      if (!file.is_open ())
+        throw std::runtime_error ("Failed to create model cache file => "
+                                  + tmpFilename);
+
+      file.write (reinterpret_cast<const char *> (&p_Header),
+                  sizeof (p_Header));
+      file.write (reinterpret_cast<const char *> (p_Meshes), meshBytes);
+      file.write (reinterpret_cast<const char *> (p_Textures), textureBytes);
+      file.write (reinterpret_cast<const char *> (p_Materials),
+                  materialBytes);
+      file.write (static_cast<const char *> (p_Vertices), vertexBytes);
+      file.write (reinterpret_cast<const char *> (p_Indices), indexBytes);
+
+      if (!file)
+        throw std::runtime_error ("Failed writing model cache file => "
+                                  + tmpFilename);
+    }
+
+    std::filesystem::rename (tmpFilename, p_Filename);
+    return;
+  }
+}; // namespace Cache
@@ -150,6 +150,74 @@ Camera::update (void)
   return;
 }
 
+std::array<glm::vec4, 6>
+Camera::getFrustumPlanes (void) const
+{
+  // Without matrices treat everything as visible
+  if (!viewUniformObject || !projectionUniformObject)
+    {
+      std::array<glm::vec4, 6> all;
+      all.fill (glm::vec4 (0.0f, 0.0f, 0.0f, 1.0f));
+      return all;
+    }
+
+  // Gribb/Hartmann extraction; clip space depth is 0..1
+  glm::mat4 m = projectionUniformObject->matrix * viewUniformObject->matrix;
+  auto row = [&m] (int p_Row) {
+    return glm::vec4 (m[0][p_Row], m[1][p_Row], m[2][p_Row], m[3][p_Row]);
+  };
+
+  std::array<glm::vec4, 6> planes = {
+    row (3) + row (0), // left
+    row (3) - row (0), // right
+    row (3) + row (1), // bottom
+    row (3) - row (1), // top
+    row (2),           // near
+    row (3) - row (2), // far
+  };
+
+  for (auto &plane : planes)
+    plane /= glm::length (glm::vec3 (plane));
+
+  return planes;
+}
+
+float
+Camera::getFov (void) const
+{
+  return fov;
+}
+
+glm::vec3
+Camera::getEyePosition (void) const
+{
+  if (!viewUniformObject)
+    return position;
+
+  // translation of the inverse view is the eye
+  return glm::vec3 (glm::inverse (viewUniformObject->matrix)[3]);
+}
+
+std::pair<glm::vec3, glm::vec3>
+Camera::getPickRay (float p_X, float p_Y, float p_Width, float p_Height) const
+{
+  // Without matrices fall back to the view direction
+  if (!viewUniformObject || !projectionUniformObject || p_Width <= 0.0f
+      || p_Height <= 0.0f)
+    return { getEyePosition (), front };
+
+  // Window y runs down like Vulkan's normalized device y; depth is 0..1
+  glm::vec2 ndc (p_X / p_Width * 2.0f - 1.0f, p_Y / p_Height * 2.0f - 1.0f);
+  glm::mat4 inverse = glm::inverse (projectionUniformObject->matrix
+                                    * viewUniformObject->matrix);
+  glm::vec4 nearPoint = inverse * glm::vec4 (ndc, 0.0f, 1.0f);
+  glm::vec4 farPoint = inverse * glm::vec4 (ndc, 1.0f, 1.0f);
+
+  glm::vec3 origin = glm::vec3 (nearPoint) / nearPoint.w;
+  glm::vec3 end = glm::vec3 (farPoint) / farPoint.w;
+  return { origin, glm::normalize (end - origin) };
+}
+
 void
 Camera::adjustMovement (glm::vec3 p_Delta)
 {
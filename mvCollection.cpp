@@ -53,6 +53,14 @@ void Collection::update(void)
                 << model.modelName << " object container never initialized\n";
             throw std::runtime_error(oss.str());
         }
+    }
+
+    // matrices are built from position so ground first
+    if (groundObjects)
+        groundToTerrain();
+
+    for (auto &model : *models)
+    {
         for (auto &object : *model.objects)
         {
             object.update();
@@ -61,6 +69,28 @@ void Collection::update(void)
     return;
 }
 
+void Collection::groundToTerrain(void)
+{
+    const auto &map = engine->mapHandler;
+    if (!map.isMapLoaded)
+        return;
+
+    groundPoints.clear();
+    for (auto &model : *models)
+        for (auto &object : *model.objects)
+            groundPoints.push_back({object.position.x, object.position.z});
+
+    groundHeights.resize(groundPoints.size());
+    map.heightsAt(groundPoints, groundHeights);
+
+    // terrain surface is at y = -height
+    size_t i = 0;
+    for (auto &model : *models)
+        for (auto &object : *model.objects)
+            object.position.y = -groundHeights[i++];
+    return;
+}
+
 void Collection::cleanup(void)
 {
     engine->logicalDevice.waitIdle();
@@ -2,6 +2,8 @@
 #include "mvAllocator.h"
 #include "mvCollection.h"
 #include "mvModel.h"
+#include "mvTextures.h"
+#include "mvUpload.h"
 
 extern LogHandler logger;
 
@@ -38,7 +40,9 @@ Engine::~Engine ()
 
   // collection struct will handle cleanup of models & objs
   collectionHandler->cleanup ();
+  textures->cleanup ();
   allocator->cleanup ();
+  uploads->cleanup ();
 }
 
 void
@@ -193,7 +197,9 @@ Engine::go (void)
   prepare ();
 
   // Initialize here before use in later methods
+  uploads = std::make_unique<UploadBatcher> (this);
   allocator = std::make_unique<Allocator> (this);
+  textures = std::make_unique<TextureRegistry> (this);
   collectionHandler = std::make_unique<Collection> (this);
 
   // setup descriptor allocator, collection handler & camera
@@ -518,12 +524,11 @@ Engine::go (void)
                   std::uniform_int_distribution<int> z_distr (min, z_max);
 
                   float x = xy_distr (eng);
-                  float y = xy_distr (eng);
                   float z = z_distr (eng);
                   allocator->createObject (collectionHandler->models.get (),
                                            "models/_viking_room.fbx");
                   collectionHandler->models->at (0).objects->back ().position
-                      = glm::vec3 (x, y, z);
+                      = glm::vec3 (x, -mapHandler.heightAt (x, z), z);
                 }
             } // end third person methods
           // update game objects
@@ -532,27 +537,28 @@ Engine::go (void)
           // update view and projection matrices
           camera.update ();
 
-          /*
-              Update ray cast vertices
-          */
-          // int min = 0;
-          // int max = 90;
-          // int z_max = 60;
-
-          // std::random_device rd;
-          // std::default_random_engine eng(rd());
-          // std::uniform_int_distribution<int> xy_distr(min, max);
-          // std::uniform_int_distribution<int> z_distr(min, z_max);
-
-          // float x = xy_distr(eng);
-          // float y = xy_distr(eng);
-          // float z = z_distr(eng);
-          // raycast_p1(*this, {x, y, z});
-          // raycastP2(*this,
-          // {collectionHandler.models->at(1).objects->at(0).position.x,
-          //                   collectionHandler.models->at(1).objects->at(0).position.y
-          //                   - 1.5f,
-          //                   collectionHandler.models->at(1).objects->at(0).position.z});
+          // Left click places an object where the cursor meets the terrain
+          if (mouseEvent.type == Mouse::Event::Type::eLeftDown
+              && !gui->hasFocus && !gui->getIO ().WantCaptureMouse
+              && mapHandler.isMapLoaded)
+            {
+              int width = 0;
+              int height = 0;
+              glfwGetWindowSize (window, &width, &height);
+              auto [origin, direction] = camera.getPickRay (
+                  static_cast<float> (mouseEvent.x),
+                  static_cast<float> (mouseEvent.y),
+                  static_cast<float> (width), static_cast<float> (height));
+
+              MapHandler::RayHit hit;
+              if (mapHandler.raycast (origin, direction, hit))
+                {
+                  allocator->createObject (collectionHandler->models.get (),
+                                           "models/_viking_room.fbx");
+                  collectionHandler->models->at (0).objects->back ().position
+                      = hit.position;
+                }
+            }
         }
 
       // Game editor rendering
@@ -569,7 +575,8 @@ Engine::go (void)
                 .count (),
             static_cast<uint32_t> (collectionHandler->modelNames.size ()),
             collectionHandler->getObjectCount (),
-            collectionHandler->getVertexCount () + mapHandler.indexCount);
+            collectionHandler->getVertexCount () + mapHandler.indexCount,
+            mapHandler.visibleChunkCount, mapHandler.culledChunkCount);
 
         gui->renderFrame ();
       }
@@ -623,18 +630,41 @@ Engine::prepareLayouts (void)
     uniformLayout, // View uniform
     uniformLayout, // Projection uniform
   };
+  std::vector<vk::DescriptorSetLayout> layoutTerrainHeightfield = {
+    uniformLayout, // View uniform
+    uniformLayout, // Projection uniform
+    samplerLayout, // Terrain Texture Sampler
+    samplerLayout, // Heightmap Sampler
+  };
+
+  // Model material colour; identical in both model layouts so it survives
+  // switching between them
+  vk::PushConstantRange materialRange;
+  materialRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  materialRange.offset = 0;
+  materialRange.size = sizeof (Model::MaterialPushConstant);
 
   // Pipeline for models with textures
   vk::PipelineLayoutCreateInfo pLineWithSamplerInfo;
   pLineWithSamplerInfo.setLayoutCount
       = static_cast<uint32_t> (layoutWSampler.size ());
   pLineWithSamplerInfo.pSetLayouts = layoutWSampler.data ();
+  pLineWithSamplerInfo.pushConstantRangeCount = 1;
+  pLineWithSamplerInfo.pPushConstantRanges = &materialRange;
 
   // Pipeline with no textures
   vk::PipelineLayoutCreateInfo pLineNoSamplerInfo;
   pLineNoSamplerInfo.setLayoutCount
       = static_cast<uint32_t> (layoutNoSampler.size ());
   pLineNoSamplerInfo.pSetLayouts = layoutNoSampler.data ();
+  pLineNoSamplerInfo.pushConstantRangeCount = 1;
+  pLineNoSamplerInfo.pPushConstantRanges = &materialRange;
+
+  // Terrain LOD level & morph factor
+  vk::PushConstantRange terrainLodRange;
+  terrainLodRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  terrainLodRange.offset = 0;
+  terrainLodRange.size = sizeof (MapHandler::LodPushConstant);
 
   // Pipeline for terrain vertices
   vk::PipelineLayoutCreateInfo pLineTerrainMeshNoSamplerInfo;
@@ -642,11 +672,29 @@ Engine::prepareLayouts (void)
       = static_cast<uint32_t> (layoutTerrainMeshNoSampler.size ());
   pLineTerrainMeshNoSamplerInfo.pSetLayouts
       = layoutTerrainMeshNoSampler.data ();
+  pLineTerrainMeshNoSamplerInfo.pushConstantRangeCount = 1;
+  pLineTerrainMeshNoSamplerInfo.pPushConstantRanges = &terrainLodRange;
 
   vk::PipelineLayoutCreateInfo pLineTerrainMeshWSamplerInfo;
   pLineTerrainMeshWSamplerInfo.setLayoutCount
       = static_cast<uint32_t> (layoutTerrainMeshWSampler.size ());
   pLineTerrainMeshWSamplerInfo.pSetLayouts = layoutTerrainMeshWSampler.data ();
+  pLineTerrainMeshWSamplerInfo.pushConstantRangeCount = 1;
+  pLineTerrainMeshWSamplerInfo.pPushConstantRanges = &terrainLodRange;
+
+  // Terrain patch placement, LOD & skirt depth
+  vk::PushConstantRange terrainPatchRange;
+  terrainPatchRange.stageFlags = vk::ShaderStageFlagBits::eVertex;
+  terrainPatchRange.offset = 0;
+  terrainPatchRange.size = sizeof (MapHandler::HeightfieldPushConstant);
+
+  // Pipeline for heightfield terrain
+  vk::PipelineLayoutCreateInfo pLineTerrainHeightfieldInfo;
+  pLineTerrainHeightfieldInfo.setLayoutCount
+      = static_cast<uint32_t> (layoutTerrainHeightfield.size ());
+  pLineTerrainHeightfieldInfo.pSetLayouts = layoutTerrainHeightfield.data ();
+  pLineTerrainHeightfieldInfo.pushConstantRangeCount = 1;
+  pLineTerrainHeightfieldInfo.pPushConstantRanges = &terrainPatchRange;
 
   // Model, View, Projection
   // Color, UV, Sampler
@@ -672,6 +720,12 @@ Engine::prepareLayouts (void)
   pipelineLayouts.insert (
       { eVPNoSampler,
         logicalDevice.createPipelineLayout (pLineTerrainMeshNoSamplerInfo) });
+
+  // View, Projection
+  // Sampler, Heightmap Sampler
+  pipelineLayouts.insert (
+      { eTerrainHeightfield,
+        logicalDevice.createPipelineLayout (pLineTerrainHeightfieldInfo) });
   return;
 }
 
@@ -681,8 +735,8 @@ Engine::prepareLayouts (void)
 void
 Engine::preparePipeline (void)
 {
-  auto bindingDescription = Vertex::getBindingDescription ();
-  auto attributeDescriptions = Vertex::getAttributeDescriptions ();
+  auto bindingDescription = getVertexBindingDescription ();
+  auto attributeDescriptions = getVertexAttributeDescriptions ();
 
   vk::PipelineVertexInputStateCreateInfo viState;
   viState.vertexBindingDescriptionCount = 1;
@@ -907,6 +961,49 @@ Engine::preparePipeline (void)
           "Failed to create pipeline for terrain mesh with no sampler");
   }
 
+  // Create pipeline for heightfield terrain
+  // No vertex input; vsTerrain builds vertices from gl_VertexIndex
+  // Optional so builds without the compiled shader still run mesh terrain
+  if (std::filesystem::exists ("shaders/vsTerrain.spv"))
+    {
+      auto vsTerrain = readFile ("shaders/vsTerrain.spv");
+      vk::ShaderModule vsModuleTerrain = createShaderModule (vsTerrain);
+
+      vk::PipelineShaderStageCreateInfo vsStageInfoTerrain;
+      vsStageInfoTerrain.stage = vk::ShaderStageFlagBits::eVertex;
+      vsStageInfoTerrain.module = vsModuleTerrain;
+      vsStageInfoTerrain.pName = "main";
+      vsStageInfoTerrain.pSpecializationInfo = nullptr;
+
+      std::vector<vk::PipelineShaderStageCreateInfo> ssTerrainHeightfield
+          = { vsStageInfoTerrain, fsStageInfoVPSampler };
+
+      vk::PipelineVertexInputStateCreateInfo noVertexInput;
+
+      vk::GraphicsPipelineCreateInfo plTerrainHeightfieldInfo
+          = plVPSamplerInfo;
+      plTerrainHeightfieldInfo.layout
+          = pipelineLayouts.at (eTerrainHeightfield);
+      plTerrainHeightfieldInfo.stageCount
+          = static_cast<uint32_t> (ssTerrainHeightfield.size ());
+      plTerrainHeightfieldInfo.pStages = ssTerrainHeightfield.data ();
+      plTerrainHeightfieldInfo.pVertexInputState = &noVertexInput;
+
+      vk::ResultValue result = logicalDevice.createGraphicsPipeline (
+          nullptr, plTerrainHeightfieldInfo);
+      logicalDevice.destroyShaderModule (vsModuleTerrain);
+      if (result.result != vk::Result::eSuccess)
+        throw std::runtime_error (
+            "Failed to create graphics pipeline for heightfield terrain");
+
+      pipelines.insert ({ eTerrainHeightfield, result.value });
+    }
+  else
+    {
+      std::cout << "shaders/vsTerrain.spv not found; heightfield terrain "
+                   "disabled\n";
+    }
+
   /*
     Dynamic state extension
   */
@@ -1065,37 +1162,35 @@ Engine::recordCommandBuffer (uint32_t p_ImageIndex)
     {
       mapHandler.bindBuffer (commandBuffers.at (p_ImageIndex));
 
+      // Heightfield terrain is displaced from the heightmap image
+      bool isHeightfield = mapHandler.terrainMode
+                           == MapHandler::TerrainMode::eHeightfield;
+      PipelineTypes terrainPipeline
+          = isHeightfield ? eTerrainHeightfield : eVPWSampler;
+
       commandBuffers.at (p_ImageIndex)
           .bindPipeline (vk::PipelineBindPoint::eGraphics,
-                         pipelines.at (eVPWSampler));
+                         pipelines.at (terrainPipeline));
 
       std::vector<vk::DescriptorSet> toBind = {
         collectionHandler->viewUniform->descriptor,
         collectionHandler->projectionUniform->descriptor,
         mapHandler.terrainDescriptor,
       };
+      if (isHeightfield)
+        toBind.push_back (mapHandler.heightfieldDescriptor);
+
       commandBuffers.at (p_ImageIndex)
           .bindDescriptorSets (vk::PipelineBindPoint::eGraphics,
-                               pipelineLayouts.at (eVPWSampler), 0, toBind,
-                               nullptr);
-
-      // for (const auto &vOffset : mapHandler.vertexOffsets)
-      //   {
-      //     // Index offset
-      //     // { index start, index count }
-      //     commandBuffers.at (p_ImageIndex)
-      //         .drawIndexed (mapHandler.indexOffsets
-      //                           .at (&vOffset -
-      //                           &mapHandler.vertexOffsets[0]) .second,
-      //                       1,
-      //                       mapHandler.indexOffsets
-      //                           .at (&vOffset -
-      //                           &mapHandler.vertexOffsets[0]) .first,
-      //                       vOffset, 0);
-      //   }
-      commandBuffers.at (p_ImageIndex)
-          .drawIndexed (mapHandler.indexCount, 1, 0, 0, 0);
-      // commandBuffers.at(p_ImageIndex).draw(mapHandler.vertexCount, 1, 0, 0);
+                               pipelineLayouts.at (terrainPipeline), 0,
+                               toBind, nullptr);
+
+      // Only chunks intersecting the view frustum are drawn, each at a
+      // level of detail chosen from its distance to the camera
+      mapHandler.cull (camera,
+                       static_cast<float> (swapchain.swapExtent.height));
+      mapHandler.draw (commandBuffers.at (p_ImageIndex),
+                       pipelineLayouts.at (terrainPipeline));
     }
 
   for (auto &model : *collectionHandler->models)
@@ -1130,28 +1225,25 @@ Engine::recordCommandBuffer (uint32_t p_ImageIndex)
                   = { object.uniform.first,
                       collectionHandler->viewUniform->descriptor,
                       collectionHandler->projectionUniform->descriptor };
-              if (offset.first.second >= 0)
+              vk::PipelineLayout layout = pipelineLayouts.at (eMVPNoSampler);
+              if (offset.textureIndex >= 0)
                 {
                   toBind.push_back (
-                      model.textureDescriptors.at (offset.first.second).first);
-                  commandBuffers.at (p_ImageIndex)
-                      .bindDescriptorSets (vk::PipelineBindPoint::eGraphics,
-                                           pipelineLayouts.at (eMVPWSampler),
-                                           0, toBind, nullptr);
-                }
-              else
-                {
-                  commandBuffers.at (p_ImageIndex)
-                      .bindDescriptorSets (vk::PipelineBindPoint::eGraphics,
-                                           pipelineLayouts.at (eMVPNoSampler),
-                                           0, toBind, nullptr);
+                      model.textureDescriptors.at (offset.textureIndex).first);
+                  layout = pipelineLayouts.at (eMVPWSampler);
                 }
+              commandBuffers.at (p_ImageIndex)
+                  .bindDescriptorSets (vk::PipelineBindPoint::eGraphics,
+                                       layout, 0, toBind, nullptr);
 
-              // { { vertex offset, Texture index }, { Index start, Index count
-              // } }
               commandBuffers.at (p_ImageIndex)
-                  .drawIndexed (offset.second.second, 1, offset.second.first,
-                                offset.first.first, 0);
+                  .pushConstants (layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                  sizeof (Model::MaterialPushConstant),
+                                  &model.materials.at (offset.materialIndex));
+
+              commandBuffers.at (p_ImageIndex)
+                  .drawIndexed (offset.indexCount, 1, offset.firstIndex,
+                                offset.vertexOffset, 0);
             }
         }
     }
@@ -1181,6 +1273,14 @@ Engine::draw (size_t &p_CurrentFrame, uint32_t &p_CurrentImageIndex)
   if (res != vk::Result::eSuccess)
     throw std::runtime_error ("Error occurred while waiting for fence");
 
+  // fence also covers every submit before it
+  completedFrames
+      = std::max (completedFrames, frameSerials.at (p_CurrentFrame));
+
+  // frame boundary; finished terrain loads are swapped in here
+  mapHandler.update (gui.get ());
+  textures->collect ();
+
   vk::Result result = logicalDevice.acquireNextImageKHR (
       swapchain.swapchain, UINT64_MAX, semaphores.presentComplete, nullptr,
       &p_CurrentImageIndex);
@@ -1240,8 +1340,12 @@ Engine::draw (size_t &p_CurrentFrame, uint32_t &p_CurrentImageIndex)
 
   logicalDevice.resetFences (inFlightFences.at (p_CurrentFrame));
 
+  // textures staged since the last frame reach the queue ahead of it
+  uploads->submit ();
+
   result = graphicsQueue.submit (1, &submitInfo,
                                  inFlightFences.at (p_CurrentFrame));
+  frameSerials.at (p_CurrentFrame) = ++submittedFrames;
 
   switch (result)
     {
@@ -1328,9 +1432,12 @@ Engine::goSetup (void)
 
   /*
       TEXTURE SAMPLER LAYOUT
+      Heightfield terrain also samples its heightmap in the vertex stage
   */
   allocator->createLayout (vk::DescriptorType::eCombinedImageSampler, 1,
-                           vk::ShaderStageFlagBits::eFragment, 0);
+                           vk::ShaderStageFlagBits::eVertex
+                               | vk::ShaderStageFlagBits::eFragment,
+                           0);
 
   /*
       INITIALIZE MODEL/OBJECT HANDLER
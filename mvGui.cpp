@@ -277,7 +277,8 @@ GuiHandler::doRenderPass (const vk::RenderPass &p_RenderPass,
 void
 GuiHandler::update (const vk::Extent2D &p_SwapExtent, float p_RenderDelta,
                     float p_FrameDelta, uint32_t p_ModelCount,
-                    uint32_t p_ObjectCount, uint32_t p_VertexCount)
+                    uint32_t p_ObjectCount, uint32_t p_VertexCount,
+                    uint32_t p_VisibleChunkCount, uint32_t p_CulledChunkCount)
 {
   /*
       Determine if should update engine status deltas
@@ -352,9 +353,10 @@ GuiHandler::update (const vk::Extent2D &p_SwapExtent, float p_RenderDelta,
   ImGui::Begin ("Status", nullptr, engineDataFlags);
   ImGui::Text ("Render time: %.2f ms | Frame time: %.2f ms | FPS: %i | Model "
                "Count: %i | Object Count: %i | Vertex "
-               "Count: %i",
+               "Count: %i | Terrain Chunks: %i visible, %i culled",
                storedRenderDelta, storedFrameDelta, displayFPS, p_ModelCount,
-               p_ObjectCount, p_VertexCount);
+               p_ObjectCount, p_VertexCount, p_VisibleChunkCount,
+               p_CulledChunkCount);
   ImGui::End ();
 
   // Clear key states
@@ -399,6 +401,60 @@ GuiHandler::renderMapConfigModal (void)
       mapModal.terrainItem.isSelected = false;
     }
 
+  /*
+      Background map load
+  */
+  if (ptrMapHandler->isLoading)
+    {
+      ImGui::ProgressBar (ptrMapHandler->loadProgress, ImVec2 (-1.0f, 0.0f),
+                          ptrMapHandler->loadStage);
+    }
+  else if (!ptrMapHandler->loadError.empty ())
+    {
+      ImGui::PushStyleColor (ImGuiCol_Text, ImVec4 (1.0f, 0.3f, 0.3f, 1.0f));
+      ImGui::TextWrapped ("Load failed: %s",
+                          ptrMapHandler->loadError.c_str ());
+      ImGui::PopStyleColor (1);
+    }
+
+  /*
+      Terrain level of detail
+  */
+  ImGui::Spacing ();
+  ImGui::Text ("LOD error (px)");
+  ImGui::SameLine ();
+  ImGui::SetNextItemWidth (-1.0f);
+  ImGui::SliderFloat ("##lodErrorThreshold",
+                      &ptrMapHandler->lodErrorThreshold, 0.25f, 16.0f, "%.2f");
+
+  // applies to the next load; caches baked with another value are rebuilt
+  ImGui::Text ("Bake error (height)");
+  ImGui::SameLine ();
+  ImGui::SetNextItemWidth (-1.0f);
+  ImGui::SliderFloat ("##decimationError", &ptrMapHandler->decimationError,
+                      0.0f, 8.0f, "%.2f");
+
+  /*
+      Terrain mode; heightfield needs its vertex shader
+  */
+  if (ptrMapHandler->isHeightfieldSupported ())
+    {
+      using TerrainMode = MapHandler::TerrainMode;
+      bool isHeightfield
+          = ptrMapHandler->terrainMode == TerrainMode::eHeightfield;
+      if (ImGui::Checkbox ("GPU heightfield", &isHeightfield))
+        {
+          auto mode
+              = isHeightfield ? TerrainMode::eHeightfield : TerrainMode::eMesh;
+
+          // rebuild current map in the new mode; mode switches on swap in
+          if (ptrMapHandler->isMapLoaded)
+            ptrMapHandler->requestHeightMap (ptrMapHandler->filename, mode);
+          else
+            ptrMapHandler->terrainMode = mode;
+        }
+    }
+
   /*
       Camera configuration
   */
@@ -504,21 +560,9 @@ GuiHandler::loadHeightMap (std::string p_Path, std::string p_Filename)
   show = noShow;
   mapModal.selectTerrainModal.isOpen = false;
 
-  try
-    {
-      // Load heightmap
-      ptrMapHandler->readHeightMap (this, p_Path + p_Filename);
-    }
-  catch (std::exception &e)
-    {
-      auto msg
-          = ":: Fatal error in gui handler ::\n  Attempted to load map file "
-            + p_Path + p_Filename + " but exception occurred => "
-            + std::string (e.what ());
-
-      glfwSetWindowShouldClose (window, GLFW_TRUE);
-      throw std::runtime_error (msg);
-    }
-
+  // Built on a worker; map modal shows progress & any failure while the
+  // current map keeps drawing
+  ptrMapHandler->requestHeightMap (p_Path + p_Filename,
+                                   ptrMapHandler->terrainMode);
   return;
 }
\ No newline at end of file
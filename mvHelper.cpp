@@ -2,6 +2,7 @@
 
 void LogHandler::logMessage(std::pair<MessagePriority, std::string> p_Message)
 {
+    std::scoped_lock lock(mtx);
     trim();
     messages.push_back(p_Message);
 }
@@ -9,12 +10,14 @@ void LogHandler::logMessage(std::pair<MessagePriority, std::string> p_Message)
 void LogHandler::logMessage(MessagePriority p_MessagePriority,
                             std::string p_Message)
 {
+    std::scoped_lock lock(mtx);
     trim();
     messages.push_back({p_MessagePriority, p_Message});
 }
 
 void LogHandler::logMessage(std::string p_Message)
 {
+    std::scoped_lock lock(mtx);
     trim();
     messages.push_back({MessagePriority::eInfo, p_Message});
 }
@@ -22,6 +25,7 @@ void LogHandler::logMessage(std::string p_Message)
 std::vector<std::pair<LogHandler::MessagePriority, std::string>> LogHandler::
     getMessages(void)
 {
+    std::scoped_lock lock(mtx);
     return messages; // return copy of list
 }
 
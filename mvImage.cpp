@@ -1,5 +1,27 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "mvImage.h"
+#include "mvBlockCompress.h"
+#include "mvMipmap.h"
+#include "mvUpload.h"
+
+// Colour channels of these are stored gamma encoded
+static bool
+isSrgb (vk::Format p_Format)
+{
+  switch (p_Format)
+    {
+    case vk::Format::eR8Srgb:
+    case vk::Format::eR8G8Srgb:
+    case vk::Format::eR8G8B8Srgb:
+    case vk::Format::eB8G8R8Srgb:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eB8G8R8A8Srgb:
+    case vk::Format::eA8B8G8R8SrgbPack32:
+      return true;
+    default:
+      return false;
+    }
+}
 
 Image::Image () { return; }
 
@@ -9,13 +31,21 @@ void
 Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
                std::string p_ImageFilename)
 {
-  if (!p_Engine)
-    throw std::runtime_error ("Invalid engine handle passed to image");
-  if (!p_Engine->commandPool)
-    throw std::runtime_error ("command pool not initialized in mv device "
-                              "handler:: image handler");
-
-  engine = p_Engine;
+  // A corrupt bake only costs decoding the source
+  try
+    {
+      Ktx::Texture baked;
+      if (Ktx::findTexture (p_ImageFilename, baked)
+          && Ktx::isSrgb (baked.vkFormat) == isSrgb (p_ImageCreateInfo.format))
+        {
+          create (p_Engine, p_ImageCreateInfo, baked);
+          return;
+        }
+    }
+  catch (std::exception &e)
+    {
+      std::cout << "[-] Ignoring baked texture => " << e.what () << "\n";
+    }
 
   int width = 0;
   int height = 0;
@@ -24,28 +54,160 @@ Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
   // load image
   stbi_uc *rawImage = stbi_load (p_ImageFilename.c_str (), &width, &height,
                                  &channels, STBI_rgb_alpha);
-  vk::DeviceSize imageSize = width * height * 4;
 
   if (!rawImage)
     throw std::runtime_error ("Failed to load image => " + p_ImageFilename);
 
-  vk::Buffer stagingBuffer;
-  vk::DeviceMemory stagingMemory;
-  void *stagingMapped = nullptr;
+  try
+    {
+      create (p_Engine, p_ImageCreateInfo, rawImage,
+              static_cast<uint32_t> (width), static_cast<uint32_t> (height),
+              4);
+    }
+  catch (...)
+    {
+      stbi_image_free (rawImage);
+      throw;
+    }
 
-  // create staging buffer
-  createStagingBuffer (imageSize, stagingBuffer, stagingMemory);
+  // free stb image
+  stbi_image_free (rawImage);
+  return;
+}
 
-  stagingMapped
-      = p_Engine->logicalDevice.mapMemory (stagingMemory, 0, imageSize);
+void
+Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
+               const void *p_Texels, uint32_t p_Width, uint32_t p_Height,
+               size_t p_BytesPerTexel)
+{
+  if (!p_Engine)
+    throw std::runtime_error ("Invalid engine handle passed to image");
 
-  // copy raw image to staging memory
-  memcpy (stagingMapped, rawImage, static_cast<size_t> (imageSize));
+  uint32_t width = p_Width;
+  uint32_t height = p_Height;
+
+  // Chains are blitted on the GPU where the format allows, otherwise
+  // filtered on the CPU & uploaded level by level
+  mipLevels = p_ImageCreateInfo.generateMipmaps
+                  ? Mipmap::levelCount (width, height)
+                  : 1;
+  const vk::FormatFeatureFlags blitFeatures
+      = vk::FormatFeatureFlagBits::eBlitSrc
+        | vk::FormatFeatureFlagBits::eBlitDst
+        | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+  vk::FormatProperties formatProperties
+      = p_Engine->physicalDevice.getFormatProperties (
+          p_ImageCreateInfo.format);
+  bool canBlit = (formatProperties.optimalTilingFeatures & blitFeatures)
+                 == blitFeatures;
+  if (mipLevels > 1 && canBlit)
+    p_ImageCreateInfo.usage |= vk::ImageUsageFlagBits::eTransferSrc;
+
+  allocate (p_Engine, p_ImageCreateInfo, width, height);
+
+  // staged & recorded; submitted ahead of the next frame
+  if (mipLevels == 1 || canBlit)
+    {
+      p_Engine->uploads->uploadImage (image, width, height, p_BytesPerTexel,
+                                      p_Texels, mipLevels);
+    }
+  else
+    {
+      auto chain = Mipmap::generate (
+          p_Engine->workers, static_cast<const uint8_t *> (p_Texels), width,
+          height, p_BytesPerTexel, isSrgb (p_ImageCreateInfo.format));
+
+      std::vector<UploadBatcher::MipLevel> levels;
+      levels.push_back ({ p_Texels, width, height });
+      for (const auto &level : chain)
+        levels.push_back ({ level.texels.data (), level.width, level.height });
+      p_Engine->uploads->uploadImage (image, p_BytesPerTexel, levels);
+    }
 
-  p_Engine->logicalDevice.unmapMemory (stagingMemory);
+  createView (p_ImageCreateInfo);
+  return;
+}
 
-  // free stb image
-  stbi_image_free (rawImage);
+void
+Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
+               const Ktx::Texture &p_Texture)
+{
+  if (!p_Engine)
+    throw std::runtime_error ("Invalid engine handle passed to image");
+  if (p_Texture.levels.empty ())
+    throw std::runtime_error ("Attempted to create image from empty texture");
+
+  mipLevels = p_ImageCreateInfo.generateMipmaps
+                  ? static_cast<uint32_t> (p_Texture.levels.size ())
+                  : 1;
+
+  std::vector<UploadBatcher::MipLevel> levels;
+  for (uint32_t l = 0; l < mipLevels; l++)
+    levels.push_back ({ p_Texture.levels.at (l).data,
+                        p_Texture.levels.at (l).width,
+                        p_Texture.levels.at (l).height });
+
+  BlockCompress::Format blockFormat;
+  if (!Ktx::blockFormat (p_Texture.vkFormat, blockFormat))
+    {
+      p_ImageCreateInfo.format = static_cast<vk::Format> (p_Texture.vkFormat);
+      allocate (p_Engine, p_ImageCreateInfo, p_Texture.width,
+                p_Texture.height);
+      p_Engine->uploads->uploadImage (image, 4, levels);
+      createView (p_ImageCreateInfo);
+      return;
+    }
+
+  // Blocks are copied as is where the device samples the format
+  vk::Format format = static_cast<vk::Format> (p_Texture.vkFormat);
+  vk::FormatFeatureFlags sampleFeatures
+      = vk::FormatFeatureFlagBits::eSampledImage;
+  if (p_ImageCreateInfo.filter == vk::Filter::eLinear)
+    sampleFeatures |= vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+  vk::FormatProperties formatProperties
+      = p_Engine->physicalDevice.getFormatProperties (format);
+  if ((formatProperties.optimalTilingFeatures & sampleFeatures)
+      == sampleFeatures)
+    {
+      p_ImageCreateInfo.format = format;
+      allocate (p_Engine, p_ImageCreateInfo, p_Texture.width,
+                p_Texture.height);
+      p_Engine->uploads->uploadImage (
+          image, BlockCompress::blockBytes (blockFormat), levels,
+          BlockCompress::BLOCK_DIM);
+      createView (p_ImageCreateInfo);
+      return;
+    }
+
+  // RGBA8 fallback; same texels at 4 to 8 times the memory
+  std::vector<std::vector<uint8_t>> decoded (mipLevels);
+  p_Engine->workers.parallelFor (mipLevels, [&] (size_t l) {
+    decoded.at (l) = BlockCompress::decode (
+        blockFormat,
+        reinterpret_cast<const uint8_t *> (p_Texture.levels.at (l).data),
+        p_Texture.levels.at (l).width, p_Texture.levels.at (l).height);
+  });
+  for (uint32_t l = 0; l < mipLevels; l++)
+    levels.at (l).texels = decoded.at (l).data ();
+
+  p_ImageCreateInfo.format = Ktx::isSrgb (p_Texture.vkFormat)
+                                 ? vk::Format::eR8G8B8A8Srgb
+                                 : vk::Format::eR8G8B8A8Unorm;
+  allocate (p_Engine, p_ImageCreateInfo, p_Texture.width, p_Texture.height);
+  p_Engine->uploads->uploadImage (image, 4, levels);
+  createView (p_ImageCreateInfo);
+  return;
+}
+
+void
+Image::allocate (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
+                 uint32_t p_Width, uint32_t p_Height)
+{
+  if (!p_Engine->uploads)
+    throw std::runtime_error ("upload batcher not initialized in engine "
+                              ":: image handler");
+
+  engine = p_Engine;
 
   // In case I forgot to add TransferDst
   if (!(p_ImageCreateInfo.usage & vk::ImageUsageFlagBits::eTransferDst))
@@ -57,10 +219,10 @@ Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
   vk::ImageCreateInfo imageInfo;
   imageInfo.imageType = vk::ImageType::e2D;
   imageInfo.format = p_ImageCreateInfo.format;
-  imageInfo.extent.width = width;
-  imageInfo.extent.height = height;
+  imageInfo.extent.width = p_Width;
+  imageInfo.extent.height = p_Height;
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
+  imageInfo.mipLevels = mipLevels;
   imageInfo.arrayLayers = 1;
   imageInfo.samples = vk::SampleCountFlagBits::e1;
   imageInfo.tiling = p_ImageCreateInfo.tiling;
@@ -83,35 +245,12 @@ Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
   memory = p_Engine->logicalDevice.allocateMemory (allocInfo);
 
   p_Engine->logicalDevice.bindImageMemory (image, memory, 0);
+  return;
+}
 
-  // transition image to transfer dst
-  transitionImageLayout (&image, vk::ImageLayout::eUndefined,
-                         vk::ImageLayout::eTransferDstOptimal);
-
-  // copy staging buffer to image
-  vk::CommandBuffer commandBuffer = beginCommandBuffer ();
-
-  vk::BufferImageCopy region;
-  region.bufferOffset = 0;
-  region.bufferRowLength = 0;
-  region.bufferImageHeight = 0;
-  region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-  region.imageSubresource.mipLevel = 0;
-  region.imageSubresource.baseArrayLayer = 0;
-  region.imageSubresource.layerCount = 1;
-  region.imageOffset = vk::Offset3D{ 0, 0, 0 };
-  region.imageExtent = vk::Extent3D{ static_cast<uint32_t> (width),
-                                     static_cast<uint32_t> (height), 1 };
-
-  commandBuffer.copyBufferToImage (
-      stagingBuffer, image, vk::ImageLayout::eTransferDstOptimal, region);
-
-  endCommandBuffer (commandBuffer);
-
-  // transition image to shader read only
-  transitionImageLayout (&image, vk::ImageLayout::eTransferDstOptimal,
-                         vk::ImageLayout::eShaderReadOnlyOptimal);
-
+void
+Image::createView (ImageCreateInfo &p_ImageCreateInfo)
+{
   // create view into image
   vk::ImageViewCreateInfo viewInfo;
   viewInfo.image = image;
@@ -125,35 +264,33 @@ Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
   };
   viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
   viewInfo.subresourceRange.baseMipLevel = 0;
-  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.levelCount = mipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
   // create image view
-  imageView = p_Engine->logicalDevice.createImageView (viewInfo);
+  imageView = engine->logicalDevice.createImageView (viewInfo);
 
   // create image sampler
   vk::SamplerCreateInfo samplerInfo;
-  samplerInfo.magFilter = vk::Filter::eLinear;
-  samplerInfo.minFilter = vk::Filter::eLinear;
-  samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
-  samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
-  samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+  samplerInfo.magFilter = p_ImageCreateInfo.filter;
+  samplerInfo.minFilter = p_ImageCreateInfo.filter;
+  samplerInfo.addressModeU = p_ImageCreateInfo.addressMode;
+  samplerInfo.addressModeV = p_ImageCreateInfo.addressMode;
+  samplerInfo.addressModeW = p_ImageCreateInfo.addressMode;
   samplerInfo.anisotropyEnable = VK_TRUE;
   samplerInfo.maxAnisotropy
-      = p_Engine->physicalProperties.limits.maxSamplerAnisotropy;
+      = engine->physicalProperties.limits.maxSamplerAnisotropy;
   samplerInfo.borderColor = vk::BorderColor::eIntOpaqueBlack;
   samplerInfo.unnormalizedCoordinates = VK_FALSE;
   samplerInfo.compareEnable = VK_FALSE;
   samplerInfo.compareOp = vk::CompareOp::eAlways;
   samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = static_cast<float> (mipLevels);
 
   // create sampler
-  sampler = p_Engine->logicalDevice.createSampler (samplerInfo);
-
-  // cleanup staging resources
-  p_Engine->logicalDevice.destroyBuffer (stagingBuffer);
-  p_Engine->logicalDevice.freeMemory (stagingMemory);
+  sampler = engine->logicalDevice.createSampler (samplerInfo);
 
   // setup the descriptor
   descriptor.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
@@ -163,163 +300,6 @@ Image::create (Engine *p_Engine, ImageCreateInfo &p_ImageCreateInfo,
   return;
 }
 
-void
-Image::createStagingBuffer (vk::DeviceSize &p_BufferSize,
-                            vk::Buffer &p_StagingBuffer,
-                            vk::DeviceMemory &p_StagingMemory)
-{
-  vk::MemoryRequirements stagingReq;
-
-  vk::BufferCreateInfo bufferInfo;
-  bufferInfo.size = p_BufferSize;
-  bufferInfo.sharingMode = vk::SharingMode::eExclusive;
-  bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
-
-  // create staging buffer
-  p_StagingBuffer = engine->logicalDevice.createBuffer (bufferInfo);
-
-  // get memory requirements
-  stagingReq
-      = engine->logicalDevice.getBufferMemoryRequirements (p_StagingBuffer);
-
-  vk::MemoryAllocateInfo allocInfo;
-  allocInfo.allocationSize = stagingReq.size;
-  allocInfo.memoryTypeIndex = engine->getMemoryType (
-      stagingReq.memoryTypeBits,
-      vk::MemoryPropertyFlagBits::eHostVisible
-          | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-  // allocate staging memory
-  p_StagingMemory = engine->logicalDevice.allocateMemory (allocInfo);
-
-  // bind staging buffer & memory
-  engine->logicalDevice.bindBufferMemory (p_StagingBuffer, p_StagingMemory, 0);
-  return;
-}
-
-vk::CommandBuffer
-Image::beginCommandBuffer (void)
-{
-  if (!engine->commandPool)
-    throw std::runtime_error ("Command pool not initialized in mv device "
-                              "handler :: image handler");
-
-  vk::CommandBufferAllocateInfo allocInfo;
-  allocInfo.level = vk::CommandBufferLevel::ePrimary;
-  allocInfo.commandPool = engine->commandPool;
-  allocInfo.commandBufferCount = 1;
-
-  // create command buffer
-  std::vector<vk::CommandBuffer> cmdBuffers
-      = engine->logicalDevice.allocateCommandBuffers (allocInfo);
-
-  if (cmdBuffers.size () < 1)
-    throw std::runtime_error (
-        "Failed to allocate command buffers :: image handler");
-
-  // destroy other command buffers if more than 1 created
-  // shouldn't happen
-  if (cmdBuffers.size () > 1)
-    {
-      std::vector<vk::CommandBuffer> toDestroy;
-      for (auto &buf : cmdBuffers)
-        {
-          if (&buf - &cmdBuffers[0] > 0)
-            {
-              toDestroy.push_back (buf);
-            }
-        }
-      engine->logicalDevice.freeCommandBuffers (engine->commandPool,
-                                                toDestroy);
-    }
-
-  vk::CommandBufferBeginInfo begin_info;
-  begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
-
-  cmdBuffers.at (0).begin (begin_info);
-
-  return cmdBuffers.at (0);
-}
-
-void
-Image::endCommandBuffer (vk::CommandBuffer p_CommandBuffer)
-{
-
-  if (!engine->commandPool)
-    throw std::runtime_error (
-        "Command pool invalid ending commands :: image handler");
-
-  if (!engine->graphicsQueue)
-    throw std::runtime_error ("Graphics queue reference invalid ending "
-                              "commands :: image handler");
-
-  p_CommandBuffer.end ();
-
-  vk::SubmitInfo submitInfo;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &p_CommandBuffer;
-
-  engine->graphicsQueue.submit (submitInfo);
-  engine->graphicsQueue.waitIdle ();
-
-  engine->logicalDevice.freeCommandBuffers (engine->commandPool,
-                                            p_CommandBuffer);
-  return;
-}
-
-void
-Image::transitionImageLayout (vk::Image *p_TargetImage,
-                              vk::ImageLayout p_StartingLayout,
-                              vk::ImageLayout p_EndingLayout)
-{
-  vk::CommandBuffer commandBuffer = beginCommandBuffer ();
-
-  vk::ImageMemoryBarrier barrier;
-  barrier.oldLayout = p_StartingLayout;
-  barrier.newLayout = p_EndingLayout;
-  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-  barrier.image = *p_TargetImage;
-  barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-  barrier.subresourceRange.baseMipLevel = 0;
-  barrier.subresourceRange.levelCount = 1;
-  barrier.subresourceRange.baseArrayLayer = 0;
-  barrier.subresourceRange.layerCount = 1;
-
-  vk::PipelineStageFlags sourceStage;
-  vk::PipelineStageFlags destinationStage;
-
-  if (p_StartingLayout == vk::ImageLayout::eUndefined
-      && p_EndingLayout == vk::ImageLayout::eTransferDstOptimal)
-    {
-      barrier.srcAccessMask = vk::AccessFlagBits::eNoneKHR;
-      barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-
-      sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-      destinationStage = vk::PipelineStageFlagBits::eTransfer;
-    }
-  else if (p_StartingLayout == vk::ImageLayout::eTransferDstOptimal
-           && p_EndingLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
-    {
-      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-      barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-      sourceStage = vk::PipelineStageFlagBits::eTransfer;
-      destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
-    }
-  else
-    {
-      throw std::runtime_error ("Layout transition requested is unsupported");
-    }
-
-  commandBuffer.pipelineBarrier (sourceStage, destinationStage,
-                                 vk::DependencyFlags (), nullptr, nullptr,
-                                 barrier);
-
-  endCommandBuffer (commandBuffer);
-  return;
-}
-
 void
 Image::destroy (void)
 {
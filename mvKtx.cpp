@@ -0,0 +1,461 @@
+#include "mvKtx.h"
+#include "mvMipmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
+namespace Ktx
+{
+  namespace
+  {
+    constexpr uint8_t IDENTIFIER[12] = { 0xab, 0x4b, 0x54, 0x58, 0x20, 0x32,
+                                         0x30, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a };
+
+    struct FileHeader
+    {
+      uint8_t identifier[12] = {};
+      uint32_t vkFormat = 0;
+      uint32_t typeSize = 1;
+      uint32_t pixelWidth = 0;
+      uint32_t pixelHeight = 0;
+      uint32_t pixelDepth = 0;
+      uint32_t layerCount = 0;
+      uint32_t faceCount = 1;
+      uint32_t levelCount = 0;
+      uint32_t supercompressionScheme = 0;
+      uint32_t dfdByteOffset = 0;
+      uint32_t dfdByteLength = 0;
+      uint32_t kvdByteOffset = 0;
+      uint32_t kvdByteLength = 0;
+      uint64_t sgdByteOffset = 0;
+      uint64_t sgdByteLength = 0;
+    };
+    static_assert (sizeof (FileHeader) == 80, "KTX2 header layout");
+
+    struct LevelIndex
+    {
+      uint64_t byteOffset = 0;
+      uint64_t byteLength = 0;
+      uint64_t uncompressedByteLength = 0;
+    };
+    static_assert (sizeof (LevelIndex) == 24, "KTX2 level index layout");
+
+    // Key/value keys; sorted as the spec requires
+    constexpr char WRITER_KEY[] = "KTXwriter";
+    constexpr char CHECKSUM_KEY[] = "mvChecksum";
+    constexpr char SOURCE_KEY[] = "mvSourceKey";
+    constexpr char WRITER[] = "mv texbake";
+
+    // Data format descriptor values
+    constexpr uint32_t MODEL_RGBSDA = 1;
+    constexpr uint32_t MODEL_BC1A = 128;
+    constexpr uint32_t MODEL_BC3 = 130;
+    constexpr uint32_t PRIMARIES_BT709 = 1;
+    constexpr uint32_t TRANSFER_LINEAR = 1;
+    constexpr uint32_t TRANSFER_SRGB = 2;
+    constexpr uint32_t CHANNEL_ALPHA = 15;
+    constexpr uint32_t QUALIFIER_LINEAR = 0x10;
+
+    size_t
+    align (size_t p_Offset, size_t p_Alignment)
+    {
+      return (p_Offset + p_Alignment - 1) / p_Alignment * p_Alignment;
+    }
+
+    // Texel block size; level data is aligned to lcm (this, 4)
+    size_t
+    elementBytes (uint32_t p_VkFormat)
+    {
+      BlockCompress::Format format;
+      if (blockFormat (p_VkFormat, format))
+        return BlockCompress::blockBytes (format);
+      return 4;
+    }
+
+    uint64_t
+    levelChecksum (const uint64_t *p_LevelChecksums, size_t p_LevelCount)
+    {
+      return Cache::checksum (p_LevelChecksums,
+                              p_LevelCount * sizeof (uint64_t));
+    }
+
+    // One sample of a basic descriptor block
+    void
+    appendSample (std::vector<uint32_t> &p_Dfd, uint32_t p_BitOffset,
+                  uint32_t p_BitLength, uint32_t p_Channel,
+                  uint32_t p_Upper)
+    {
+      p_Dfd.push_back (p_BitOffset | (p_BitLength - 1) << 16
+                       | p_Channel << 24);
+      p_Dfd.push_back (0);
+      p_Dfd.push_back (0);
+      p_Dfd.push_back (p_Upper);
+      return;
+    }
+
+    // Basic data format descriptor, including the leading total size
+    std::vector<uint32_t>
+    buildDfd (uint32_t p_VkFormat)
+    {
+      bool srgb = isSrgb (p_VkFormat);
+      // sRGB alpha is stored linear
+      uint32_t alpha = CHANNEL_ALPHA | (srgb ? QUALIFIER_LINEAR : 0);
+      BlockCompress::Format format = BlockCompress::Format::eBC1;
+      bool compressed = blockFormat (p_VkFormat, format);
+
+      uint32_t model = MODEL_RGBSDA;
+      if (compressed)
+        model = format == BlockCompress::Format::eBC1 ? MODEL_BC1A
+                                                      : MODEL_BC3;
+      uint32_t blockDim = compressed ? BlockCompress::BLOCK_DIM - 1 : 0;
+
+      std::vector<uint32_t> dfd = { 0, 0, 0 };
+      dfd.push_back (model | PRIMARIES_BT709 << 8
+                     | (srgb ? TRANSFER_SRGB : TRANSFER_LINEAR) << 16);
+      dfd.push_back (blockDim | blockDim << 8);
+      dfd.push_back (static_cast<uint32_t> (elementBytes (p_VkFormat)));
+      dfd.push_back (0);
+
+      if (!compressed)
+        {
+          for (uint32_t c = 0; c < 3; c++)
+            appendSample (dfd, c * 8, 8, c, 255);
+          appendSample (dfd, 24, 8, alpha, 255);
+        }
+      else if (format == BlockCompress::Format::eBC1)
+        {
+          appendSample (dfd, 0, 64, 0, UINT32_MAX);
+        }
+      else
+        {
+          appendSample (dfd, 0, 64, alpha, UINT32_MAX);
+          appendSample (dfd, 64, 64, 0, UINT32_MAX);
+        }
+
+      uint32_t blockBytes = static_cast<uint32_t> (
+          (dfd.size () - 1) * sizeof (uint32_t));
+      dfd.at (0) = static_cast<uint32_t> (dfd.size () * sizeof (uint32_t));
+      // vendor & descriptor type are 0; version 2 of the basic block
+      dfd.at (2) = 2 | blockBytes << 16;
+      return dfd;
+    }
+
+    void
+    appendKeyValue (std::vector<uint8_t> &p_Kvd, const char *p_Key,
+                    const void *p_Value, size_t p_ValueBytes)
+    {
+      size_t keyBytes = std::strlen (p_Key) + 1;
+      uint32_t length = static_cast<uint32_t> (keyBytes + p_ValueBytes);
+      const auto *lengthBytes = reinterpret_cast<const uint8_t *> (&length);
+      const auto *value = static_cast<const uint8_t *> (p_Value);
+
+      p_Kvd.insert (p_Kvd.end (), lengthBytes, lengthBytes + sizeof (length));
+      p_Kvd.insert (p_Kvd.end (), p_Key, p_Key + keyBytes);
+      p_Kvd.insert (p_Kvd.end (), value, value + p_ValueBytes);
+      p_Kvd.resize (align (p_Kvd.size (), 4), 0);
+      return;
+    }
+
+    // Finds p_Key's 8 byte value; false if absent
+    bool
+    findValue (const std::byte *p_Kvd, size_t p_Length, const char *p_Key,
+               uint64_t &p_Value)
+    {
+      size_t keyBytes = std::strlen (p_Key) + 1;
+      size_t offset = 0;
+      while (offset + sizeof (uint32_t) <= p_Length)
+        {
+          uint32_t length = 0;
+          std::memcpy (&length, p_Kvd + offset, sizeof (length));
+          offset += sizeof (length);
+          if (length > p_Length - offset)
+            return false;
+
+          if (length == keyBytes + sizeof (p_Value)
+              && std::memcmp (p_Kvd + offset, p_Key, keyBytes) == 0)
+            {
+              std::memcpy (&p_Value, p_Kvd + offset + keyBytes,
+                           sizeof (p_Value));
+              return true;
+            }
+          offset = align (offset + length, 4);
+        }
+      return false;
+    }
+  }; // namespace
+
+  bool
+  isSupported (uint32_t p_VkFormat)
+  {
+    switch (p_VkFormat)
+      {
+      case FORMAT_R8G8B8A8_UNORM:
+      case FORMAT_R8G8B8A8_SRGB:
+      case FORMAT_BC1_RGB_UNORM:
+      case FORMAT_BC1_RGB_SRGB:
+      case FORMAT_BC3_UNORM:
+      case FORMAT_BC3_SRGB:
+        return true;
+      default:
+        return false;
+      }
+  }
+
+  bool
+  isSrgb (uint32_t p_VkFormat)
+  {
+    return p_VkFormat == FORMAT_R8G8B8A8_SRGB
+           || p_VkFormat == FORMAT_BC1_RGB_SRGB
+           || p_VkFormat == FORMAT_BC3_SRGB;
+  }
+
+  bool
+  blockFormat (uint32_t p_VkFormat, BlockCompress::Format &p_Format)
+  {
+    switch (p_VkFormat)
+      {
+      case FORMAT_BC1_RGB_UNORM:
+      case FORMAT_BC1_RGB_SRGB:
+        p_Format = BlockCompress::Format::eBC1;
+        return true;
+      case FORMAT_BC3_UNORM:
+      case FORMAT_BC3_SRGB:
+        p_Format = BlockCompress::Format::eBC3;
+        return true;
+      default:
+        return false;
+      }
+  }
+
+  uint32_t
+  compressedFormat (BlockCompress::Format p_Format, bool p_Srgb)
+  {
+    if (p_Format == BlockCompress::Format::eBC1)
+      return p_Srgb ? FORMAT_BC1_RGB_SRGB : FORMAT_BC1_RGB_UNORM;
+    return p_Srgb ? FORMAT_BC3_SRGB : FORMAT_BC3_UNORM;
+  }
+
+  size_t
+  levelBytes (uint32_t p_VkFormat, uint32_t p_Width, uint32_t p_Height)
+  {
+    BlockCompress::Format format;
+    if (blockFormat (p_VkFormat, format))
+      return BlockCompress::imageBytes (format, p_Width, p_Height);
+    return size_t (p_Width) * p_Height * 4;
+  }
+
+  std::string
+  textureFilename (const std::string &p_ImageFilename)
+  {
+    return std::filesystem::path (p_ImageFilename)
+        .replace_extension (".ktx2")
+        .string ();
+  }
+
+  uint64_t
+  sourceKey (const std::string &p_ImageFilename)
+  {
+    Cache::MappedFile source;
+    try
+      {
+        source.open (p_ImageFilename);
+      }
+    catch (std::exception &)
+      {
+        return 0;
+      }
+
+    const uint64_t key[2]
+        = { BAKE_VERSION, Cache::checksum (source.data (), source.size ()) };
+    return Cache::checksum (key, sizeof (key));
+  }
+
+  void
+  readTexture (const std::string &p_Filename, Texture &p_Texture)
+  {
+    p_Texture.file.open (p_Filename);
+    p_Texture.levels.clear ();
+
+    const std::byte *base = p_Texture.file.data ();
+    size_t size = p_Texture.file.size ();
+
+    if (size < sizeof (FileHeader))
+      throw std::runtime_error ("Truncated KTX2 header => " + p_Filename);
+
+    FileHeader header;
+    std::memcpy (&header, base, sizeof (header));
+
+    if (std::memcmp (header.identifier, IDENTIFIER, sizeof (IDENTIFIER)) != 0)
+      throw std::runtime_error ("Not a KTX2 file => " + p_Filename);
+
+    if (!isSupported (header.vkFormat) || header.typeSize != 1)
+      throw std::runtime_error ("Unsupported KTX2 format => " + p_Filename);
+
+    // 2D, one layer & face, levels stored whole
+    if (header.pixelWidth == 0 || header.pixelHeight == 0
+        || header.pixelDepth != 0 || header.layerCount > 1
+        || header.faceCount != 1 || header.supercompressionScheme != 0
+        || header.levelCount == 0
+        || header.levelCount
+               > Mipmap::levelCount (header.pixelWidth, header.pixelHeight))
+      throw std::runtime_error ("Unsupported KTX2 layout => " + p_Filename);
+
+    size_t indexBytes = header.levelCount * sizeof (LevelIndex);
+    if (size < sizeof (FileHeader) + indexBytes
+        || uint64_t (header.kvdByteOffset) + header.kvdByteLength > size)
+      throw std::runtime_error ("KTX2 index out of range => " + p_Filename);
+
+    std::vector<uint64_t> checksums (header.levelCount);
+    for (uint32_t l = 0; l < header.levelCount; l++)
+      {
+        LevelIndex index;
+        std::memcpy (&index,
+                     base + sizeof (FileHeader) + l * sizeof (LevelIndex),
+                     sizeof (index));
+
+        Level level;
+        level.width = std::max (header.pixelWidth >> l, 1u);
+        level.height = std::max (header.pixelHeight >> l, 1u);
+        level.size = levelBytes (header.vkFormat, level.width, level.height);
+        if (index.byteLength != level.size || index.byteOffset > size
+            || level.size > size - index.byteOffset)
+          throw std::runtime_error ("KTX2 level out of range => "
+                                    + p_Filename);
+
+        level.data = base + index.byteOffset;
+        checksums.at (l) = Cache::checksum (level.data, level.size);
+        p_Texture.levels.push_back (level);
+      }
+
+    // Bakes from other tools carry no checksum
+    const std::byte *kvd = base + header.kvdByteOffset;
+    uint64_t checksum = 0;
+    if (findValue (kvd, header.kvdByteLength, CHECKSUM_KEY, checksum)
+        && checksum != levelChecksum (checksums.data (), checksums.size ()))
+      throw std::runtime_error ("KTX2 checksum mismatch => " + p_Filename);
+
+    p_Texture.sourceKey = 0;
+    findValue (kvd, header.kvdByteLength, SOURCE_KEY, p_Texture.sourceKey);
+
+    p_Texture.vkFormat = header.vkFormat;
+    p_Texture.width = header.pixelWidth;
+    p_Texture.height = header.pixelHeight;
+    return;
+  }
+
+  bool
+  findTexture (const std::string &p_ImageFilename, Texture &p_Texture)
+  {
+    std::string filename = textureFilename (p_ImageFilename);
+    std::error_code error;
+    if (!std::filesystem::exists (filename, error))
+      return false;
+
+    readTexture (filename, p_Texture);
+
+    // named directly; nothing to compare against
+    if (filename == p_ImageFilename)
+      return true;
+
+    uint64_t key = sourceKey (p_ImageFilename);
+    if (key != 0 && key != p_Texture.sourceKey)
+      {
+        p_Texture = {};
+        return false;
+      }
+    return true;
+  }
+
+  void
+  writeTexture (const std::string &p_Filename, uint32_t p_VkFormat,
+                uint32_t p_Width, uint32_t p_Height,
+                const std::vector<std::vector<uint8_t>> &p_Levels,
+                uint64_t p_SourceKey)
+  {
+    if (!isSupported (p_VkFormat))
+      throw std::runtime_error ("Unsupported KTX2 format => " + p_Filename);
+    if (p_Levels.empty ()
+        || p_Levels.size () > Mipmap::levelCount (p_Width, p_Height))
+      throw std::runtime_error ("Invalid KTX2 level count => " + p_Filename);
+
+    std::vector<uint64_t> checksums;
+    for (size_t l = 0; l < p_Levels.size (); l++)
+      {
+        const auto &level = p_Levels.at (l);
+        uint32_t width = std::max (p_Width >> l, 1u);
+        uint32_t height = std::max (p_Height >> l, 1u);
+        if (level.size () != levelBytes (p_VkFormat, width, height))
+          throw std::runtime_error ("KTX2 level size mismatch => "
+                                    + p_Filename);
+        checksums.push_back (Cache::checksum (level.data (), level.size ()));
+      }
+    uint64_t checksum = levelChecksum (checksums.data (), checksums.size ());
+
+    std::vector<uint32_t> dfd = buildDfd (p_VkFormat);
+    std::vector<uint8_t> kvd;
+    appendKeyValue (kvd, WRITER_KEY, WRITER, sizeof (WRITER));
+    appendKeyValue (kvd, CHECKSUM_KEY, &checksum, sizeof (checksum));
+    appendKeyValue (kvd, SOURCE_KEY, &p_SourceKey, sizeof (p_SourceKey));
+
+    FileHeader header;
+    std::memcpy (header.identifier, IDENTIFIER, sizeof (IDENTIFIER));
+    header.vkFormat = p_VkFormat;
+    header.pixelWidth = p_Width;
+    header.pixelHeight = p_Height;
+    header.levelCount = static_cast<uint32_t> (p_Levels.size ());
+    header.dfdByteOffset = static_cast<uint32_t> (
+        sizeof (FileHeader) + p_Levels.size () * sizeof (LevelIndex));
+    header.dfdByteLength
+        = static_cast<uint32_t> (dfd.size () * sizeof (uint32_t));
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t> (kvd.size ());
+
+    // Levels are stored smallest first, each aligned to the texel block
+    size_t alignment = std::lcm (elementBytes (p_VkFormat), size_t (4));
+    std::vector<LevelIndex> index (p_Levels.size ());
+    size_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for (size_t l = p_Levels.size (); l-- > 0;)
+      {
+        offset = align (offset, alignment);
+        index.at (l).byteOffset = offset;
+        index.at (l).byteLength = p_Levels.at (l).size ();
+        index.at (l).uncompressedByteLength = p_Levels.at (l).size ();
+        offset += p_Levels.at (l).size ();
+      }
+
+    std::string tmpFilename = p_Filename + ".tmp";
+    {
+      std::ofstream file (tmpFilename, std::ios::binary | std::ios::trunc);
+      if (!file.is_open ())
+        throw std::runtime_error ("Failed to create KTX2 file => "
+                                  + tmpFilename);
+
+      file.write (reinterpret_cast<const char *> (&header), sizeof (header));
+      file.write (reinterpret_cast<const char *> (index.data ()),
+                  index.size () * sizeof (LevelIndex));
+      file.write (reinterpret_cast<const char *> (dfd.data ()),
+                  dfd.size () * sizeof (uint32_t));
+      file.write (reinterpret_cast<const char *> (kvd.data ()), kvd.size ());
+
+      size_t written = header.kvdByteOffset + header.kvdByteLength;
+      const char padding[16] = {};
+      for (size_t l = p_Levels.size (); l-- > 0;)
+        {
+          file.write (padding, index.at (l).byteOffset - written);
+          file.write (reinterpret_cast<const char *> (p_Levels.at (l).data ()),
+                      p_Levels.at (l).size ());
+          written = index.at (l).byteOffset + p_Levels.at (l).size ();
+        }
+
+      if (!file)
+        throw std::runtime_error ("Failed writing KTX2 file => "
+                                  + tmpFilename);
+    }
+
+    std::filesystem::rename (tmpFilename, p_Filename);
+    return;
+  }
+}; // namespace Ktx
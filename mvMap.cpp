@@ -1,21 +1,22 @@
-#define STBI_IMAGE_IMPLEMENTATION
 #include "mvMap.h"
 
 // For handling terrain related textures
 #include "mvImage.h"
+#include "mvTextures.h"
 
 // For struct Vertex definition
 #include "mvModel.h"
 
-// Image loading/decoding methods
-#include "stb_image.h"
-
 // For interfacing with gui handler
 #include "mvGui.h"
 
 // For createBuffer methods & access to vk::Device
 #include "mvEngine.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 MapHandler::MapHandler (Engine *p_ParentEngine)
 {
   if (!p_ParentEngine)
@@ -31,10 +32,37 @@ MapHandler::~MapHandler () { return; }
 void
 MapHandler::cleanup (const vk::Device &p_LogicalDevice)
 {
+  // worker may still be filling staging buffers
+  if (loadJob.valid ())
+    {
+      try
+        {
+          auto map = loadJob.get ();
+          destroyPending (*map);
+        }
+      catch (std::exception &e)
+        {
+          // nothing was kept by a failed load
+        }
+    }
+  if (uploading)
+    {
+      destroyPending (*uploading);
+      uploading.reset ();
+    }
+
+  // device is idle by now
+  releaseRetired (true);
+
   if (defaultTexture)
     {
-      defaultTexture->destroy ();
-      defaultTexture.reset ();
+      ptrEngine->textures->release (defaultTexture);
+      defaultTexture = nullptr;
+    }
+  if (heightTexture)
+    {
+      heightTexture->destroy ();
+      heightTexture.reset ();
     }
   if (vertexBuffer)
     {
@@ -69,1332 +97,1329 @@ MapHandler::readHeightMap (GuiHandler *p_Gui, std::string p_Filename)
   if (!ptrEngine)
     throw std::runtime_error (
         "Pass map handler core engine before attempting to read heightmaps");
-  auto [vertices, indices] = readHeightMap (p_Filename);
 
-  // validate before return
-  if (vertices.empty () || indices.empty ())
-    throw std::runtime_error (
-        "Empty vertices/indices container returned; Failed to read map mesh");
+  if (isLoading)
+    throw std::runtime_error ("A map is already loading in the background");
 
-  // update gui
-  p_Gui->setLoadedTerrainFile (filename);
+  if (terrainMode == TerrainMode::eHeightfield && !isHeightfieldSupported ())
+    throw std::runtime_error (
+        "Heightfield terrain requires shaders/vsTerrain.spv");
 
-  // Load default terrain texture
-  if (!defaultTexture)
+  auto map = buildMap (p_Filename, terrainMode, decimationError);
+  try
     {
-      // allocate image
-      defaultTexture = std::make_unique<Image> ();
-
-      Image::ImageCreateInfo createInfo = {};
-      createInfo.tiling = vk::ImageTiling::eOptimal;
-      createInfo.format = vk::Format::eR8G8B8A8Srgb;
-      createInfo.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
-      createInfo.usage = vk::ImageUsageFlagBits::eSampled
-                         | vk::ImageUsageFlagBits::eTransferDst;
-
-      try
-        {
-          defaultTexture->create (ptrEngine, createInfo,
-                                  "terrain/defaultTexture.png");
-        }
-      catch (std::exception &e)
-        {
-          throw std::runtime_error ("Failed to load default terrain texture");
-        }
-
-      auto layout = ptrEngine->allocator->getLayout (
-          vk::DescriptorType::eCombinedImageSampler);
-
-      ptrEngine->allocator->allocateSet (layout, terrainDescriptor);
-      ptrEngine->allocator->updateSet (defaultTexture->descriptor,
-                                       terrainDescriptor, 0);
-      std::cout << "Loaded default terrain texture\n";
+      submitCopy (*map);
+      vk::Result res = ptrEngine->logicalDevice.waitForFences (
+          map->fence, VK_TRUE, UINT64_MAX);
+      if (res != vk::Result::eSuccess)
+        throw std::runtime_error ("Error occurred while waiting for fence");
+
+      // no frames are in flight before the render loop
+      ptrEngine->logicalDevice.waitIdle ();
+      swapIn (p_Gui, *map);
+    }
+  catch (...)
+    {
+      destroyPending (*map);
+      throw;
     }
-
   return;
 }
 
-std::pair<std::vector<Vertex>, std::vector<uint32_t>>
-MapHandler::readHeightMap (std::string p_Filename)
+bool
+MapHandler::requestHeightMap (std::string p_Filename, TerrainMode p_Mode)
 {
-  //   // Look for already optimized filename
-  if (isAlreadyOptimized (p_Filename))
+  if (isLoading)
     {
-      std::mutex mtx; // for chunk container
-      std::vector<std::pair<std::vector<Vertex>, std::vector<uint32_t>>>
-          chunks (4);
-
-      size_t numThreads = 4;
-
-      std::vector<std::thread> threads (numThreads);
-
-      std::cout << "Created " << threads.size () << " threads awaiting jobs\n";
-
-      // spin up threads
-      size_t idx = 0;
-      auto spinThreadReadVertex = [&] (std::thread &thread) {
-        auto job = [&] (size_t ourIndex) {
-          std::vector<Vertex> verts;
-          auto name = getBaseFilename (p_Filename) + std::to_string (ourIndex)
-                      + "_v.bin";
-          // read file
-          readVertexFile (name, verts);
-
-          // insert in container
-          do
-            {
-              if (!mtx.try_lock ())
-                continue;
-              chunks.at (ourIndex).first = verts;
-              mtx.unlock ();
-              break;
-            }
-          while (1);
-        };
-
-        thread = std::thread (job, idx);
-        idx++;
-      };
-
-      auto joinThread = [&] (std::thread &thread) {
-        if (thread.joinable ())
-          thread.join ();
-      };
-
-      std::for_each (threads.begin (), threads.end (), spinThreadReadVertex);
-
-      std::for_each (threads.begin (), threads.end (), joinThread);
-
-      std::cout << "Done reading vertex files\n";
-
-      // load indices
-      idx = 0;
-      auto spinThreadReadIndex = [&] (std::thread &thread) {
-        auto job = [&] (size_t ourIndex) {
-          std::vector<uint32_t> inds;
-          auto name = getBaseFilename (p_Filename) + std::to_string (ourIndex)
-                      + "_i.bin";
-          // read file
-          readIndexFile (name, inds);
-
-          // insert into container
-          do
-            {
-              if (!mtx.try_lock ())
-                continue;
-              chunks.at (ourIndex).second = inds;
-              mtx.unlock ();
-              break;
-            }
-          while (1);
-        };
-        thread = std::thread (job, idx);
-        idx++;
-      };
-
-      std::for_each (threads.begin (), threads.end (), spinThreadReadIndex);
-
-      std::for_each (threads.begin (), threads.end (), joinThread);
-
-      std::cout << "Done reading index files\n";
+      std::cout << "Map load already in progress; ignoring " << p_Filename
+                << "\n";
+      return false;
+    }
 
-      // ensure no empty chunks
-      auto allLoaded = std::all_of (
-          chunks.begin (), chunks.end (),
-          [] (std::pair<std::vector<Vertex>, std::vector<uint32_t>> &p) {
-            if (p.first.empty () || p.second.empty ())
-              return false;
+  loadError.clear ();
 
-            return true;
-          });
+  // pipelines are only safe to read on the render thread
+  if (p_Mode == TerrainMode::eHeightfield && !isHeightfieldSupported ())
+    {
+      loadError = "Heightfield terrain requires shaders/vsTerrain.spv";
+      return false;
+    }
 
-      if (!allLoaded)
-        std::cout << "One or more chunk vertices failed to load\n";
+  isLoading = true;
+  loadProgress = 0.0f;
+  loadStage = "Queued";
 
-      std::vector<Vertex> vertices;
-      std::vector<uint32_t> indices;
+  loadJob = ptrEngine->workers.submit (
+      [this, p_Filename, p_Mode, maxError = decimationError] () {
+        return buildMap (p_Filename, p_Mode, maxError);
+      });
+  return true;
+}
 
-      // concat all data
-      for (auto &chunkpair : chunks)
+void
+MapHandler::update (GuiHandler *p_Gui)
+{
+  releaseRetired (false);
+
+  // previous map stays drawn whenever a load fails
+  auto fail = [&] (const std::string &p_Reason) {
+    loadError = p_Reason;
+    std::cout << "Failed to load map => " << p_Reason << "\n";
+    isLoading = false;
+  };
+
+  // worker finished building; start the device copy
+  if (loadJob.valid ()
+      && loadJob.wait_for (std::chrono::seconds (0))
+             == std::future_status::ready)
+    {
+      std::unique_ptr<PendingMap> map;
+      try
         {
-          // vertexOffsets.push_back (vertices.size ());
-          // indexOffsets.push_back (
-          // { indices.size (), chunkpair.second.size () });
-
-          // increment each indice by indices.size() before copy to apply
-          // its offset
-          std::for_each (chunkpair.second.begin (), chunkpair.second.end (),
-                         [&] (uint32_t &index) { index += vertices.size (); });
-
-          // copy vertices
-          std::copy (chunkpair.first.begin (), chunkpair.first.end (),
-                     std::back_inserter (vertices));
-
-          // copy indices
-          std::copy (chunkpair.second.begin (), chunkpair.second.end (),
-                     std::back_inserter (indices));
+          map = loadJob.get ();
+          loadStage = "Uploading";
+          submitCopy (*map);
+          uploading = std::move (map);
         }
+      catch (std::exception &e)
+        {
+          if (map)
+            destroyPending (*map);
+          fail (e.what ());
+        }
+    }
 
-      // Ensure we setup sizes
-      vertexCount = vertices.size ();
-      indexCount = indices.size ();
-
-      allocate (vertices, indices);
-
-      isMapLoaded = true;
-      filename = p_Filename;
+  if (!uploading || !canSwap (*uploading)
+      || ptrEngine->logicalDevice.getFenceStatus (uploading->fence)
+             != vk::Result::eSuccess)
+    return;
 
-      return { vertices, indices };
+  try
+    {
+      swapIn (p_Gui, *uploading);
+      isLoading = false;
     }
+  catch (std::exception &e)
+    {
+      destroyPending (*uploading);
+      fail (e.what ());
+    }
+  uploading.reset ();
+  return;
+}
 
-  // Pre optimized file does not exist, load raw & generate optimizations
+std::unique_ptr<MapHandler::PendingMap>
+MapHandler::buildMap (const std::string &p_Filename, TerrainMode p_Mode,
+                      float p_MaxError)
+{
+  auto map = std::make_unique<PendingMap> ();
+  map->filename = p_Filename;
+  map->mode = p_Mode;
+  map->maxError = std::max (p_MaxError, 0.0f);
+  loadProgress = 0.0f;
 
   try
     {
-      // Check if file exists
-      if (!std::filesystem::exists (p_Filename))
-        throw std::runtime_error ("File " + p_Filename + " does not exist");
-
-      // Read the image in
-      int tXLength = 0;
-      int tZLength = 0;
-      int tChannels = 0;
-      stbi_uc *stbiRawImage
-          = stbi_load (p_Filename.c_str (), &tXLength, &tZLength, &tChannels,
-                       STBI_rgb_alpha);
-
-      if (!stbiRawImage)
-        throw std::runtime_error ("STBI failed to open file => " + p_Filename);
-
-      // validate return values
-      if (tXLength < 0 || tZLength < 0 || tChannels < 0)
-        throw std::runtime_error ("STBI returned invalid values :: width, "
-                                  "height or color channels is < 0");
-
-      if (tXLength % 2 != 0 || tXLength != tZLength)
-        throw std::runtime_error (
-            "Maps must be even squares where each side is divisible by 2");
-
-      size_t xLength = static_cast<size_t> (tXLength);
-      size_t zLength = static_cast<size_t> (tZLength);
-      [[maybe_unused]] size_t channels = static_cast<size_t> (tChannels);
-
-      // Place into vector
-      std::vector<unsigned char> rawImage (
-          stbiRawImage, stbiRawImage + (xLength * zLength * 4));
-
-      // cleanup raw c interface buf
-      stbi_image_free (stbiRawImage);
-
-      // Extract height values and place into new vector
-      std::vector<Vertex> heightValues;
-      int offset = 0;
-      size_t splitWidth = xLength / 2;
-      for (size_t j = 0; j < zLength; j++)
+      // The heightmap itself is the GPU resource; no mesh or cache involved
+      if (p_Mode == TerrainMode::eHeightfield)
         {
-          for (size_t i = 0; i < xLength; i++)
-            {
-              glm::vec4 color = { 1.0f, 1.0f, 1.0f, 1.0f };
-
-              // if left edge
-              if (i == 0 || i == splitWidth)
-                {
-                  if (j == 0 || j == splitWidth) // if top left
-                    {
-                      color = { 1.0f, 1.0f, 0.0f, 1.0f };
-                    }
-                  else if (j == splitWidth - 1
-                           || j == zLength - 1) // if bottom left
-                    {
-                      color = { 1.0f, 0.5f, 0.5f, 1.0f };
-                    }
-                  else
-                    {
-                      color = { 1.0f, 0.0f, 0.0f, 1.0f };
-                    }
-                }
-              // if top edge
-              if (j == 0 || j == splitWidth)
-                {
-                  if (i == 0 || i == splitWidth) // top left
-                    {
-                      color = { 1.0f, 1.0f, 0.0f, 1.0f };
-                    }
-                  else if (i == splitWidth - 1
-                           || i == xLength - 1) // top right
-                    {
-                      color = { 0.0f, 1.0f, 1.0f, 1.0f };
-                    }
-                  else
-                    {
-                      color = { 0.0f, 1.0f, 0.0f, 1.0f };
-                    }
-                }
-              // right edge
-              if (i == splitWidth - 1 || i == xLength - 1)
-                {
-                  if (j == 0 || j == splitWidth) // top right
-                    {
-                      color = { 0.0f, 1.0f, 1.0f, 1.0f };
-                    }
-                  else if (j == splitWidth - 1
-                           || j == zLength - 1) // bottom right
-                    {
-                      color = { 0.5f, 0.5f, 1.0f, 1.0f };
-                    }
-                  else
-                    {
-                      color = { 0.0f, 0.0f, 1.0f, 1.0f };
-                    }
-                }
-              // bottom edge
-              if (j == splitWidth - 1 || j == zLength - 1)
-                {
-                  // bottom left
-                  if (i == 0 || i == splitWidth)
-                    {
-                      color = { 1.0f, 0.5f, 0.5f, 1.0f };
-                    }
-                  else if (i == splitWidth - 1
-                           || i == xLength - 1) // bottom right
-                    {
-                      color = { 0.5f, 0.5f, 1.0f, 1.0f };
-                    }
-                  else
-                    {
-                      color = { 0.5f, 0.5f, 0.5f, 1.0f };
-                    }
-                }
-              heightValues.push_back (Vertex{
-                  {
-                      static_cast<float> (i),
-                      static_cast<float> (rawImage.at (offset)) * -1.0f,
-                      static_cast<float> (j),
-                      1.0f,
-                  },
-                  color,
-                  { 0.0f, 0.0f, 0.0f, 0.0f },
-              });
-              offset += 4;
-            }
+          loadStage = "Reading heightmap";
+          map->heights = Terrain::readHeights (p_Filename, map->xLength,
+                                              map->zLength);
+          loadProgress = 0.5f;
+          loadHeightfield (*map);
         }
-      // Divide map in half -- we can use UP 4 cores
-      // Anything less and we simply parse each section in a ring buffer of
-      // threads
-      if (xLength % 2 != 0)
-        throw std::runtime_error (
-            "Maps must be an even square; Where a side is divisible by 2");
-
-      size_t numThreads = 4;
-
-      std::vector<std::thread> threads (numThreads);
-
-      std::cout << "Created " << threads.size () << " threads awaiting jobs\n";
-
-      std::vector<std::vector<Vertex>> splitValues;
-
-      std::vector<Vertex>::iterator beginIterator = heightValues.begin ();
-      std::vector<Vertex>::iterator bottomQuadIterator
-          = heightValues.begin () + (xLength * splitWidth);
-      std::vector<Vertex>::iterator endIterator = heightValues.end ();
-
-      // Need to divide mesh into even squares
-      // We lose dimensions of map when just fetching contiguous elements
-      // copy top quadrants
-      std::vector<Vertex> tlm;
-      std::vector<Vertex> trm;
-      bool leftOrRight = false; // false = left
-      do
+      else
         {
-          if (!leftOrRight) // copy left
-            {
-              std ::copy (beginIterator, std::next (beginIterator, splitWidth),
-                          std::back_inserter (tlm));
-            }
-          else // copy right
+          buildMesh (*map);
+
+          // Only a cache loaded without its source image lacks heights;
+          // the map still draws without height queries
+          if (map->heights.empty ())
             {
-              std::copy (beginIterator, std::next (beginIterator, splitWidth),
-                         std::back_inserter (trm));
+              std::cout << "No height queries for " << p_Filename << "\n";
+              map->xLength = 0;
+              map->zLength = 0;
             }
-          // Flip
-          leftOrRight = !leftOrRight;
-          // Incr
-          beginIterator += splitWidth;
         }
-      while (beginIterator < bottomQuadIterator);
 
-      // Copy bottom quadrants
-      std::vector<Vertex> blm;
-      std::vector<Vertex> brm;
-      leftOrRight = false; // false = left
-      do
-        {
+      // validate before return; heightfield maps have no vertices
+      if (map->indexCount == 0
+          || (p_Mode == TerrainMode::eMesh && map->vertexCount == 0))
+        throw std::runtime_error ("Empty vertices/indices container "
+                                  "returned; Failed to read map mesh");
 
-          if (!leftOrRight) // copy bottom left
-            {
-              std::copy (beginIterator, std::next (beginIterator, splitWidth),
-                         std::back_inserter (blm));
-            }
-          else // copy bottom right
-            {
-              std::copy (beginIterator, std::next (beginIterator, splitWidth),
-                         std::back_inserter (brm));
-            }
-          // flip
-          leftOrRight = !leftOrRight;
-          // incr
-          beginIterator += splitWidth;
+      if (!map->heights.empty ())
+        {
+          loadStage = "Building height pyramid";
+          map->heightPyramid = buildHeightPyramid (
+              map->heights, map->xLength, map->zLength);
         }
-      while (beginIterator < endIterator);
+    }
+  catch (...)
+    {
+      destroyPending (*map);
+      throw;
+    }
 
-      splitValues = { tlm, trm, blm, brm };
+  loadProgress = 0.95f;
+  return map;
+}
 
-      std::mutex mtx; // lock access to mesh vector<vector>
+void
+MapHandler::buildMesh (PendingMap &p_Map)
+{
+  const std::string &filename = p_Map.filename;
+  std::string base = Terrain::getBaseFilename (filename);
+
+  // Source texels decide which cached tiles are still valid; without them
+  // an existing cache is loaded as is
+  loadStage = "Reading heightmap";
+  size_t xLength = 0;
+  size_t zLength = 0;
+  std::vector<uint8_t> heights;
+  try
+    {
+      heights = Terrain::readHeights (filename, xLength, zLength);
+    }
+  catch (std::exception &e)
+    {
+      size_t cachedChunks = 0;
+      if (!Terrain::hasBinaryCache (base, cachedChunks))
+        throw std::runtime_error ("Failed to open heightmap " + filename
+                                  + " => " + e.what ());
+
+      std::cout << "Loading terrain cache without source => " << e.what ()
+                << "\n";
+      loadCache (p_Map, base, cachedChunks);
+      return;
+    }
+  loadProgress = 0.05f;
 
-      size_t idx = 0;
+  try
+    {
+      auto start = std::chrono::steady_clock::now ();
 
-      auto spinThreadGenerateMesh = [&] (std::thread &thread) {
-        if (idx < splitValues.size ())
-          {
-            auto job = [&] (size_t ourIndex) {
-              std::vector<Vertex> tmp;
-              do
-                {
-                  if (!mtx.try_lock ())
-                    continue;
+      // Cached tiles stay mapped until copied into the staging buffers
+      auto baked = Terrain::bake (ptrEngine->workers, base, heights, xLength,
+                                  zLength, tilesPerSide, p_Map.maxError,
+                                  { &loadProgress, &loadStage });
 
-                  auto cpy = splitValues.at (ourIndex);
-                  mtx.unlock ();
-                  tmp = generateMesh (splitWidth, splitWidth, cpy);
-                  break; // done gen mesh
-                }
-              while (1);
+      // kept for height queries once swapped in
+      p_Map.heights = std::move (heights);
+      p_Map.xLength = xLength;
+      p_Map.zLength = zLength;
 
-              // save results
-              do
-                {
-                  if (!mtx.try_lock ())
-                    continue;
-                  splitValues.at (ourIndex).clear ();
-                  splitValues.at (ourIndex) = tmp;
-                  mtx.unlock ();
-                  break; // done saving
-                }
-              while (1);
-            };
+      uploadTiles (p_Map, baked.views ());
 
-            thread = std::thread (job, idx);
-            idx++;
-          }
-      };
+      std::chrono::duration<double, std::milli> elapsed
+          = std::chrono::steady_clock::now () - start;
+      std::cout << "Built " << baked.regions.size () << " terrain tiles in "
+                << elapsed.count () << " ms\n";
+      return;
+    }
+  catch (std::filesystem::filesystem_error &e)
+    {
+      throw std::runtime_error ("Terrain cache error for " + filename
+                                + " => " + e.what ());
+    }
+  catch (std::exception &e)
+    {
+      throw std::runtime_error ("std error => " + std::string (e.what ()));
+    }
+}
 
-      auto joinThread = [&] (std::thread &thread) {
-        if (thread.joinable ())
-          {
-            thread.join ();
-          }
-      };
+void
+MapHandler::submitCopy (PendingMap &p_Map)
+{
+  auto &device = ptrEngine->logicalDevice;
+
+  auto createDeviceLocal = [&] (const MapBuffer &p_Staging,
+                                MapBuffer &p_Buffer,
+                                vk::BufferUsageFlags p_Usage) {
+    if (!p_Staging.buffer)
+      return;
+    p_Buffer.size = p_Staging.size;
+    ptrEngine->createBuffer (p_Usage | vk::BufferUsageFlagBits::eTransferDst,
+                             vk::MemoryPropertyFlagBits::eDeviceLocal,
+                             p_Buffer.size, &p_Buffer.buffer,
+                             &p_Buffer.memory);
+  };
+  createDeviceLocal (p_Map.stagingVertices, p_Map.vertices,
+                     vk::BufferUsageFlagBits::eVertexBuffer);
+  createDeviceLocal (p_Map.stagingIndices, p_Map.indices,
+                     vk::BufferUsageFlagBits::eIndexBuffer);
+
+  vk::CommandBufferAllocateInfo allocInfo;
+  allocInfo.commandPool = ptrEngine->commandPool;
+  allocInfo.level = vk::CommandBufferLevel::ePrimary;
+  allocInfo.commandBufferCount = 1;
+  p_Map.commandBuffer = device.allocateCommandBuffers (allocInfo).at (0);
+
+  vk::CommandBufferBeginInfo beginInfo;
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+  p_Map.commandBuffer.begin (beginInfo);
+
+  if (p_Map.vertices.buffer)
+    p_Map.commandBuffer.copyBuffer (
+        p_Map.stagingVertices.buffer, p_Map.vertices.buffer,
+        vk::BufferCopy (0, 0, p_Map.vertices.size));
+  if (p_Map.indices.buffer)
+    p_Map.commandBuffer.copyBuffer (p_Map.stagingIndices.buffer,
+                                    p_Map.indices.buffer,
+                                    vk::BufferCopy (0, 0, p_Map.indices.size));
+
+  // make the copy visible to vertex input of later frames
+  vk::MemoryBarrier barrier;
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead
+                          | vk::AccessFlagBits::eIndexRead;
+  p_Map.commandBuffer.pipelineBarrier (
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags (),
+      barrier, nullptr, nullptr);
+
+  p_Map.commandBuffer.end ();
+
+  p_Map.fence = device.createFence (vk::FenceCreateInfo ());
+
+  vk::SubmitInfo submitInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &p_Map.commandBuffer;
+  ptrEngine->graphicsQueue.submit (submitInfo, p_Map.fence);
+  return;
+}
 
-      std::for_each (threads.begin (), threads.end (), spinThreadGenerateMesh);
+bool
+MapHandler::canSwap (const PendingMap &p_Map) const
+{
+  if (p_Map.mode != TerrainMode::eHeightfield)
+    return true;
 
-      std::for_each (threads.begin (), threads.end (), joinThread);
+  size_t next = (heightfieldDescriptor == heightfieldSets[0]) ? 1 : 0;
+  return ptrEngine->completedFrames >= heightfieldSetFrames[next];
+}
 
-      struct ChunkData
-      {
-        std::vector<Vertex *> leftEdge;
-        std::vector<Vertex *> rightEdge;
-        std::vector<Vertex *> topEdge;
-        std::vector<Vertex *> bottomEdge;
-
-        Vertex *tl = nullptr;
-        Vertex *tr = nullptr;
-        Vertex *bl = nullptr;
-        Vertex *br = nullptr;
-      };
+void
+MapHandler::swapIn (GuiHandler *p_Gui, PendingMap &p_Map)
+{
+  // Created before anything is retired so a failure keeps the current map
+  std::unique_ptr<Image> image;
+  if (p_Map.mode == TerrainMode::eHeightfield)
+    {
+      // Heights are sampled as is; clamp keeps edge texels from wrapping
+      image = std::make_unique<Image> ();
 
-      std::vector<ChunkData> chunks (4);
+      Image::ImageCreateInfo createInfo = {};
+      createInfo.tiling = vk::ImageTiling::eOptimal;
+      createInfo.format = vk::Format::eR8Unorm;
+      createInfo.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+      createInfo.usage = vk::ImageUsageFlagBits::eSampled
+                         | vk::ImageUsageFlagBits::eTransferDst;
+      createInfo.addressMode = vk::SamplerAddressMode::eClampToEdge;
+      // fetched at level 0 only
+      createInfo.generateMipmaps = false;
 
-      // iterate each mesh vertices; find origin of edges
-      size_t chunkidx = 0;
-      for (auto &m : splitValues) // for each chunk
-        {
-          // iterate each vertex & find our tagged vertices
-          for (auto &v : m)
-            {
-              // left edge
-              if (v.color == glm::vec4 (1.0f, 0.0f, 0.0f, 1.0f))
-                {
-                  chunks.at (chunkidx).leftEdge.push_back (&v);
-                }
-              // top edge
-              if (v.color == glm::vec4 (0.0f, 1.0f, 0.0f, 1.0f))
-                {
-                  chunks.at (chunkidx).topEdge.push_back (&v);
-                }
-              // right edge
-              if (v.color == glm::vec4 (0.0f, 0.0f, 1.0f, 1.0f))
-                {
-                  chunks.at (chunkidx).rightEdge.push_back (&v);
-                }
-              // bottom edge
-              if (v.color == glm::vec4 (0.5f, 0.5f, 0.5f, 1.0f))
-                {
-                  chunks.at (chunkidx).bottomEdge.push_back (&v);
-                }
+      image->create (ptrEngine, createInfo, p_Map.heights.data (),
+                     static_cast<uint32_t> (p_Map.xLength),
+                     static_cast<uint32_t> (p_Map.zLength), 1);
+    }
 
-              // corner cases
-              if (v.color == glm::vec4 (1.0f, 1.0f, 0.0f, 1.0f)) // top left
-                {
-                  chunks.at (chunkidx).tl = &v;
-                }
-              if (v.color == glm::vec4 (0.0f, 1.0f, 1.0f, 1.0f)) // top right
-                {
-                  chunks.at (chunkidx).tr = &v;
-                }
-              if (v.color == glm::vec4 (1.0f, 0.5f, 0.5f, 1.0f)) // bottom left
-                {
-                  chunks.at (chunkidx).bl = &v;
-                }
-              if (v.color
-                  == glm::vec4 (0.5f, 0.5f, 1.0f, 1.0f)) // bottom right
-                {
-                  chunks.at (chunkidx).br = &v;
-                }
-            }
-          chunkidx++;
-        }
+  // Frames up to the last submitted one may still read the current map
+  RetiredMap old;
+  old.frame = ptrEngine->submittedFrames;
+  if (vertexBuffer)
+    old.buffers.push_back ({ *vertexBuffer, *vertexMemory });
+  if (indexBuffer)
+    old.buffers.push_back ({ *indexBuffer, *indexMemory });
+  old.heightTexture = std::move (heightTexture);
+  if (!old.buffers.empty () || old.heightTexture)
+    retired.push_back (std::move (old));
 
-      std::vector<Vertex> stitches;
+  vertexBuffer.reset ();
+  vertexMemory.reset ();
+  indexBuffer.reset ();
+  indexMemory.reset ();
 
-      /*
-        Stitch all the edges of chunks & reset colors
-      */
-      {
-        // clean edge before stitching
-        cleanEdge (chunks.at (0).rightEdge, false);
-        cleanEdge (chunks.at (1).leftEdge, false);
-        // stitch tl -> tr
-        stitchEdge (chunks.at (0).rightEdge, chunks.at (1).leftEdge, stitches,
-                    true);
-
-        // prune dups
-        cleanEdge (chunks.at (2).rightEdge, false);
-        cleanEdge (chunks.at (3).leftEdge, false);
-        // stitch bl -> br
-        stitchEdge (chunks.at (2).rightEdge, chunks.at (3).leftEdge, stitches,
-                    true);
-
-        // prune dups
-        cleanEdge (chunks.at (0).bottomEdge, true);
-        cleanEdge (chunks.at (2).topEdge, true);
-        // stich tl -> bl
-        stitchEdge (chunks.at (0).bottomEdge, chunks.at (2).topEdge, stitches,
-                    false);
-
-        // prune dups
-        cleanEdge (chunks.at (1).bottomEdge, true);
-        cleanEdge (chunks.at (3).topEdge, true);
-        // stitch tr -> br
-        stitchEdge (chunks.at (1).bottomEdge, chunks.at (3).topEdge, stitches,
-                    false);
-
-        // stitch tl -> tr corner
-        stitchCorner (chunks.at (0).tr, chunks.at (0).rightEdge.at (0),
-                      chunks.at (1).tl, chunks.at (1).leftEdge.at (0),
-                      stitches, eFirstCornerToFirstEdge);
-
-        // stitch tl -> bl corner
-        stitchCorner (chunks.at (0).bl, chunks.at (0).bottomEdge.at (0),
-                      chunks.at (2).tl, chunks.at (2).topEdge.at (0), stitches,
-                      eFirstCornerToSecondCorner);
-
-        // stitch bl -> br corner
-        stitchCorner (
-            chunks.at (2).br,
-            chunks.at (2).rightEdge.at (chunks.at (2).rightEdge.size () - 1),
-            chunks.at (3).bl,
-            chunks.at (3).leftEdge.at (chunks.at (3).leftEdge.size () - 1),
-            stitches, eFirstEdgeToFirstCorner);
-
-        // stitch tr -> br corner
-        stitchCorner (
-            chunks.at (1).br,
-            chunks.at (1).bottomEdge.at (chunks.at (1).bottomEdge.size () - 1),
-            chunks.at (3).tr,
-            chunks.at (3).topEdge.at (chunks.at (3).topEdge.size () - 1),
-            stitches, eFirstEdgeToSecondEdge);
-
-        // stitch tl -> bl RIGHT corner
-        stitchCorner (
-            chunks.at (0).br,
-            chunks.at (0).bottomEdge.at (chunks.at (0).bottomEdge.size () - 1),
-            chunks.at (2).tr,
-            chunks.at (2).topEdge.at (chunks.at (2).topEdge.size () - 1),
-            stitches, eFirstEdgeToSecondEdge);
-
-        // stitch tr -> br LEFT CORNER
-        stitchCorner (chunks.at (1).bl, chunks.at (1).bottomEdge.at (0),
-                      chunks.at (3).tl, chunks.at (3).topEdge.at (0), stitches,
-                      eFirstCornerToSecondCorner);
-        // stitch bl -> br RIGHT CORNER
-        stitchCorner (chunks.at (2).tr, chunks.at (2).rightEdge.at (0),
-                      chunks.at (3).tl, chunks.at (3).leftEdge.at (0),
-                      stitches, eFirstCornerToFirstEdge);
-
-        // stitch tl -> tr
-        stitchCorner (
-            chunks.at (0).br,
-            chunks.at (0).rightEdge.at (chunks.at (0).rightEdge.size () - 1),
-            chunks.at (1).bl,
-            chunks.at (1).leftEdge.at (chunks.at (1).leftEdge.size () - 1),
-            stitches, eFirstEdgeToFirstCorner);
-
-        // stitch center corners - provide params left->right order
-        stitchCorner (chunks.at (0).br, chunks.at (1).bl, chunks.at (2).tr,
-                      chunks.at (3).tl, stitches, eCenter);
-
-        // append to splitvals after all stitches generated; otherwise we
-        // invalidate our ptrs
-        splitValues.at (0).insert (splitValues.at (0).end (),
-                                   stitches.begin (), stitches.end ());
-
-        // reset colors for all verts
-        std::for_each (splitValues.begin (), splitValues.end (),
-                       [] (std::vector<Vertex> &values) {
-                         std::for_each (
-                             values.begin (), values.end (),
-                             [] (Vertex &vertex) {
-                               vertex.color = { 1.0f, 1.0f, 1.0f, 1.0f };
-                             });
-                       });
-      }
+  if (p_Map.vertices.buffer)
+    {
+      vertexBuffer = std::make_unique<vk::Buffer> (p_Map.vertices.buffer);
+      vertexMemory
+          = std::make_unique<vk::DeviceMemory> (p_Map.vertices.memory);
+      p_Map.vertices = {};
+    }
+  indexBuffer = std::make_unique<vk::Buffer> (p_Map.indices.buffer);
+  indexMemory = std::make_unique<vk::DeviceMemory> (p_Map.indices.memory);
+  p_Map.indices = {};
+
+  if (image)
+    {
+      heightTexture = std::move (image);
 
-      size_t tc = 0;
-      for (const auto &v : splitValues)
+      size_t next = (heightfieldDescriptor == heightfieldSets[0]) ? 1 : 0;
+      if (!heightfieldSets[next])
         {
-          tc += v.size ();
+          auto layout = ptrEngine->allocator->getLayout (
+              vk::DescriptorType::eCombinedImageSampler);
+          ptrEngine->allocator->allocateSet (layout, heightfieldSets[next]);
         }
+      ptrEngine->allocator->updateSet (heightTexture->descriptor,
+                                       heightfieldSets[next], 0);
 
-      std::vector<std::pair<std::vector<Vertex>, std::vector<uint32_t>>>
-          optimizedMesh (splitValues.size ());
+      // set being replaced is bound by frames up to now
+      heightfieldSetFrames[1 - next] = ptrEngine->submittedFrames;
+      heightfieldDescriptor = heightfieldSets[next];
+    }
 
-      idx = 0;
-      auto spinThreadOptimizeMesh = [&] (std::thread &thread) {
-        if (idx < splitValues.size ())
-          {
-            // optimize mesh
-            auto job = [&] (size_t ourIndex) {
-              std::pair<std::vector<Vertex>, std::vector<uint32_t>> pair;
-              // copy mesh data & optimize
-              do
-                {
-                  if (!mtx.try_lock ())
-                    continue;
-                  // copy and release
-                  auto cpy = splitValues.at (ourIndex);
-                  mtx.unlock ();
-
-                  // do work
-                  pair = optimize (cpy);
-                  break; // job done
-                }
-              while (1);
+  heightGrid = std::move (p_Map.heights);
+  gridWidth = heightGrid.empty () ? 0 : p_Map.xLength;
+  gridDepth = heightGrid.empty () ? 0 : p_Map.zLength;
+  if (!heightGrid.empty ())
+    heightGrid.resize (gridWidth * gridDepth + HEIGHT_GRID_PADDING, 0);
+  heightPyramid = heightGrid.empty () ? HeightPyramid ()
+                                      : std::move (p_Map.heightPyramid);
 
-              // move mesh into container safely
-              do
-                {
-                  // try lock
-                  if (!mtx.try_lock ())
-                    continue;
-                  // if lock, do work
-                  optimizedMesh.at (ourIndex) = pair;
-                  mtx.unlock ();
-                  break; // job done
-                }
-              while (1);
-            };
+  terrainMode = p_Map.mode;
+  indexType = p_Map.indexType;
+  vertexCount = p_Map.vertexCount;
+  indexCount = p_Map.indexCount;
+  renderChunks = std::move (p_Map.renderChunks);
+  patchLevels = p_Map.patchLevels;
 
-            thread = std::thread (job, idx);
-            idx++;
-          }
-      };
+  // rebuilt by cull () before every draw
+  visibleDraws.clear ();
+  visibleChunkCount = 0;
+  culledChunkCount = 0;
 
-      std::for_each (threads.begin (), threads.end (), spinThreadOptimizeMesh);
+  isMapLoaded = true;
+  filename = p_Map.filename;
 
-      std::for_each (threads.begin (), threads.end (), joinThread);
+  // staging buffers, copy command buffer & fence
+  destroyPending (p_Map);
 
-      idx = 0;
-      auto spinThreadWriteVertex = [&] (std::thread &thread) {
-        if (idx < splitValues.size ())
-          {
-            auto job = [&] (size_t ourIndex) {
-              auto fname = getBaseFilename (p_Filename);
-              do
-                {
-                  // try lock
-                  if (!mtx.try_lock ())
-                    continue;
-                  auto cpy = optimizedMesh.at (ourIndex).first;
-                  mtx.unlock ();
-                  // do work
-                  writeVertexFile (fname + std::to_string (ourIndex), cpy);
-                  break; // job done
-                }
-              while (1);
-            };
+  loadProgress = 1.0f;
+  loadStage = "Done";
 
-            thread = std::thread (job, idx);
-            idx++;
-          }
-      };
+  // update gui
+  p_Gui->setLoadedTerrainFile (filename);
 
-      // Write meshes to files
-      std::for_each (threads.begin (), threads.end (), spinThreadWriteVertex);
+  loadDefaultTexture ();
+  return;
+}
 
-      std::for_each (threads.begin (), threads.end (), joinThread);
+void
+MapHandler::destroyPending (PendingMap &p_Map)
+{
+  auto &device = ptrEngine->logicalDevice;
+  destroyBuffer (p_Map.stagingVertices);
+  destroyBuffer (p_Map.stagingIndices);
+  destroyBuffer (p_Map.vertices);
+  destroyBuffer (p_Map.indices);
 
-      idx = 0;
-      auto spinThreadWriteIndex = [&] (std::thread &thread) {
-        if (idx < splitValues.size ())
-          {
-            auto job = [&] (size_t ourIndex) {
-              auto fname = getBaseFilename (p_Filename);
+  if (p_Map.commandBuffer)
+    {
+      device.freeCommandBuffers (ptrEngine->commandPool, p_Map.commandBuffer);
+      p_Map.commandBuffer = nullptr;
+    }
+  if (p_Map.fence)
+    {
+      device.destroyFence (p_Map.fence);
+      p_Map.fence = nullptr;
+    }
+  return;
+}
 
-              do
-                {
-                  // try lock
-                  if (!mtx.try_lock ())
-                    continue;
-                  // copy
-                  auto cpy = optimizedMesh.at (ourIndex).second;
-                  // release
-                  mtx.unlock ();
-                  // do work
-                  writeIndexFile (fname + std::to_string (ourIndex), cpy);
-                  break; // job done
-                }
-              while (1);
-            };
+void
+MapHandler::releaseRetired (bool p_All)
+{
+  std::erase_if (retired, [&] (RetiredMap &p_Map) {
+    if (!p_All && ptrEngine->completedFrames < p_Map.frame)
+      return false;
+
+    for (auto &buffer : p_Map.buffers)
+      destroyBuffer (buffer);
+    if (p_Map.heightTexture)
+      p_Map.heightTexture->destroy ();
+    return true;
+  });
+  return;
+}
 
-            thread = std::thread (job, idx);
-            idx++;
-          }
-      };
+void
+MapHandler::destroyBuffer (MapBuffer &p_Buffer)
+{
+  if (p_Buffer.buffer)
+    ptrEngine->logicalDevice.destroyBuffer (p_Buffer.buffer);
+  if (p_Buffer.memory)
+    ptrEngine->logicalDevice.freeMemory (p_Buffer.memory);
+  p_Buffer = {};
+  return;
+}
 
-      std::for_each (threads.begin (), threads.end (), spinThreadWriteIndex);
+void
+MapHandler::loadDefaultTexture (void)
+{
+  if (defaultTexture)
+    return;
 
-      std::for_each (threads.begin (), threads.end (), joinThread);
+  Image::ImageCreateInfo createInfo = {};
+  createInfo.tiling = vk::ImageTiling::eOptimal;
+  createInfo.format = vk::Format::eR8G8B8A8Srgb;
+  createInfo.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+  createInfo.usage = vk::ImageUsageFlagBits::eSampled
+                     | vk::ImageUsageFlagBits::eTransferDst;
 
-      // free memory from old mesh data
-      for (auto &p : splitValues)
-        {
-          p.clear ();
-        }
-      splitValues.clear ();
+  // shared with any model using the same texels
+  try
+    {
+      defaultTexture = ptrEngine->textures->acquire (
+          "terrain/defaultTexture.png", createInfo);
+    }
+  catch (std::exception &e)
+    {
+      throw std::runtime_error ("Failed to load default terrain texture");
+    }
 
-      std::vector<Vertex> vertices;
-      std::vector<uint32_t> indices;
+  terrainDescriptor = defaultTexture->descriptor;
+  std::cout << "Loaded default terrain texture\n";
+  return;
+}
 
-      // concat vertices
-      for (auto &p : optimizedMesh)
-        {
-          // vertexOffsets.push_back (vertices.size ());
-          // indexOffsets.push_back ({ indices.size (), p.second.size () });
-
-          // increment each indice by indices.size() before copy to apply its
-          // offset
-          std::for_each (p.second.begin (), p.second.end (),
-                         [&] (uint32_t &index) { index += vertices.size (); });
-          // copy vertices
-          std::copy (p.first.begin (), p.first.end (),
-                     std::back_inserter (vertices));
-
-          // copy indices
-          std::copy (p.second.begin (), p.second.end (),
-                     std::back_inserter (indices));
-        }
+void
+MapHandler::bindBuffer (vk::CommandBuffer &p_CommandBuffer)
+{
+  // sanity check
+  if (!indexBuffer || !indexMemory
+      || (terrainMode == TerrainMode::eMesh && !vertexBuffer))
+    throw std::runtime_error (
+        "Attempted to bind buffer without creating them :: map handler");
 
-      // align indices for each submesh (indice += start offset)
-      // { index start, index count }
+  // heightfield positions come from gl_VertexIndex
+  if (vertexBuffer)
+    p_CommandBuffer.bindVertexBuffers (0, *vertexBuffer,
+                                       vk::DeviceSize{ 0 });
+  p_CommandBuffer.bindIndexBuffer (*indexBuffer, 0, indexType);
+  return;
+}
 
-      vertexCount = vertices.size ();
-      indexCount = indices.size ();
-      allocate (vertices, indices);
+float
+MapHandler::heightAt (float p_X, float p_Z) const
+{
+  if (heightGrid.empty ())
+    return 0.0f;
+
+  // Last texel row & column fall in the cell before them at t = 1
+  // 0 first so NaN clamps to 0 like the AVX2 path
+  float x = std::min (std::max (0.0f, p_X),
+                      static_cast<float> (gridWidth - 1));
+  float z = std::min (std::max (0.0f, p_Z),
+                      static_cast<float> (gridDepth - 1));
+  float cellX = std::min (std::floor (x), static_cast<float> (gridWidth - 2));
+  float cellZ = std::min (std::floor (z), static_cast<float> (gridDepth - 2));
+  float fx = x - cellX;
+  float fz = z - cellZ;
+
+  const uint8_t *cell = heightGrid.data ()
+                        + static_cast<size_t> (cellZ) * gridWidth
+                        + static_cast<size_t> (cellX);
+  float h00 = cell[0];
+  float h10 = cell[1];
+  float h01 = cell[gridWidth];
+  float h11 = cell[gridWidth + 1];
+
+  float top = h00 + (h10 - h00) * fx;
+  float bottom = h01 + (h11 - h01) * fx;
+  return top + (bottom - top) * fz;
+}
 
-      isMapLoaded = true;
-      filename = p_Filename;
+void
+MapHandler::heightsAt (std::span<const glm::vec2> p_Points,
+                       std::span<float> p_Heights) const
+{
+  if (p_Heights.size () < p_Points.size ())
+    throw std::runtime_error ("Height query output is smaller than the "
+                              "points queried");
+
+  size_t done = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  // Gather offsets are 32 bit
+  static const bool hasAvx2 = __builtin_cpu_supports ("avx2");
+  if (hasAvx2 && !heightGrid.empty ()
+      && heightGrid.size ()
+             <= static_cast<size_t> (std::numeric_limits<int32_t>::max ()))
+    done = heightsAtAvx2 (p_Points, p_Heights);
+#endif
+
+  for (size_t i = done; i < p_Points.size (); i++)
+    p_Heights[i] = heightAt (p_Points[i].x, p_Points[i].y);
+  return;
+}
 
-      return { vertices, indices };
-    }
-  catch (std::filesystem::filesystem_error &e)
-    {
-      throw std::runtime_error ("Failed to open heightmap " + p_Filename
-                                + " => " + e.what ());
-    }
-  catch (std::exception &e)
+#if defined(__x86_64__) || defined(__i386__)
+// Same operations as heightAt in the same order so both paths agree
+__attribute__ ((target ("avx2"))) size_t
+MapHandler::heightsAtAvx2 (std::span<const glm::vec2> p_Points,
+                           std::span<float> p_Heights) const
+{
+  const __m256 zero = _mm256_setzero_ps ();
+  const __m256 maxX = _mm256_set1_ps (static_cast<float> (gridWidth - 1));
+  const __m256 maxZ = _mm256_set1_ps (static_cast<float> (gridDepth - 1));
+  const __m256 lastCellX
+      = _mm256_set1_ps (static_cast<float> (gridWidth - 2));
+  const __m256 lastCellZ
+      = _mm256_set1_ps (static_cast<float> (gridDepth - 2));
+  const __m256i width = _mm256_set1_epi32 (static_cast<int32_t> (gridWidth));
+  const __m256i byte = _mm256_set1_epi32 (0xFF);
+  const int *grid = reinterpret_cast<const int *> (heightGrid.data ());
+
+  const size_t count = p_Points.size () & ~size_t (7);
+  const float *points = reinterpret_cast<const float *> (p_Points.data ());
+  for (size_t i = 0; i < count; i += 8)
     {
-      throw std::runtime_error ("std error => " + std::string (e.what ()));
+      // x0 z0 x1 z1 .. => x0..x7 & z0..z7
+      __m256 a = _mm256_loadu_ps (points + i * 2);
+      __m256 b = _mm256_loadu_ps (points + i * 2 + 8);
+      __m256 xs = _mm256_castpd_ps (_mm256_permute4x64_pd (
+          _mm256_castps_pd (_mm256_shuffle_ps (a, b, 0x88)), 0xD8));
+      __m256 zs = _mm256_castpd_ps (_mm256_permute4x64_pd (
+          _mm256_castps_pd (_mm256_shuffle_ps (a, b, 0xDD)), 0xD8));
+
+      // NaN clamps to 0; max returns its second operand on NaN
+      __m256 x = _mm256_min_ps (_mm256_max_ps (xs, zero), maxX);
+      __m256 z = _mm256_min_ps (_mm256_max_ps (zs, zero), maxZ);
+      __m256 cellX = _mm256_min_ps (_mm256_floor_ps (x), lastCellX);
+      __m256 cellZ = _mm256_min_ps (_mm256_floor_ps (z), lastCellZ);
+      __m256 fx = _mm256_sub_ps (x, cellX);
+      __m256 fz = _mm256_sub_ps (z, cellZ);
+
+      // one gather per row reads both texels of the cell
+      __m256i offset = _mm256_add_epi32 (
+          _mm256_mullo_epi32 (_mm256_cvttps_epi32 (cellZ), width),
+          _mm256_cvttps_epi32 (cellX));
+      __m256i topRow = _mm256_i32gather_epi32 (grid, offset, 1);
+      __m256i bottomRow
+          = _mm256_i32gather_epi32 (grid, _mm256_add_epi32 (offset, width), 1);
+
+      __m256 h00 = _mm256_cvtepi32_ps (_mm256_and_si256 (topRow, byte));
+      __m256 h10 = _mm256_cvtepi32_ps (
+          _mm256_and_si256 (_mm256_srli_epi32 (topRow, 8), byte));
+      __m256 h01 = _mm256_cvtepi32_ps (_mm256_and_si256 (bottomRow, byte));
+      __m256 h11 = _mm256_cvtepi32_ps (
+          _mm256_and_si256 (_mm256_srli_epi32 (bottomRow, 8), byte));
+
+      __m256 top = _mm256_add_ps (
+          h00, _mm256_mul_ps (_mm256_sub_ps (h10, h00), fx));
+      __m256 bottom = _mm256_add_ps (
+          h01, _mm256_mul_ps (_mm256_sub_ps (h11, h01), fx));
+      _mm256_storeu_ps (p_Heights.data () + i,
+                        _mm256_add_ps (top, _mm256_mul_ps (
+                                                _mm256_sub_ps (bottom, top),
+                                                fz)));
     }
+  return count;
 }
+#endif
 
-std::pair<std::vector<Vertex>, std::vector<uint32_t>>
-MapHandler::optimize (std::vector<Vertex> &p_Vertices)
+bool
+MapHandler::raycast (glm::vec3 p_Origin, glm::vec3 p_Direction,
+                     RayHit &p_Hit, float p_MaxDistance) const
 {
-  std::vector<Vertex> uniques;
-  std::vector<uint32_t> indices;
-
-  // Iterate unsorted vertices
-  bool start = true;
-  size_t startIndex = 0;
-  for (const auto &unoptimized : p_Vertices)
+  float length = glm::length (p_Direction);
+  if (heightGrid.empty () || !(length > 0.0f))
+    return false;
+
+  // Height space; y is height so up is +y like the bounds
+  const glm::vec3 origin (p_Origin.x, -p_Origin.y, p_Origin.z);
+  const glm::vec3 direction
+      = glm::vec3 (p_Direction.x, -p_Direction.y, p_Direction.z) / length;
+
+  const size_t xQuads = gridWidth - 1;
+  const size_t zQuads = gridDepth - 1;
+  const size_t top = heightPyramid.size ();
+  const HeightBounds root = cellBounds (top, 0, 0);
+
+  // Clip to the map's bounding box
+  const glm::vec3 boxMin (0.0f, root.min, 0.0f);
+  const glm::vec3 boxMax (static_cast<float> (xQuads), root.max,
+                          static_cast<float> (zQuads));
+  float tEnter = 0.0f;
+  float tExit = p_MaxDistance;
+  for (int axis = 0; axis < 3; axis++)
     {
-      bool isUnique = true;
-      // Get start index for last 10k vertices
-      if (!uniques.empty ())
+      if (direction[axis] == 0.0f)
         {
-          if (!start)
-            {
-              if (uniques.size () % 5000 == 0)
-                {
-                  startIndex += 5000;
-                }
-            }
-          else
+          if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis])
+            return false;
+          continue;
+        }
+      float t0 = (boxMin[axis] - origin[axis]) / direction[axis];
+      float t1 = (boxMax[axis] - origin[axis]) / direction[axis];
+      tEnter = std::max (tEnter, std::min (t0, t1));
+      tExit = std::min (tExit, std::max (t0, t1));
+    }
+  if (tEnter > tExit)
+    return false;
+
+  // Quad the ray is in; only the axis crossed is stepped exactly, the
+  // other is re-derived from the position within the cell left
+  auto quadAt = [&] (int p_Axis, float p_T, int64_t p_Lo, int64_t p_Hi) {
+    float position = origin[p_Axis] + direction[p_Axis] * p_T;
+    return std::clamp (static_cast<int64_t> (std::floor (position)), p_Lo,
+                       p_Hi);
+  };
+  int64_t x = quadAt (0, tEnter, 0, static_cast<int64_t> (xQuads) - 1);
+  int64_t z = quadAt (2, tEnter, 0, static_cast<int64_t> (zQuads) - 1);
+
+  // Bounds are whole texels; slack covers rounding of the ray heights
+  constexpr float slack = 1e-3f;
+  float t = tEnter;
+  size_t level = top;
+  while (true)
+    {
+      const int64_t size = int64_t (1) << level;
+      const int64_t cellX = x >> level;
+      const int64_t cellZ = z >> level;
+
+      // where the ray leaves this cell on each axis
+      float tx = std::numeric_limits<float>::max ();
+      float tz = std::numeric_limits<float>::max ();
+      if (direction.x != 0.0f)
+        tx = (static_cast<float> ((cellX + (direction.x > 0.0f)) * size)
+              - origin.x)
+             / direction.x;
+      if (direction.z != 0.0f)
+        tz = (static_cast<float> ((cellZ + (direction.z > 0.0f)) * size)
+              - origin.z)
+             / direction.z;
+      float tLeave = std::min ({ tx, tz, tExit });
+
+      HeightBounds bounds = cellBounds (level, cellX, cellZ);
+      float h0 = origin.y + direction.y * t;
+      float h1 = origin.y + direction.y * tLeave;
+      if (std::min (h0, h1) <= bounds.max + slack
+          && std::max (h0, h1) >= bounds.min - slack)
+        {
+          if (level > 0)
             {
-              start = false;
+              level--;
+              continue;
             }
 
-          for (size_t i = startIndex; i < uniques.size (); i++)
+          float hit = tExit;
+          glm::vec3 normal;
+          if (intersectQuad (x, z, origin, direction, tEnter, hit, normal))
             {
-              if (uniques.at (i).position == unoptimized.position)
-                {
-                  isUnique = false;
-                  indices.push_back (i);
-                }
+              glm::vec3 position = origin + direction * hit;
+              p_Hit.position = glm::vec3 (position.x, -position.y, position.z);
+              p_Hit.normal
+                  = glm::normalize (glm::vec3 (normal.x, -normal.y, normal.z));
+              p_Hit.distance = hit;
+              return true;
             }
         }
-      if (isUnique)
-        {
-          uniques.push_back (unoptimized);
-          indices.push_back (uniques.size () - 1);
-        }
-    }
-
-  return { uniques, indices };
-}
 
-void
-MapHandler::bindBuffer (vk::CommandBuffer &p_CommandBuffer)
-{
-  // sanity check
-  if (!vertexBuffer || !vertexMemory)
-    throw std::runtime_error (
-        "Attempted to bind buffer without creating them :: map handler");
-  p_CommandBuffer.bindVertexBuffers (0, *vertexBuffer, vk::DeviceSize{ 0 });
-  p_CommandBuffer.bindIndexBuffer (*indexBuffer, 0, vk::IndexType::eUint32);
-  return;
+      if (tLeave >= tExit)
+        return false;
+
+      // step into the neighbour across the face left through
+      const int64_t xLast
+          = std::min ((cellX + 1) * size, static_cast<int64_t> (xQuads)) - 1;
+      const int64_t zLast
+          = std::min ((cellZ + 1) * size, static_cast<int64_t> (zQuads)) - 1;
+      t = tLeave;
+      if (tx <= tz)
+        x = (direction.x > 0.0f) ? (cellX + 1) * size : cellX * size - 1;
+      else
+        x = quadAt (0, t, cellX * size, xLast);
+      if (tz <= tx)
+        z = (direction.z > 0.0f) ? (cellZ + 1) * size : cellZ * size - 1;
+      else
+        z = quadAt (2, t, cellZ * size, zLast);
+
+      if (x < 0 || z < 0 || x >= static_cast<int64_t> (xQuads)
+          || z >= static_cast<int64_t> (zQuads))
+        return false;
+
+      level = std::min (level + 1, top);
+    }
 }
 
-bool
-MapHandler::isAlreadyOptimized (std::string p_OriginalFilenameRequested)
+MapHandler::HeightPyramid
+MapHandler::buildHeightPyramid (const std::vector<uint8_t> &p_Heights,
+                                size_t p_Width, size_t p_Depth)
 {
-  std::string base = getBaseFilename (p_OriginalFilenameRequested);
-  std::cout << "Checking for base name : " << base << "\n";
+  const size_t xQuads = p_Width - 1;
+  const size_t zQuads = p_Depth - 1;
 
-  bool good = true;
-  for (size_t idx = 0; idx < 4; idx++)
+  HeightPyramid pyramid;
+  for (size_t level = 1; levelCells (level - 1, xQuads) > 1
+                         || levelCells (level - 1, zQuads) > 1;
+       level++)
     {
-      try
+      const size_t childX = levelCells (level - 1, xQuads);
+      const size_t childZ = levelCells (level - 1, zQuads);
+      const size_t xCells = levelCells (level, xQuads);
+      const size_t zCells = levelCells (level, zQuads);
+
+      std::vector<HeightBounds> bounds (xCells * zCells);
+      for (size_t z = 0; z < zCells; z++)
         {
-          auto vfile = base + std::to_string (idx) + "_v.bin";
-          auto ifile = base + std::to_string (idx) + "_i.bin";
-          if (!std::filesystem::exists (vfile))
-            {
-              std::cout << "Failed to find vertex file " + vfile + "\n";
-              good = false;
-            }
-          if (!std::filesystem::exists (ifile))
+          for (size_t x = 0; x < xCells; x++)
             {
-              std::cout << "Failed to find index file " + ifile + "\n";
-              good = false;
+              HeightBounds cell = { 255, 0 };
+              for (size_t cz = z * 2; cz < std::min (z * 2 + 2, childZ); cz++)
+                {
+                  for (size_t cx = x * 2; cx < std::min (x * 2 + 2, childX);
+                       cx++)
+                    {
+                      HeightBounds child
+                          = (level == 1)
+                                ? quadBounds (p_Heights.data (), p_Width,
+                                              cx, cz)
+                                : pyramid.back ()[cz * childX + cx];
+                      cell.min = std::min (cell.min, child.min);
+                      cell.max = std::max (cell.max, child.max);
+                    }
+                }
+              bounds[z * xCells + x] = cell;
             }
         }
-      catch (std::filesystem::filesystem_error &e)
-        {
-          throw std::runtime_error (
-              "Error occurred while checking for existing meshes "
-              + std::string (e.what ()));
-        }
+      pyramid.push_back (std::move (bounds));
     }
-
-  return good;
+  return pyramid;
 }
 
-std::string
-MapHandler::getBaseFilename (const std::string &p_Filename)
+size_t
+MapHandler::levelCells (size_t p_Level, size_t p_Quads)
 {
-  return p_Filename.substr (0, p_Filename.find ("."));
+  return ((p_Quads - 1) >> p_Level) + 1;
 }
 
-std::string
-MapHandler::filenameToBinV (const std::string &p_Filename)
+MapHandler::HeightBounds
+MapHandler::quadBounds (const uint8_t *p_Heights, size_t p_Width, size_t p_X,
+                        size_t p_Z)
 {
-  return p_Filename.substr (0, p_Filename.find (".")) + "_v.bin";
+  const uint8_t *cell = p_Heights + p_Z * p_Width + p_X;
+  auto [lo, hi] = std::minmax ({ cell[0], cell[1], cell[p_Width],
+                                 cell[p_Width + 1] });
+  return { lo, hi };
 }
 
-std::string
-MapHandler::filenameToBinI (const std::string &p_Filename)
+MapHandler::HeightBounds
+MapHandler::cellBounds (size_t p_Level, size_t p_X, size_t p_Z) const
 {
-  return p_Filename.substr (0, p_Filename.find (".")) + "_i.bin";
+  if (p_Level == 0)
+    return quadBounds (heightGrid.data (), gridWidth, p_X, p_Z);
+
+  size_t xCells = levelCells (p_Level, gridWidth - 1);
+  return heightPyramid[p_Level - 1][p_Z * xCells + p_X];
 }
 
-void
-MapHandler::writeVertexFile (std::string p_FilenameIndexAppended,
-                             std::vector<Vertex> &p_VertexContainer)
+bool
+MapHandler::intersectQuad (size_t p_X, size_t p_Z, const glm::vec3 &p_Origin,
+                           const glm::vec3 &p_Direction, float p_TMin,
+                           float &p_T, glm::vec3 &p_Normal) const
 {
-  std::ofstream file (filenameToBinV (p_FilenameIndexAppended),
-                      std::ios::trunc);
-  std::ostream_iterator<Vertex> vertexOutputIterator (file);
-
-  file << "v " << p_VertexContainer.size () << "\n";
-
-  std::copy (p_VertexContainer.begin (), p_VertexContainer.end (),
-             vertexOutputIterator);
-
-  file.close ();
-  return;
+  auto corner = [&] (size_t p_CornerX, size_t p_CornerZ) {
+    return glm::vec3 (
+        static_cast<float> (p_CornerX),
+        static_cast<float> (heightGrid[p_CornerZ * gridWidth + p_CornerX]),
+        static_cast<float> (p_CornerZ));
+  };
+  const glm::vec3 tl = corner (p_X, p_Z);
+  const glm::vec3 tr = corner (p_X + 1, p_Z);
+  const glm::vec3 bl = corner (p_X, p_Z + 1);
+  const glm::vec3 br = corner (p_X + 1, p_Z + 1);
+
+  // Moller-Trumbore; edges get a little slack so rays through the
+  // diagonal hit one of the halves
+  constexpr float edge = 1e-5f;
+  bool isHit = false;
+  auto triangle = [&] (const glm::vec3 &p_A, const glm::vec3 &p_B,
+                       const glm::vec3 &p_C) {
+    glm::vec3 e1 = p_B - p_A;
+    glm::vec3 e2 = p_C - p_A;
+    glm::vec3 pv = glm::cross (p_Direction, e2);
+    float det = glm::dot (e1, pv);
+    if (std::abs (det) < 1e-12f)
+      return;
+    float inverse = 1.0f / det;
+    glm::vec3 tv = p_Origin - p_A;
+    float u = glm::dot (tv, pv) * inverse;
+    if (u < -edge || u > 1.0f + edge)
+      return;
+    glm::vec3 qv = glm::cross (tv, e1);
+    float v = glm::dot (p_Direction, qv) * inverse;
+    if (v < -edge || u + v > 1.0f + edge)
+      return;
+    float t = glm::dot (e2, qv) * inverse;
+    if (t < p_TMin || t > p_T)
+      return;
+
+    p_T = t;
+    // facing up whichever way the triangle winds
+    p_Normal = glm::cross (e1, e2);
+    if (p_Normal.y < 0.0f)
+      p_Normal = -p_Normal;
+    isHit = true;
+  };
+
+  // same split as the mesh; tl -> bl -> br & br -> tr -> tl
+  triangle (tl, bl, br);
+  triangle (br, tr, tl);
+  return isHit;
 }
 
-void
-MapHandler::writeIndexFile (std::string p_FilenameIndexAppended,
-                            std::vector<uint32_t> &p_IndexContainer)
+bool
+MapHandler::isHeightfieldSupported (void) const
 {
-  std::ofstream file (filenameToBinI (p_FilenameIndexAppended),
-                      std::ios::trunc);
-  std::ostream_iterator<uint32_t> indexOutputIterator (file, "\n");
-
-  file << "i " << p_IndexContainer.size () << "\n";
-
-  std::copy (p_IndexContainer.begin (), p_IndexContainer.end (),
-             indexOutputIterator);
-
-  file.close ();
-  return;
+  return ptrEngine->pipelines.contains (PipelineTypes::eTerrainHeightfield);
 }
 
 void
-MapHandler::writeRaw (std::string p_FilenameIndexAppended,
-                      std::vector<Vertex> &p_VertexContainer,
-                      std::vector<uint32_t> &p_IndexContainer)
+MapHandler::allocate (PendingMap &p_Map, size_t p_VertexBytes,
+                      size_t p_IndexBytes)
 {
-  std::cout << "All output operations complete\n";
+  destroyBuffer (p_Map.stagingVertices);
+  destroyBuffer (p_Map.stagingIndices);
+
+  std::cout << "Creating staging buffers for map\n";
+  std::cout << "Vertex bytes : " << p_VertexBytes << "\n";
+  std::cout << "Index bytes : " << p_IndexBytes << "\n";
+
+  using enum vk::MemoryPropertyFlagBits;
+
+  // Contents are copied in by caller through mapped memory, then into
+  // device local buffers by submitCopy
+  auto create = [&] (MapBuffer &p_Buffer, size_t p_Bytes) {
+    if (p_Bytes == 0)
+      return;
+    p_Buffer.size = p_Bytes;
+    ptrEngine->createBuffer (vk::BufferUsageFlagBits::eTransferSrc,
+                             eHostCoherent | eHostVisible, p_Bytes,
+                             &p_Buffer.buffer, &p_Buffer.memory, nullptr);
+  };
+  create (p_Map.stagingVertices, p_VertexBytes);
+  create (p_Map.stagingIndices, p_IndexBytes);
   return;
 }
 
 void
-MapHandler::readVertexFile (std::string p_FinalName,
-                            std::vector<Vertex> &p_VertexContainer)
+MapHandler::uploadTiles (PendingMap &p_Map,
+                         const std::vector<Terrain::TileView> &p_Tiles)
 {
-  std::ifstream file (p_FinalName);
-  if (!file.is_open ())
-    throw std::runtime_error ("Failed to open pre optimized file");
-
-  // Read vertices count
-  std::string strVertexCount;
-
-  std::getline (file, strVertexCount);
-  size_t vColon = strVertexCount.find (' ');
-  if (vColon == std::string::npos)
-    throw std::runtime_error (
-        "Could not determine vertex count from map file");
-
-  vColon++;
-  size_t vertexCount = 0;
-  try
-    {
-      vertexCount = std::stol (strVertexCount.substr (vColon));
-    }
-  catch (std::invalid_argument &e)
+  // Lay tiles out back to back
+  std::vector<size_t> vertexBases (p_Tiles.size ());
+  std::vector<size_t> indexBases (p_Tiles.size ());
+  std::vector<size_t> renderChunkBases (p_Tiles.size ());
+
+  size_t totalVertices = 0;
+  size_t totalIndices = 0;
+  size_t totalRenderChunks = 0;
+  for (size_t idx = 0; idx < p_Tiles.size (); idx++)
     {
-      throw std::runtime_error (
-          "Invalid vertex count in map file, received => "
-          + std::string (e.what ()));
+      vertexBases.at (idx) = totalVertices;
+      indexBases.at (idx) = totalIndices;
+      renderChunkBases.at (idx) = totalRenderChunks;
+      totalVertices += p_Tiles.at (idx).vertexCount;
+      totalIndices += p_Tiles.at (idx).indexCount;
+      totalRenderChunks += p_Tiles.at (idx).renderChunkCount;
     }
-  if (!vertexCount)
-    throw std::runtime_error ("Invalid vertex count in map file, = 0");
 
-  p_VertexContainer.reserve (vertexCount);
-
-  std::vector<Vertex>::iterator iterator = p_VertexContainer.begin ();
-  std::insert_iterator<std::vector<Vertex>> vertexInserter (p_VertexContainer,
-                                                            iterator);
-
-  std::copy (std::istream_iterator<Vertex> (file),
-             std::istream_iterator<Vertex> (), vertexInserter);
+  // drawIndexed takes a signed vertex offset
+  if (totalVertices
+          > static_cast<size_t> (std::numeric_limits<int32_t>::max ())
+      || totalIndices > std::numeric_limits<uint32_t>::max ())
+    throw std::runtime_error ("Terrain exceeds 32 bit index range");
+
+  // Indices are local to a vertex block; 16 bit whenever every block fits
+  bool isNarrow = true;
+  for (const auto &tile : p_Tiles)
+    for (size_t c = 0; c < tile.renderChunkCount; c++)
+      if (tile.renderChunks[c].vertexCount > Terrain::VERTEX_BLOCK_SIZE)
+        isNarrow = false;
+  const size_t indexSize = isNarrow ? sizeof (uint16_t) : sizeof (uint32_t);
+
+  allocate (p_Map, totalVertices * sizeof (Vertex), totalIndices * indexSize);
+  p_Map.renderChunks.resize (totalRenderChunks);
+
+  auto &device = ptrEngine->logicalDevice;
+  auto *vertexMapped = static_cast<std::byte *> (
+      device.mapMemory (p_Map.stagingVertices.memory, 0,
+                        totalVertices * sizeof (Vertex)));
+  auto *indexMapped = static_cast<std::byte *> (device.mapMemory (
+      p_Map.stagingIndices.memory, 0, totalIndices * indexSize));
+
+  loadStage = "Staging";
+  const float tileProgress
+      = std::max (0.95f - loadProgress, 0.0f)
+        / static_cast<float> (std::max<size_t> (p_Tiles.size (), 1));
+  try
+    {
+      ptrEngine->workers.parallelFor (p_Tiles.size (), [&] (size_t idx) {
+        const auto &tile = p_Tiles.at (idx);
 
-  // std::copy(std::istream_iterator<Vertex>(file),
-  //           std::istream_iterator<Vertex>(),
-  //           std::back_inserter(p_VertexContainer));
+        std::memcpy (vertexMapped + (vertexBases.at (idx) * sizeof (Vertex)),
+                     tile.vertices, tile.vertexCount * sizeof (Vertex));
 
-  file.close ();
-  return;
-}
+        // block local indices need no rebasing; draws add the block's
+        // first vertex as vertex offset
+        std::byte *indexDestination
+            = indexMapped + indexBases.at (idx) * indexSize;
+        if (isNarrow)
+          {
+            auto *narrow = reinterpret_cast<uint16_t *> (indexDestination);
+            for (size_t i = 0; i < tile.indexCount; i++)
+              narrow[i] = static_cast<uint16_t> (tile.indices[i]);
+          }
+        else
+          {
+            std::memcpy (indexDestination, tile.indices,
+                         tile.indexCount * sizeof (uint32_t));
+          }
 
-void
-MapHandler::readIndexFile (std::string p_FinalFilename,
-                           std::vector<uint32_t> &p_IndexContainer)
-{
-  std::ifstream file (p_FinalFilename);
-  if (!file.is_open ())
-    throw std::runtime_error ("Failed to open pre optimized file");
-
-  std::string strIndexCount;
-  std::getline (file, strIndexCount);
-  size_t iColon = strIndexCount.find (' ');
-  if (iColon == std::string::npos)
-    throw std::runtime_error ("Could not determine index count");
-
-  iColon++;
-  size_t indexCount = 0;
-  try
-    {
-      indexCount = std::stol (strIndexCount.substr (iColon));
+        uint32_t indexBase = static_cast<uint32_t> (indexBases.at (idx));
+        for (size_t c = 0; c < tile.renderChunkCount; c++)
+          {
+            const auto &source = tile.renderChunks[c];
+            auto &chunk
+                = p_Map.renderChunks.at (renderChunkBases.at (idx) + c);
+            for (uint32_t level = 0; level < LOD_LEVELS; level++)
+              {
+                chunk.firstIndex[level] = source.firstIndex[level] + indexBase;
+                chunk.indexCount[level] = source.indexCount[level];
+                chunk.error[level] = source.error[level];
+              }
+            chunk.boundsMin = glm::make_vec3 (source.boundsMin);
+            chunk.boundsMax = glm::make_vec3 (source.boundsMax);
+            chunk.vertexOffset = static_cast<int32_t> (vertexBases.at (idx)
+                                                       + source.firstVertex);
+          }
+        loadProgress.fetch_add (tileProgress);
+      });
     }
-  catch (std::invalid_argument &e)
+  catch (...)
     {
-      throw std::runtime_error ("Invalid index count in map file, received => "
-                                + std::string (e.what ()));
+      device.unmapMemory (p_Map.stagingVertices.memory);
+      device.unmapMemory (p_Map.stagingIndices.memory);
+      throw;
     }
-  if (!indexCount)
-    throw std::runtime_error ("Invalid index count in map file, = 0");
-
-  p_IndexContainer.reserve (indexCount);
-
-  std::vector<uint32_t>::iterator iterator = p_IndexContainer.begin ();
-  std::insert_iterator<std::vector<uint32_t>> indexInserter (p_IndexContainer,
-                                                             iterator);
 
-  std::copy (std::istream_iterator<uint32_t> (file),
-             std::istream_iterator<uint32_t> (), indexInserter);
+  device.unmapMemory (p_Map.stagingVertices.memory);
+  device.unmapMemory (p_Map.stagingIndices.memory);
 
-  // std::copy(std::istream_iterator<uint32_t>(file),
-  //           std::istream_iterator<uint32_t>(),
-  //           std::back_inserter(p_IndexContainer));
-
-  file.close ();
+  p_Map.vertexCount = totalVertices;
+  p_Map.indexCount = totalIndices;
+  p_Map.indexType
+      = isNarrow ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+  std::cout << "Terrain indices => " << (isNarrow ? 16 : 32) << " bit, "
+            << (totalIndices * indexSize) / (1024 * 1024) << " MB\n";
   return;
 }
 
 void
-MapHandler::allocate (std::vector<Vertex> &p_VertexContainer,
-                      std::vector<uint32_t> &p_IndexContainer)
+MapHandler::loadHeightfield (PendingMap &p_Map)
 {
-  {
-    // If a map is already loaded, release preallocated vulkan memory
-    if (isMapLoaded)
+  auto start = std::chrono::steady_clock::now ();
+  loadStage = "Building chunks";
+
+  const auto &heights = p_Map.heights;
+  const size_t xLength = p_Map.xLength;
+  const size_t zLength = p_Map.zLength;
+
+  // Shared by every chunk; 16 bit as patch ids stay below 2 * 65 * 65
+  auto indices = generatePatchIndices (p_Map.patchLevels);
+
+  allocate (p_Map, 0, indices.size () * sizeof (uint16_t));
+  auto &device = ptrEngine->logicalDevice;
+  void *mapped = device.mapMemory (p_Map.stagingIndices.memory, 0,
+                                   p_Map.stagingIndices.size);
+  std::memcpy (mapped, indices.data (), p_Map.stagingIndices.size);
+  device.unmapMemory (p_Map.stagingIndices.memory);
+  p_Map.indexType = vk::IndexType::eUint16;
+
+  // Bounds & level errors still come from the CPU copy of the heights
+  const auto chunksOn = [] (size_t p_Length) {
+    return (p_Length - 1 + RENDER_CHUNK_QUADS - 1) / RENDER_CHUNK_QUADS;
+  };
+  const size_t xChunks = chunksOn (xLength);
+  const size_t zChunks = chunksOn (zLength);
+  p_Map.renderChunks.assign (xChunks * zChunks, RenderChunk{});
+
+  ptrEngine->workers.parallelFor (zChunks, [&] (size_t cz) {
+    for (size_t cx = 0; cx < xChunks; cx++)
       {
-        ptrEngine->logicalDevice.waitIdle ();
-        std::cout << "Map already loaded so cleaning up\n";
-        if (vertexBuffer)
-          {
-            ptrEngine->logicalDevice.destroyBuffer (*vertexBuffer);
-            vertexBuffer.reset ();
-          }
-        if (vertexMemory)
-          {
-            ptrEngine->logicalDevice.freeMemory (*vertexMemory);
-            vertexMemory.reset ();
-          }
-        if (indexBuffer)
+        const size_t x0 = cx * RENDER_CHUNK_QUADS;
+        const size_t z0 = cz * RENDER_CHUNK_QUADS;
+        Terrain::ChunkRegion region = {
+          x0,
+          z0,
+          std::min (RENDER_CHUNK_QUADS, xLength - 1 - x0),
+          std::min (RENDER_CHUNK_QUADS, zLength - 1 - z0),
+        };
+
+        uint8_t lowest = std::numeric_limits<uint8_t>::max ();
+        uint8_t highest = 0;
+        for (size_t z = 0; z <= region.zQuads; z++)
           {
-            ptrEngine->logicalDevice.destroyBuffer (*indexBuffer);
-            indexBuffer.reset ();
+            const uint8_t *row = heights.data ()
+                                 + (region.z0 + z) * xLength + region.x0;
+            auto [lo, hi] = std::minmax_element (row, row + region.xQuads + 1);
+            lowest = std::min (lowest, *lo);
+            highest = std::max (highest, *hi);
           }
-        if (indexMemory)
+
+        float errors[LOD_LEVELS];
+        Terrain::levelErrors (heights, xLength, region, errors);
+
+        auto &chunk = p_Map.renderChunks[cz * xChunks + cx];
+        for (uint32_t level = 0; level < LOD_LEVELS; level++)
           {
-            ptrEngine->logicalDevice.freeMemory (*indexMemory);
-            indexMemory.reset ();
+            chunk.firstIndex[level] = p_Map.patchLevels[level].first;
+            chunk.indexCount[level] = p_Map.patchLevels[level].second;
+            chunk.error[level] = errors[level];
           }
+
+        // same skirt depth the mesh path bakes; y is negated height
+        chunk.skirtDepth = static_cast<float> (highest - lowest) + 1.0f;
+        chunk.origin = glm::ivec2 (region.x0, region.z0);
+        chunk.quads = glm::ivec2 (region.xQuads, region.zQuads);
+        chunk.boundsMin = glm::vec3 (region.x0, -static_cast<float> (highest),
+                                     region.z0);
+        chunk.boundsMax
+            = glm::vec3 (region.x0 + region.xQuads,
+                         -static_cast<float> (lowest) + chunk.skirtDepth,
+                         region.z0 + region.zQuads);
       }
+  });
 
-    // ensure vk objects allocated
-    if (!vertexBuffer)
-      vertexBuffer = std::make_unique<vk::Buffer> ();
-    if (!vertexMemory)
-      vertexMemory = std::make_unique<vk::DeviceMemory> ();
-    if (!indexBuffer)
-      indexBuffer = std::make_unique<vk::Buffer> ();
-    if (!indexMemory)
-      indexMemory = std::make_unique<vk::DeviceMemory> ();
-  }
-
-  {
-    std::cout << "Creating buffers for map mesh\n";
-    std::cout << "Vertices count : " << p_VertexContainer.size () << "\n";
-    std::cout << "Indices count : " << p_IndexContainer.size () << "\n";
-    // Create vulkan resources for our map
-    using enum vk::MemoryPropertyFlagBits;
-
-    // Create vertex buffer
-    ptrEngine->createBuffer (
-        vk::BufferUsageFlagBits::eVertexBuffer, eHostCoherent | eHostVisible,
-        p_VertexContainer.size () * sizeof (Vertex), vertexBuffer.get (),
-        vertexMemory.get (), p_VertexContainer.data ());
-
-    // Create index buffer
-    ptrEngine->createBuffer (
-        vk::BufferUsageFlagBits::eIndexBuffer, eHostCoherent | eHostVisible,
-        p_IndexContainer.size () * sizeof (uint32_t), indexBuffer.get (),
-        indexMemory.get (), p_IndexContainer.data ());
-  }
+  p_Map.vertexCount = 0;
+  p_Map.indexCount = indices.size ();
+
+  std::chrono::duration<double, std::milli> elapsed
+      = std::chrono::steady_clock::now () - start;
+  std::cout << "Built " << xLength << "x" << zLength << " heightfield as "
+            << p_Map.renderChunks.size () << " chunks in "
+            << elapsed.count () << " ms\n";
   return;
 }
 
-std::vector<Vertex>
-MapHandler::generateMesh (size_t p_XLength, size_t p_ZLength,
-                          std::vector<Vertex> &p_HeightValues)
+void
+MapHandler::loadCache (PendingMap &p_Map, const std::string &p_BaseFilename,
+                       size_t p_ChunkCount)
 {
-  std::vector<Vertex> vertices;
+  auto start = std::chrono::steady_clock::now ();
+  loadStage = "Reading cache";
+  const float tileProgress = 0.5f / static_cast<float> (p_ChunkCount);
+
+  // Map & validate every tile in parallel; mappings stay alive until the
+  // copy into vulkan memory is done
+  std::vector<Cache::TerrainChunk> tiles (p_ChunkCount);
+  ptrEngine->workers.parallelFor (p_ChunkCount, [&] (size_t idx) {
+    auto name = Cache::terrainChunkFilename (p_BaseFilename, idx);
+    Cache::readTerrainChunk (name, sizeof (Vertex), tiles.at (idx));
+
+    if (tiles.at (idx).header->chunkIndex != idx
+        || tiles.at (idx).header->chunkCount != p_ChunkCount)
+      throw std::runtime_error ("Terrain cache chunk out of sequence => "
+                                + name);
+    loadProgress.fetch_add (tileProgress);
+  });
+
+  std::vector<Terrain::TileView> views;
+  views.reserve (tiles.size ());
+  for (const auto &tile : tiles)
+    {
+      views.push_back ({
+          tile.vertices,
+          tile.header->vertexCount,
+          tile.indices,
+          tile.header->indexCount,
+          tile.renderChunks,
+          tile.header->renderChunkCount,
+      });
+    }
+
+  uploadTiles (p_Map, views);
+
+  std::chrono::duration<double, std::milli> elapsed
+      = std::chrono::steady_clock::now () - start;
+  std::cout << "Loaded " << p_ChunkCount << " terrain cache chunks in "
+            << elapsed.count () << " ms\n";
+  return;
+}
 
-  // Generates terribly bloated & inefficient mesh data
-  // Iterate image height
-  for (size_t j = 0; j < (p_ZLength - 1); j++)
+std::vector<uint16_t>
+MapHandler::generatePatchIndices (
+    std::array<std::pair<uint32_t, uint32_t>, LOD_LEVELS> &p_Levels)
+{
+  // One full size chunk per level; vsTerrain rebuilds positions from the
+  // index & clamps partial chunks. Skirt ids follow the patch vertices
+  std::vector<uint16_t> indices;
+  for (uint32_t level = 0; level < LOD_LEVELS; level++)
     {
-      // Iterate image width
-      for (size_t i = 0; i < (p_XLength - 1); i++)
-        {
-          const size_t topLeftIndex = (p_ZLength * j) + i;
-          const size_t topRightIndex = (p_ZLength * j) + (i + 1);
-          const size_t bottomLeftIndex = (p_ZLength * (j + 1)) + i;
-          const size_t bottomRightIndex = (p_ZLength * (j + 1)) + (i + 1);
-
-          Vertex topLeft = p_HeightValues.at (topLeftIndex);
-          Vertex topRight = p_HeightValues.at (topRightIndex);
-          Vertex bottomLeft = p_HeightValues.at (bottomLeftIndex);
-          Vertex bottomRight = p_HeightValues.at (bottomRightIndex);
-
-          vertices.push_back (topLeft);
-          vertices.push_back (bottomLeft);
-          vertices.push_back (bottomRight);
-
-          vertices.push_back (bottomRight);
-          vertices.push_back (topRight);
-          vertices.push_back (topLeft);
-        }
+      const size_t step = size_t{ 1 } << level;
+      const size_t side = (RENDER_CHUNK_QUADS >> level) + 1;
+      auto surface = [&] (size_t p_X, size_t p_Z) {
+        return static_cast<uint16_t> ((p_Z / step) * side + (p_X / step));
+      };
+
+      p_Levels[level].first = static_cast<uint32_t> (indices.size ());
+      emitLevel (indices, step, RENDER_CHUNK_QUADS, RENDER_CHUNK_QUADS,
+                 surface, [&] (size_t p_X, size_t p_Z) {
+                   return static_cast<uint16_t> (side * side
+                                                 + surface (p_X, p_Z));
+                 });
+      p_Levels[level].second = static_cast<uint32_t> (
+          indices.size () - p_Levels[level].first);
+
+      // Positions come from the index so only the triangle order can
+      // change
+      std::vector<uint32_t> ordered (indices.begin () + p_Levels[level].first,
+                                     indices.end ());
+      MeshOpt::optimizeVertexCache (ordered.data (), ordered.size (),
+                                    side * side * 2);
+      std::copy (ordered.begin (), ordered.end (),
+                 indices.begin () + p_Levels[level].first);
     }
-  return vertices;
+  return indices;
 }
 
 void
-MapHandler::cleanEdge (std::vector<Vertex *> &p_Edge, bool isHorizontal)
+MapHandler::cull (const Camera &p_Camera, float p_ViewportHeight)
 {
-  std::vector<Vertex *> optimized;
-  if (isHorizontal)
+  visibleDraws.clear ();
+  visibleChunkCount = 0;
+  culledChunkCount = 0;
+
+  const auto frustumPlanes = p_Camera.getFrustumPlanes ();
+  const glm::vec3 eye = p_Camera.getEyePosition ();
+
+  // A height error e at distance d covers e * projection / d pixels
+  // Level l is usable from d >= error[l] * switchScale
+  const float projection
+      = p_ViewportHeight
+        / (2.0f * std::tan (glm::radians (p_Camera.getFov ()) * 0.5f));
+  const float switchScale = projection / std::max (lodErrorThreshold, 0.01f);
+
+  for (size_t c = 0; c < renderChunks.size (); c++)
     {
-      // prune x axis
-      for (auto &vptr : p_Edge)
+      const auto &chunk = renderChunks[c];
+
+      // AABB is outside if its corner furthest along a plane normal is
+      // still behind that plane
+      bool inside = true;
+      for (const auto &plane : frustumPlanes)
         {
-          bool unique = true;
-          // search for x:z val
-          if (!optimized.empty ())
-            {
-              // iterate optimized and look for dup
-              for (const auto &o : optimized)
-                {
-                  if (o->position == vptr->position)
-                    {
-                      unique = false;
-                    }
-                }
-            }
-          if (unique) // add to optimized
+          glm::vec3 furthest = {
+            plane.x >= 0.0f ? chunk.boundsMax.x : chunk.boundsMin.x,
+            plane.y >= 0.0f ? chunk.boundsMax.y : chunk.boundsMin.y,
+            plane.z >= 0.0f ? chunk.boundsMax.z : chunk.boundsMin.z,
+          };
+          if (glm::dot (glm::vec3 (plane), furthest) + plane.w < 0.0f)
             {
-              optimized.push_back (vptr);
+              inside = false;
+              break;
             }
         }
-    }
-  else
-    {
-      // prune z axis
-      for (auto &vptr : p_Edge)
+
+      if (!inside)
         {
-          bool unique = true;
-          // search for x:z val
-          if (!optimized.empty ())
-            {
-              // iterate optimized and look for dup
-              for (const auto &o : optimized)
-                {
-                  if (o->position == vptr->position)
-                    {
-                      unique = false;
-                    }
-                }
-            }
-          if (unique) // add to optimized
-            {
-              optimized.push_back (vptr);
-            }
+          culledChunkCount++;
+          continue;
         }
-    }
-  p_Edge.clear ();
-  p_Edge = optimized;
-  return;
-}
 
-// must be same size
-// stitches edges together with param 1 being origin
-void
-MapHandler::stitchEdge (std::vector<Vertex *> &p_FirstEdge,
-                        std::vector<Vertex *> &p_SecondEdge,
-                        std::vector<Vertex> &p_Vertices, bool p_IsVertical)
-{
-  // sanity check
-  if (p_FirstEdge.size () != p_SecondEdge.size ())
-    throw std::runtime_error ("Cannot stich edges of uneven lengths");
+      visibleChunkCount++;
 
-  if (p_IsVertical)
-    {
-      for (size_t i = 0; i < (p_FirstEdge.size () - 1); i++)
+      float distance = glm::length (
+          eye - glm::clamp (eye, chunk.boundsMin, chunk.boundsMax));
+
+      // coarsest level whose error stays under the threshold
+      uint32_t level = 0;
+      while (level + 1 < LOD_LEVELS
+             && chunk.error[level + 1] * switchScale <= distance)
+        level++;
+
+      // morph over the second half of the level's distance band so the
+      // switch to the next level is seamless
+      float morph = 0.0f;
+      if (level + 1 < LOD_LEVELS)
         {
-          // grab verts for quad
-          auto tl = p_FirstEdge.at (i);
-          auto bl = p_FirstEdge.at (i + 1);
-          auto br = p_SecondEdge.at (i + 1);
-          auto tr = p_SecondEdge.at (i);
-
-          tl->color = { 1.0f, 0.0f, 0.0f, 1.0f };
-          bl->color = { 0.0f, 1.0f, 0.0f, 1.0f };
-          br->color = { 0.0f, 1.0f, 1.0f, 1.0f };
-          tr->color = { 0.0f, 1.0f, 1.0f, 1.0f };
-
-          // push counter clockwise
-          p_Vertices.push_back (*tl);
-          p_Vertices.push_back (*bl);
-          p_Vertices.push_back (*br);
-
-          p_Vertices.push_back (*br);
-          p_Vertices.push_back (*tr);
-          p_Vertices.push_back (*tl);
+          float start = chunk.error[level] * switchScale;
+          float end = chunk.error[level + 1] * switchScale;
+          float middle = (start + end) * 0.5f;
+          morph = std::clamp ((distance - middle) / (end - middle), 0.0f,
+                              1.0f);
         }
-    }
-  else
-    {
-      for (size_t i = 0; i < (p_FirstEdge.size () - 1); i++)
+
+      ChunkDraw draw;
+      draw.chunk = static_cast<uint32_t> (c);
+      draw.firstIndex = chunk.firstIndex[level];
+      draw.indexCount = chunk.indexCount[level];
+      draw.vertexOffset = chunk.vertexOffset;
+      draw.lod.level = static_cast<int32_t> (level);
+      draw.lod.morph = morph;
+
+      // same level chunks are laid out in index order; extend previous
+      // draw if contiguous, in the same vertex block & morphing
+      // identically. Heightfield chunks all share one patch so each needs
+      // its own draw
+      if (terrainMode == TerrainMode::eMesh && !visibleDraws.empty ())
         {
-          // grab verts for quad
-          auto tl = p_FirstEdge.at (i);
-          auto bl = p_SecondEdge.at (i);
-          auto br = p_SecondEdge.at (i + 1);
-          auto tr = p_FirstEdge.at (i + 1);
-
-          // push counter clockwise
-          p_Vertices.push_back (*tl);
-          p_Vertices.push_back (*bl);
-          p_Vertices.push_back (*br);
-
-          p_Vertices.push_back (*br);
-          p_Vertices.push_back (*tr);
-          p_Vertices.push_back (*tl);
+          auto &previous = visibleDraws.back ();
+          if (previous.firstIndex + previous.indexCount == draw.firstIndex
+              && previous.vertexOffset == draw.vertexOffset
+              && previous.lod.level == draw.lod.level
+              && previous.lod.morph == draw.lod.morph)
+            {
+              previous.indexCount += draw.indexCount;
+              continue;
+            }
         }
+      visibleDraws.push_back (draw);
     }
   return;
 }
 
 void
-MapHandler::stitchCorner (Vertex *p_FirstCorner, Vertex *p_FirstEdgeVertex,
-                          Vertex *p_SecondCorner, Vertex *p_SecondEdgeVertex,
-                          std::vector<Vertex> &p_Vertices,
-                          WindingStyle p_Style)
+MapHandler::draw (vk::CommandBuffer &p_CommandBuffer,
+                  const vk::PipelineLayout &p_PipelineLayout)
 {
-  using enum WindingStyle;
-  if (p_Style == eFirstCornerToFirstEdge)
-    {
-      auto tl = p_FirstCorner;
-      auto bl = p_FirstEdgeVertex;
-      auto br = p_SecondEdgeVertex;
-      auto tr = p_SecondCorner;
-
-      p_Vertices.push_back (*tl);
-      p_Vertices.push_back (*bl);
-      p_Vertices.push_back (*br);
-
-      p_Vertices.push_back (*br);
-      p_Vertices.push_back (*tr);
-      p_Vertices.push_back (*tl);
-    }
-  else if (p_Style == eFirstCornerToSecondCorner)
-    {
-      auto tl = p_FirstCorner;
-      auto bl = p_SecondCorner;
-      auto br = p_SecondEdgeVertex;
-      auto tr = p_FirstEdgeVertex;
-
-      p_Vertices.push_back (*tl);
-      p_Vertices.push_back (*bl);
-      p_Vertices.push_back (*br);
-
-      p_Vertices.push_back (*br);
-      p_Vertices.push_back (*tr);
-      p_Vertices.push_back (*tl);
-    }
-  else if (p_Style == eFirstEdgeToFirstCorner)
-    {
-      auto tl = p_FirstEdgeVertex;
-      auto bl = p_FirstCorner;
-      auto br = p_SecondCorner;
-      auto tr = p_SecondEdgeVertex;
-
-      p_Vertices.push_back (*tl);
-      p_Vertices.push_back (*bl);
-      p_Vertices.push_back (*br);
-
-      p_Vertices.push_back (*br);
-      p_Vertices.push_back (*tr);
-      p_Vertices.push_back (*tl);
-    }
-  else if (p_Style == eFirstEdgeToSecondEdge)
+  if (terrainMode == TerrainMode::eHeightfield)
     {
-      auto tl = p_FirstEdgeVertex;
-      auto bl = p_SecondEdgeVertex;
-      auto br = p_SecondCorner;
-      auto tr = p_FirstCorner;
-
-      p_Vertices.push_back (*tl);
-      p_Vertices.push_back (*bl);
-      p_Vertices.push_back (*br);
-
-      p_Vertices.push_back (*br);
-      p_Vertices.push_back (*tr);
-      p_Vertices.push_back (*tl);
+      for (const auto &draw : visibleDraws)
+        {
+          const auto &chunk = renderChunks[draw.chunk];
+
+          HeightfieldPushConstant patch;
+          patch.level = draw.lod.level;
+          patch.morph = draw.lod.morph;
+          patch.origin = chunk.origin;
+          patch.quads = chunk.quads;
+          patch.skirtDepth = chunk.skirtDepth;
+
+          p_CommandBuffer.pushConstants (
+              p_PipelineLayout, vk::ShaderStageFlagBits::eVertex, 0,
+              sizeof (HeightfieldPushConstant), &patch);
+          p_CommandBuffer.drawIndexed (draw.indexCount, 1, draw.firstIndex,
+                                       0, 0);
+        }
+      return;
     }
-  else if (p_Style == eCenter)
+
+  const LodPushConstant *pushed = nullptr;
+  for (const auto &draw : visibleDraws)
     {
-      // param
-      // 1
-      // 3
-      // 4
-      // 2
-      auto tl = p_FirstCorner;
-      auto bl = p_SecondCorner;
-      auto br = p_SecondEdgeVertex;
-      auto tr = p_FirstEdgeVertex;
-
-      p_Vertices.push_back (*tl);
-      p_Vertices.push_back (*bl);
-      p_Vertices.push_back (*br);
-
-      p_Vertices.push_back (*br);
-      p_Vertices.push_back (*tr);
-      p_Vertices.push_back (*tl);
+      if (!pushed || pushed->level != draw.lod.level
+          || pushed->morph != draw.lod.morph)
+        {
+          p_CommandBuffer.pushConstants (
+              p_PipelineLayout, vk::ShaderStageFlagBits::eVertex, 0,
+              sizeof (LodPushConstant), &draw.lod);
+          pushed = &draw.lod;
+        }
+      p_CommandBuffer.drawIndexed (draw.indexCount, 1, draw.firstIndex,
+                                   draw.vertexOffset, 0);
     }
   return;
 }
-
-// void
-// MapHandler::stitchCorner (Vertex *p_TLCorner, Vertex *p_TRCorner,
-//                           Vertex *p_BRCorner, Vertex *p_BLCorner,
-//                           std::vector<Vertex> &p_Vertices)
-// {
-//   return;
-// }
\ No newline at end of file
@@ -0,0 +1,223 @@
+#include "mvMeshOpt.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace MeshOpt
+{
+  namespace
+  {
+    // LRU cache the scores model; larger than any FIFO reported on so the
+    // order stays good across hardware
+    constexpr size_t CACHE_SIZE = 32;
+    constexpr float CACHE_DECAY_POWER = 1.5f;
+    constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+    constexpr float VALENCE_BOOST_SCALE = 2.0f;
+    constexpr float VALENCE_BOOST_POWER = 0.5f;
+    constexpr size_t VALENCE_TABLE_SIZE = 32;
+
+    struct ScoreTables
+    {
+      std::array<float, CACHE_SIZE> cache = {};
+      std::array<float, VALENCE_TABLE_SIZE> valence = {};
+
+      ScoreTables (void)
+      {
+        // vertices of the last triangle score a flat value so the next
+        // triangle does not simply reuse its edge
+        for (size_t p = 0; p < CACHE_SIZE; p++)
+          cache[p] = (p < 3) ? LAST_TRIANGLE_SCORE
+                             : std::pow (1.0f
+                                             - static_cast<float> (p - 3)
+                                                   / (CACHE_SIZE - 3),
+                                         CACHE_DECAY_POWER);
+        for (size_t v = 1; v < VALENCE_TABLE_SIZE; v++)
+          valence[v] = VALENCE_BOOST_SCALE
+                       * std::pow (static_cast<float> (v),
+                                   -VALENCE_BOOST_POWER);
+      }
+    };
+
+    // Higher is emitted sooner; vertices with few triangles left are
+    // boosted so they get finished & leave the cache
+    float
+    vertexScore (const ScoreTables &p_Tables, int32_t p_CachePosition,
+                 uint32_t p_LiveTriangles)
+    {
+      if (p_LiveTriangles == 0)
+        return -1.0f;
+
+      float score = (p_CachePosition < 0) ? 0.0f
+                                          : p_Tables.cache[p_CachePosition];
+      if (p_LiveTriangles < VALENCE_TABLE_SIZE)
+        return score + p_Tables.valence[p_LiveTriangles];
+      return score
+             + VALENCE_BOOST_SCALE
+                   * std::pow (static_cast<float> (p_LiveTriangles),
+                               -VALENCE_BOOST_POWER);
+    }
+  }; // namespace
+
+  void
+  optimizeVertexCache (uint32_t *p_Indices, size_t p_IndexCount,
+                       size_t p_VertexCount)
+  {
+    const size_t triangleCount = p_IndexCount / 3;
+    if (triangleCount < 2)
+      return;
+
+    static const ScoreTables tables;
+
+    // Triangles of every vertex; the first live[v] entries of a vertex's
+    // range are the ones not yet emitted
+    std::vector<uint32_t> live (p_VertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+      live[p_Indices[i]]++;
+
+    std::vector<uint32_t> offsets (p_VertexCount + 1, 0);
+    for (size_t v = 0; v < p_VertexCount; v++)
+      offsets[v + 1] = offsets[v] + live[v];
+
+    std::vector<uint32_t> adjacency (triangleCount * 3);
+    {
+      std::vector<uint32_t> fill (offsets.begin (), offsets.end () - 1);
+      for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacency[fill[p_Indices[i]]++] = static_cast<uint32_t> (i / 3);
+    }
+
+    std::vector<int32_t> cachePosition (p_VertexCount, -1);
+    std::vector<float> score (p_VertexCount);
+    for (size_t v = 0; v < p_VertexCount; v++)
+      score[v] = vertexScore (tables, -1, live[v]);
+
+    std::vector<float> triangleScore (triangleCount);
+    std::vector<uint8_t> isEmitted (triangleCount, 0);
+    size_t best = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+      {
+        const uint32_t *triangle = p_Indices + t * 3;
+        triangleScore[t] = score[triangle[0]] + score[triangle[1]]
+                           + score[triangle[2]];
+        if (triangleScore[t] > triangleScore[best])
+          best = t;
+      }
+
+    std::vector<uint32_t> ordered;
+    ordered.reserve (triangleCount * 3);
+
+    // room for the emitted triangle's vertices pushing others out
+    std::array<uint32_t, CACHE_SIZE + 3> cache;
+    std::array<uint32_t, CACHE_SIZE + 3> next;
+    size_t cacheCount = 0;
+
+    // triangles before this have all been emitted; fallback when no
+    // cached vertex has triangles left
+    size_t cursor = 0;
+    while (true)
+      {
+        const uint32_t *triangle = p_Indices + best * 3;
+        ordered.insert (ordered.end (), triangle, triangle + 3);
+        isEmitted[best] = 1;
+
+        // drop the triangle from its vertices' live ranges
+        for (int corner = 0; corner < 3; corner++)
+          {
+            uint32_t v = triangle[corner];
+            uint32_t *first = adjacency.data () + offsets[v];
+            uint32_t *last = first + live[v] - 1;
+            *std::find (first, last, static_cast<uint32_t> (best))
+                = *last;
+            live[v]--;
+          }
+
+        // most recent first
+        size_t nextCount = 0;
+        for (int corner = 0; corner < 3; corner++)
+          if (std::find (next.begin (), next.begin () + nextCount,
+                         triangle[corner])
+              == next.begin () + nextCount)
+            next[nextCount++] = triangle[corner];
+        for (size_t c = 0; c < cacheCount; c++)
+          if (cache[c] != triangle[0] && cache[c] != triangle[1]
+              && cache[c] != triangle[2])
+            next[nextCount++] = cache[c];
+
+        for (size_t c = 0; c < nextCount; c++)
+          {
+            uint32_t v = next[c];
+            cachePosition[v]
+                = (c < CACHE_SIZE) ? static_cast<int32_t> (c) : -1;
+            score[v] = vertexScore (tables, cachePosition[v], live[v]);
+          }
+
+        // only triangles touching a vertex that moved changed score
+        float bestScore = -1.0f;
+        bool isFound = false;
+        for (size_t c = 0; c < nextCount; c++)
+          {
+            uint32_t v = next[c];
+            for (uint32_t a = 0; a < live[v]; a++)
+              {
+                uint32_t t = adjacency[offsets[v] + a];
+                const uint32_t *candidate = p_Indices + t * 3;
+                triangleScore[t] = score[candidate[0]] + score[candidate[1]]
+                                   + score[candidate[2]];
+                if (triangleScore[t] > bestScore)
+                  {
+                    bestScore = triangleScore[t];
+                    best = t;
+                    isFound = true;
+                  }
+              }
+          }
+
+        cacheCount = std::min (nextCount, CACHE_SIZE);
+        std::copy (next.begin (), next.begin () + cacheCount, cache.begin ());
+
+        if (!isFound)
+          {
+            while (cursor < triangleCount && isEmitted[cursor])
+              cursor++;
+            if (cursor == triangleCount)
+              break;
+            best = cursor;
+          }
+      }
+
+    std::copy (ordered.begin (), ordered.end (), p_Indices);
+    return;
+  }
+
+  std::vector<uint32_t>
+  optimizeVertexFetch (uint32_t *p_Indices, size_t p_IndexCount,
+                       size_t p_VertexCount)
+  {
+    std::vector<uint32_t> remap (p_VertexCount, UNUSED);
+    uint32_t used = 0;
+    for (size_t i = 0; i < p_IndexCount; i++)
+      {
+        uint32_t &slot = remap[p_Indices[i]];
+        if (slot == UNUSED)
+          slot = used++;
+        p_Indices[i] = slot;
+      }
+    return remap;
+  }
+
+  size_t
+  cacheMisses (const uint32_t *p_Indices, size_t p_IndexCount,
+               size_t p_VertexCount, size_t p_CacheSize)
+  {
+    // miss number each vertex last entered the cache at; 0 => never
+    std::vector<size_t> entered (p_VertexCount, 0);
+    size_t misses = 0;
+    for (size_t i = 0; i < p_IndexCount; i++)
+      {
+        size_t &stamp = entered[p_Indices[i]];
+        if (stamp == 0 || misses - stamp >= p_CacheSize)
+          stamp = ++misses;
+      }
+    return misses;
+  }
+}; // namespace MeshOpt
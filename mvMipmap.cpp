@@ -0,0 +1,140 @@
+#include "mvMipmap.h"
+#include "mvWorker.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace Mipmap
+{
+  namespace
+  {
+    // rows per parallelFor job
+    constexpr uint32_t ROW_BATCH = 32;
+
+    struct SrgbTables
+    {
+      std::array<float, 256> toLinear = {};
+
+      SrgbTables (void)
+      {
+        for (size_t i = 0; i < toLinear.size (); i++)
+          {
+            float c = static_cast<float> (i) / 255.0f;
+            toLinear[i] = (c <= 0.04045f)
+                              ? c / 12.92f
+                              : std::pow ((c + 0.055f) / 1.055f, 2.4f);
+          }
+      }
+    };
+
+    const SrgbTables &
+    srgbTables (void)
+    {
+      static const SrgbTables tables;
+      return tables;
+    }
+
+    uint8_t
+    linearToSrgb (float p_Value)
+    {
+      float c = (p_Value <= 0.0031308f)
+                    ? p_Value * 12.92f
+                    : 1.055f * std::pow (p_Value, 1.0f / 2.4f) - 0.055f;
+      return static_cast<uint8_t> (
+          std::clamp (c * 255.0f + 0.5f, 0.0f, 255.0f));
+    }
+
+    // Rows [p_Z0, p_Z1) of the level below p_Source
+    void
+    downsampleRows (const uint8_t *p_Source, uint32_t p_SourceWidth,
+                    uint32_t p_SourceHeight, Level &p_Level,
+                    size_t p_Channels, bool p_Srgb, uint32_t p_Z0,
+                    uint32_t p_Z1)
+    {
+      const auto &toLinear = srgbTables ().toLinear;
+      size_t colourChannels = p_Srgb ? std::min<size_t> (p_Channels, 3) : 0;
+
+      for (uint32_t z = p_Z0; z < p_Z1; z++)
+        {
+          // odd sizes drop the last row/column like a linear blit
+          uint32_t z0 = std::min (z * 2, p_SourceHeight - 1);
+          uint32_t z1 = std::min (z * 2 + 1, p_SourceHeight - 1);
+          const uint8_t *row0 = p_Source + size_t (z0) * p_SourceWidth
+                                               * p_Channels;
+          const uint8_t *row1 = p_Source + size_t (z1) * p_SourceWidth
+                                               * p_Channels;
+          uint8_t *out = p_Level.texels.data ()
+                         + size_t (z) * p_Level.width * p_Channels;
+
+          for (uint32_t x = 0; x < p_Level.width; x++)
+            {
+              size_t x0 = std::min (x * 2, p_SourceWidth - 1) * p_Channels;
+              size_t x1
+                  = std::min (x * 2 + 1, p_SourceWidth - 1) * p_Channels;
+
+              for (size_t c = 0; c < p_Channels; c++)
+                {
+                  if (c < colourChannels)
+                    {
+                      float sum = toLinear[row0[x0 + c]]
+                                  + toLinear[row0[x1 + c]]
+                                  + toLinear[row1[x0 + c]]
+                                  + toLinear[row1[x1 + c]];
+                      out[c] = linearToSrgb (sum * 0.25f);
+                    }
+                  else
+                    {
+                      uint32_t sum = row0[x0 + c] + row0[x1 + c]
+                                     + row1[x0 + c] + row1[x1 + c];
+                      out[c] = static_cast<uint8_t> ((sum + 2) / 4);
+                    }
+                }
+              out += p_Channels;
+            }
+        }
+      return;
+    }
+  }; // namespace
+
+  uint32_t
+  levelCount (uint32_t p_Width, uint32_t p_Height)
+  {
+    uint32_t levels = 1;
+    for (uint32_t size = std::max (p_Width, p_Height); size > 1; size >>= 1)
+      levels++;
+    return levels;
+  }
+
+  std::vector<Level>
+  generate (WorkerPool &p_Workers, const uint8_t *p_Texels, uint32_t p_Width,
+            uint32_t p_Height, size_t p_Channels, bool p_Srgb)
+  {
+    std::vector<Level> levels (levelCount (p_Width, p_Height) - 1);
+
+    const uint8_t *source = p_Texels;
+    uint32_t sourceWidth = p_Width;
+    uint32_t sourceHeight = p_Height;
+    for (auto &level : levels)
+      {
+        level.width = std::max (sourceWidth / 2, 1u);
+        level.height = std::max (sourceHeight / 2, 1u);
+        level.texels.resize (size_t (level.width) * level.height
+                             * p_Channels);
+
+        // each level reads the finished one above it
+        uint32_t batches = (level.height + ROW_BATCH - 1) / ROW_BATCH;
+        p_Workers.parallelFor (batches, [&] (size_t idx) {
+          uint32_t z0 = static_cast<uint32_t> (idx) * ROW_BATCH;
+          uint32_t z1 = std::min (z0 + ROW_BATCH, level.height);
+          downsampleRows (source, sourceWidth, sourceHeight, level,
+                          p_Channels, p_Srgb, z0, z1);
+        });
+
+        source = level.texels.data ();
+        sourceWidth = level.width;
+        sourceHeight = level.height;
+      }
+    return levels;
+  }
+}; // namespace Mipmap
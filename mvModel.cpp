@@ -1,4 +1,5 @@
 #include "mvModel.h"
+#include "mvMeshOpt.h"
 
 extern LogHandler logger;
 
@@ -15,167 +16,383 @@ Model::Model (void)
 Model::~Model () {}
 
 void
-Model::load (Engine *p_Engine, Allocator &p_DescriptorAllocator,
-             const char *p_Filename, bool p_OutputDebug)
+Model::load (Engine *p_Engine, const char *p_Filename, bool p_OutputDebug)
 {
+  ModelData data = import (p_Filename);
+  upload (p_Engine, data, p_OutputDebug);
+  return;
+}
+
+ModelData
+Model::import (const char *p_Filename)
+{
+  ModelData data;
+  data.filename = p_Filename;
+
+  uint64_t key = sourceKey (p_Filename);
+  std::string cacheFilename = Cache::modelCacheFilename (p_Filename);
+
+  Cache::ModelHeader header;
+  if (Cache::peekModelHeader (cacheFilename, sizeof (Vertex), header)
+      && header.sourceKey == key)
+    {
+      try
+        {
+          Cache::readModelFile (cacheFilename, sizeof (Vertex), data.cached);
+        }
+      catch (std::exception &e)
+        {
+          logger.logMessage (LogHandler::MessagePriority::eWarning,
+                             "Discarding model cache => "
+                                 + std::string (e.what ()));
+          data.cached = {};
+        }
+    }
+
+  if (data.cached.header)
+    {
+      const Cache::ModelHeader &cached = *data.cached.header;
+      data.meshes.assign (data.cached.meshes,
+                          data.cached.meshes + cached.meshCount);
+      for (uint32_t i = 0; i < cached.textureCount; i++)
+        {
+          TextureData tex;
+          tex.type = static_cast<aiTextureType> (data.cached.textures[i].type);
+          tex.path = data.cached.textures[i].path;
+          data.textures.push_back (std::move (tex));
+        }
+      data.materials.assign (data.cached.materials,
+                             data.cached.materials + cached.materialCount);
+      data.missesBefore = cached.cacheMissesBefore;
+      data.missesAfter = cached.cacheMissesAfter;
+    }
+  else
+    {
+      // Importers are not thread safe; one per call
+      Assimp::Importer importer;
+      const aiScene *aiScene = importer.ReadFile (
+          p_Filename, aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs
+                          | aiProcess_Triangulate
+                          | aiProcess_ValidateDataStructure
+                          | aiProcess_SplitLargeMeshes);
+
+      if (!aiScene)
+        {
+          throw std::runtime_error ("Assimp failed to load model => "
+                                    + std::string (p_Filename));
+        }
+
+      // process model data
+      processMaterials (data, aiScene);
+      std::vector<Mesh> nodeMeshes;
+      processNode (data, nodeMeshes, aiScene->mRootNode, aiScene,
+                   aiMatrix4x4 ());
+      std::vector<Mesh> meshes = mergeMeshes (data, nodeMeshes);
+
+      for (auto &mesh : meshes)
+        {
+          // Faces come in file order; reorder for the vertex cache then
+          // number vertices in order of first use
+          data.missesBefore += MeshOpt::cacheMisses (
+              mesh.indices.data (), mesh.indices.size (),
+              mesh.vertices.size ());
+          MeshOpt::optimizeVertexCache (mesh.indices.data (),
+                                        mesh.indices.size (),
+                                        mesh.vertices.size ());
+          auto remap = MeshOpt::optimizeVertexFetch (mesh.indices.data (),
+                                                     mesh.indices.size (),
+                                                     mesh.vertices.size ());
+          MeshOpt::remapVertices (mesh.vertices, remap);
+          data.missesAfter += MeshOpt::cacheMisses (mesh.indices.data (),
+                                                    mesh.indices.size (),
+                                                    mesh.vertices.size ());
+
+          // Flatten into one vertex & index array; indices stay mesh local
+          Cache::ModelMesh range;
+          range.firstVertex = data.vertices.size ();
+          range.vertexCount = mesh.vertices.size ();
+          range.firstIndex = data.indices.size ();
+          range.indexCount = mesh.indices.size ();
+          range.mtlIndex = mesh.mtlIndex;
+          range.materialIndex = mesh.materialIndex;
+          data.meshes.push_back (range);
+
+          data.vertices.insert (data.vertices.end (), mesh.vertices.begin (),
+                                mesh.vertices.end ());
+          data.indices.insert (data.indices.end (), mesh.indices.begin (),
+                               mesh.indices.end ());
+        }
+
+      // A missing cache only costs the next launch another import
+      try
+        {
+          writeCache (cacheFilename, data, key);
+        }
+      catch (std::exception &e)
+        {
+          logger.logMessage (LogHandler::MessagePriority::eWarning,
+                             "Failed to write model cache => "
+                                 + std::string (e.what ()));
+        }
+    }
 
-  modelName = p_Filename;
+  // Texels are never cached; decoded at upload unless already registered
+  for (auto &tex : data.textures)
+    tex.checksum = TextureRegistry::contentChecksum (tex.path);
+  return data;
+}
 
-  Assimp::Importer importer;
-  const aiScene *aiScene = importer.ReadFile (
-      p_Filename, aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs
-                      | aiProcess_Triangulate | aiProcess_ValidateDataStructure
-                      | aiProcess_SplitLargeMeshes);
+void
+Model::decodeTexture (TextureData &p_Texture)
+{
+  try
+    {
+      if (Ktx::findTexture (p_Texture.path, p_Texture.baked)
+          && Ktx::isSrgb (p_Texture.baked.vkFormat))
+        return;
+    }
+  catch (std::exception &e)
+    {
+      logger.logMessage (LogHandler::MessagePriority::eWarning,
+                         "Ignoring baked texture => "
+                             + std::string (e.what ()));
+    }
+  p_Texture.baked = {};
+
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  stbi_uc *rawImage = stbi_load (p_Texture.path.c_str (), &width, &height,
+                                 &channels, STBI_rgb_alpha);
+  if (!rawImage)
+    throw std::runtime_error ("Failed to load image => " + p_Texture.path);
+
+  p_Texture.width = static_cast<uint32_t> (width);
+  p_Texture.height = static_cast<uint32_t> (height);
+  p_Texture.texels.assign (
+      rawImage, rawImage + static_cast<size_t> (width) * height * 4);
+  stbi_image_free (rawImage);
+  return;
+}
 
-  if (!aiScene)
+Image::ImageCreateInfo
+Model::textureCreateInfo (void)
+{
+  Image::ImageCreateInfo createInfo;
+  createInfo.format = vk::Format::eR8G8B8A8Srgb;
+  createInfo.memoryProperties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+  createInfo.tiling = vk::ImageTiling::eOptimal;
+  createInfo.usage = vk::ImageUsageFlagBits::eSampled
+                     | vk::ImageUsageFlagBits::eTransferDst;
+  return createInfo;
+}
+
+uint64_t
+Model::sourceKey (const char *p_Filename)
+{
+  // an unreadable file fails in assimp with a better message
+  Cache::MappedFile source;
+  try
     {
-      throw std::runtime_error ("Assimp failed to load model");
+      source.open (p_Filename);
     }
+  catch (std::exception &)
+    {
+      return 0;
+    }
+
+  const uint64_t key[2]
+      = { IMPORT_VERSION, Cache::checksum (source.data (), source.size ()) };
+  return Cache::checksum (key, sizeof (key));
+}
+
+void
+Model::writeCache (const std::string &p_Filename, const ModelData &p_Data,
+                   uint64_t p_Key)
+{
+  std::vector<Cache::ModelTexture> textures (p_Data.textures.size ());
+  for (size_t i = 0; i < textures.size (); i++)
+    {
+      const std::string &path = p_Data.textures.at (i).path;
+      if (path.size () >= sizeof (Cache::ModelTexture::path))
+        throw std::runtime_error ("Texture path too long to cache => "
+                                  + path);
 
-  // process model data
-  processNode (p_Engine, aiScene->mRootNode, aiScene);
+      textures.at (i).type = p_Data.textures.at (i).type;
+      path.copy (textures.at (i).path, path.size ());
+    }
+
+  Cache::ModelHeader header;
+  header.sourceKey = p_Key;
+  header.cacheMissesBefore = p_Data.missesBefore;
+  header.cacheMissesAfter = p_Data.missesAfter;
+  Cache::writeModelFile (p_Filename, header, p_Data.meshes.data (),
+                         p_Data.meshes.size (), textures.data (),
+                         textures.size (), p_Data.materials.data (),
+                         p_Data.materials.size (), p_Data.vertices.data (),
+                         p_Data.vertices.size (), sizeof (Vertex),
+                         p_Data.indices.data (), p_Data.indices.size ());
+  return;
+}
+
+void
+Model::upload (Engine *p_Engine, ModelData &p_Data, bool p_OutputDebug)
+{
+  modelName = p_Data.filename;
 
-  // Arrange data in contiguous arrays for loading into gpu memory
-  std::vector<Vertex> allVertices;
-  std::vector<uint32_t> allIndices;
+  // Textures are shared engine wide; meshes share them by mtlIndex
+  for (auto &data : p_Data.textures)
+    {
+      Texture tex;
+      tex.path = data.path;
+      tex.type = data.type;
+      Image::ImageCreateInfo createInfo = textureCreateInfo ();
+
+      tex.shared = p_Engine->textures->acquire (
+          data.path, data.checksum, createInfo, [&] (Image &p_Image) {
+            if (data.baked.levels.empty () && data.texels.empty ())
+              decodeTexture (data);
+
+            if (!data.baked.levels.empty ())
+              p_Image.create (p_Engine, createInfo, data.baked);
+            else
+              p_Image.create (p_Engine, createInfo, data.texels.data (),
+                              data.width, data.height, 4);
+          });
+      tex.descriptor = tex.shared->descriptor;
+      loadedTextures->push_back (tex);
+      textureDescriptors.push_back (std::make_pair (tex.descriptor, tex));
+
+      // texels live on the GPU now
+      data.baked = {};
+      data.texels = {};
+    }
 
-  // Get total size of all meshes
-  uint32_t vertexTotalSize = 0;
-  uint32_t indexTotalSize = 0;
+  for (const auto &material : p_Data.materials)
+    materials.push_back ({ glm::make_vec4 (material.color) });
 
-  uint32_t vertexOffset = 0;
-  uint32_t indexStart = 0;
-  for (auto &mesh : *loadedMeshes)
+  for (const auto &range : p_Data.meshes)
     {
-      // For every texture loaded
+      // Geometry lives only in the combined buffers
+      Mesh mesh;
+      mesh.mtlIndex = range.mtlIndex;
       if (mesh.mtlIndex >= 0)
         {
           hasTexture = true;
-          // { vk::DescriptorSet, Texture }
-          vk::DescriptorSetLayout samplerLayout
-              = p_DescriptorAllocator.getLayout (
-                  vk::DescriptorType::eCombinedImageSampler);
-
-          p_DescriptorAllocator.allocateSet (
-              samplerLayout, textureDescriptors.at (mesh.mtlIndex).first);
-
-          p_DescriptorAllocator.updateSet (
-              textureDescriptors.at (mesh.mtlIndex).second.mvImage.descriptor,
-              textureDescriptors.at (mesh.mtlIndex).first, 0);
+          mesh.textures.push_back (loadedTextures->at (mesh.mtlIndex));
         }
-
-      auto meshVertexSize
-          = static_cast<uint32_t> (mesh.vertices.size ()) * sizeof (Vertex);
-      auto meshIndexSize
-          = static_cast<uint32_t> (mesh.indices.size ()) * sizeof (uint32_t);
-
-      // Append mesh data
-      allVertices.insert (allVertices.end (), mesh.vertices.begin (),
-                          mesh.vertices.end ());
-      allIndices.insert (allIndices.end (), mesh.indices.begin (),
-                         mesh.indices.end ());
-
-      // clang-format off
-        //
-        // { {vertex offset, textureDescriptors index}, { Index start, Index count } }
-        //
-      // clang-format on
-      bufferOffsets.push_back ({ { vertexOffset, mesh.mtlIndex },
-                                 { indexStart, mesh.indices.size () } });
-
-      indexStart += mesh.indices.size ();
-      // vertexOffset += meshVertexSize;
-      vertexOffset += mesh.vertices.size ();
-      vertexTotalSize += meshVertexSize;
-      indexTotalSize += meshIndexSize;
+      mesh.materialIndex = range.materialIndex;
+      loadedMeshes->push_back (std::move (mesh));
+
+      DrawRange draw;
+      draw.vertexOffset = range.firstVertex;
+      draw.textureIndex = range.mtlIndex;
+      draw.materialIndex = range.materialIndex;
+      draw.firstIndex = range.firstIndex;
+      draw.indexCount = range.indexCount;
+      bufferOffsets.push_back (draw);
     }
 
   // Create large contiguous buffers for model data
-  // Data loaded in allVertices & allIndices
-  totalVertices = allVertices.size ();
-  totalIndices = allIndices.size ();
+  totalVertices = p_Data.getVertexCount ();
+  totalIndices = p_Data.getIndexCount ();
   triangleCount = totalIndices / 3;
 
+  // createBuffer only reads the initial data; it may point into the
+  // read only cache mapping
   // Create vertex buffer
-  p_Engine->createBuffer (vk::BufferUsageFlagBits::eVertexBuffer,
-                          vk::MemoryPropertyFlagBits::eHostCoherent
-                              | vk::MemoryPropertyFlagBits::eHostVisible,
-                          vertexTotalSize, &vertexBuffer, &vertexMemory,
-                          allVertices.data ());
+  p_Engine->createBuffer (
+      vk::BufferUsageFlagBits::eVertexBuffer,
+      vk::MemoryPropertyFlagBits::eHostCoherent
+          | vk::MemoryPropertyFlagBits::eHostVisible,
+      totalVertices * sizeof (Vertex), &vertexBuffer, &vertexMemory,
+      const_cast<Vertex *> (p_Data.getVertices ()));
   // Create index buffer
-  p_Engine->createBuffer (vk::BufferUsageFlagBits::eIndexBuffer,
-                          vk::MemoryPropertyFlagBits::eHostCoherent
-                              | vk::MemoryPropertyFlagBits::eHostVisible,
-                          indexTotalSize, &indexBuffer, &indexMemory,
-                          allIndices.data ());
+  p_Engine->createBuffer (
+      vk::BufferUsageFlagBits::eIndexBuffer,
+      vk::MemoryPropertyFlagBits::eHostCoherent
+          | vk::MemoryPropertyFlagBits::eHostVisible,
+      totalIndices * sizeof (uint32_t), &indexBuffer, &indexMemory,
+      const_cast<uint32_t *> (p_Data.getIndices ()));
 
   if (p_OutputDebug || true)
     {
       logger.logMessage (
-          "\t :: Loaded model => " + std::string (p_Filename)
-          + "\n\t\t Meshes => " + std::to_string (loadedMeshes->size ())
-          + "\n\t\t Textures => " + std::to_string (loadedTextures->size ()));
+          "\t :: Loaded model => " + modelName
+          + (p_Data.cached.header ? " (cached)" : "") + "\n\t\t Meshes => "
+          + std::to_string (loadedMeshes->size ()) + "\n\t\t Textures => "
+          + std::to_string (loadedTextures->size ())
+          + "\n\t\t Vertex cache ACMR => "
+          + std::to_string (static_cast<float> (p_Data.missesBefore)
+                            / std::max (triangleCount, 1u))
+          + " -> "
+          + std::to_string (static_cast<float> (p_Data.missesAfter)
+                            / std::max (triangleCount, 1u)));
     }
   return;
 }
 
 void
-Model::processNode (Engine *p_Engine, aiNode *p_Node, const aiScene *p_Scene)
+Model::processNode (ModelData &p_Data, std::vector<Mesh> &p_Meshes,
+                    aiNode *p_Node, const aiScene *p_Scene,
+                    const aiMatrix4x4 &p_Parent)
 {
+  aiMatrix4x4 transform = p_Parent * p_Node->mTransformation;
   for (uint32_t i = 0; i < p_Node->mNumMeshes; i++)
     {
       aiMesh *mesh = p_Scene->mMeshes[p_Node->mMeshes[i]];
-      loadedMeshes->push_back (processMesh (p_Engine, mesh, p_Scene));
+      p_Meshes.push_back (processMesh (p_Data, mesh, p_Scene, transform));
     }
 
   // recall function for children of this node
   for (uint32_t i = 0; i < p_Node->mNumChildren; i++)
     {
-      processNode (p_Engine, p_Node->mChildren[i], p_Scene);
+      processNode (p_Data, p_Meshes, p_Node->mChildren[i], p_Scene,
+                   transform);
     }
   return;
 }
 
 struct Mesh
-Model::processMesh (Engine *p_Engine, aiMesh *p_Mesh, const aiScene *p_Scene)
+Model::processMesh (ModelData &p_Data, aiMesh *p_Mesh, const aiScene *p_Scene,
+                    const aiMatrix4x4 &p_Transform)
 {
   std::vector<uint32_t> inds;
   std::vector<struct Vertex> verts;
-  std::vector<Texture> texs;
+
+  // Normals take the inverse transpose so non uniform scale keeps them
+  // perpendicular; mirroring transforms flip winding
+  aiMatrix3x3 normalTransform = aiMatrix3x3 (p_Transform);
+  const float determinant = normalTransform.Determinant ();
+  const bool mirrored = determinant < 0.0f;
+  if (determinant != 0.0f)
+    normalTransform.Inverse ().Transpose ();
 
   for (uint32_t i = 0; i < p_Mesh->mNumVertices; i++)
     {
       Vertex v = {};
 
       // get vertices
-      v.position = {
-        p_Mesh->mVertices[i].x,
-        p_Mesh->mVertices[i].y,
-        p_Mesh->mVertices[i].z,
-        1.0f,
-      };
+      aiVector3D position = p_Transform * p_Mesh->mVertices[i];
+      v.position = { position.x, position.y, position.z };
 
       // get uv
       if (p_Mesh->mTextureCoords[0])
         {
-          // Last two elements are for padding--not read in shader
-          v.uv = {
-            static_cast<float> (p_Mesh->mTextureCoords[0][i].x),
-            static_cast<float> (p_Mesh->mTextureCoords[0][i].y),
-            0.0f,
-            0.0f,
-          };
+          v.setUV ({
+              p_Mesh->mTextureCoords[0][i].x,
+              p_Mesh->mTextureCoords[0][i].y,
+          });
         }
 
-      aiColor4D materialColor;
-      aiGetMaterialColor (p_Scene->mMaterials[p_Mesh->mMaterialIndex],
-                          AI_MATKEY_COLOR_DIFFUSE, &materialColor);
-      v.color = {
-        materialColor.r,
-        materialColor.g,
-        materialColor.b,
-        materialColor.a,
-      };
+      // zero length normals keep the default
+      if (p_Mesh->HasNormals ())
+        {
+          aiVector3D transformed = normalTransform * p_Mesh->mNormals[i];
+          glm::vec3 normal = { transformed.x, transformed.y, transformed.z };
+          if (normal != glm::vec3 (0.0f))
+            v.normal = Vertex::packNormal (normal);
+        }
 
       verts.push_back (v);
     }
@@ -189,83 +406,115 @@ Model::processMesh (Engine *p_Engine, aiMesh *p_Mesh, const aiScene *p_Scene)
           // get indices
           inds.push_back (face.mIndices[j]);
         }
+      if (mirrored)
+        std::reverse (inds.end () - face.mNumIndices, inds.end ());
     }
 
   // construct _Mesh then return
   struct Mesh m;
+  m.materialIndex = p_Mesh->mMaterialIndex;
 
   // get material textures
   aiMaterial *material = p_Scene->mMaterials[p_Mesh->mMaterialIndex];
-  std::vector<Texture> diffuseMaps
-      = loadMaterialTextures (p_Engine, material, aiTextureType_DIFFUSE,
-                              "texture_diffuse", p_Scene, m.mtlIndex);
-  texs.insert (texs.end (), std::make_move_iterator (diffuseMaps.begin ()),
-               std::make_move_iterator (diffuseMaps.end ()));
-
-  m.vertices = verts;
-  m.indices = inds;
-  m.textures = std::move (texs);
+  loadMaterialTextures (p_Data, material, aiTextureType_DIFFUSE,
+                        "texture_diffuse", p_Scene, m.mtlIndex);
+
+  m.vertices = std::move (verts);
+  m.indices = std::move (inds);
   return m;
 }
 
-std::vector<Texture>
-Model::loadMaterialTextures (Engine *p_Engine, aiMaterial *p_Material,
+std::vector<Mesh>
+Model::mergeMeshes (const ModelData &p_Data, std::vector<Mesh> &p_Meshes)
+{
+  auto sameColor = [&] (uint32_t p_A, uint32_t p_B) {
+    const auto &a = p_Data.materials.at (p_A).color;
+    const auto &b = p_Data.materials.at (p_B).color;
+    return std::equal (std::begin (a), std::end (a), std::begin (b));
+  };
+
+  std::vector<Mesh> merged;
+  for (auto &mesh : p_Meshes)
+    {
+      auto target = std::find_if (
+          merged.begin (), merged.end (), [&] (const Mesh &p_Merged) {
+            return p_Merged.mtlIndex == mesh.mtlIndex
+                   && sameColor (p_Merged.materialIndex, mesh.materialIndex);
+          });
+      if (target == merged.end ())
+        {
+          merged.push_back (std::move (mesh));
+          continue;
+        }
+
+      // indices stay local to the merged range
+      const auto base = static_cast<uint32_t> (target->vertices.size ());
+      for (uint32_t index : mesh.indices)
+        target->indices.push_back (base + index);
+      target->vertices.insert (target->vertices.end (),
+                               mesh.vertices.begin (), mesh.vertices.end ());
+    }
+  p_Meshes.clear ();
+  return merged;
+}
+
+void
+Model::processMaterials (ModelData &p_Data, const aiScene *p_Scene)
+{
+  for (uint32_t i = 0; i < p_Scene->mNumMaterials; i++)
+    {
+      // materials without a diffuse colour draw white
+      Cache::ModelMaterial material;
+      aiColor4D materialColor;
+      if (aiGetMaterialColor (p_Scene->mMaterials[i], AI_MATKEY_COLOR_DIFFUSE,
+                              &materialColor)
+          == aiReturn_SUCCESS)
+        {
+          material.color[0] = materialColor.r;
+          material.color[1] = materialColor.g;
+          material.color[2] = materialColor.b;
+          material.color[3] = materialColor.a;
+        }
+      p_Data.materials.push_back (material);
+    }
+  return;
+}
+
+void
+Model::loadMaterialTextures (ModelData &p_Data, aiMaterial *p_Material,
                              aiTextureType p_Type,
                              [[maybe_unused]] std::string p_TypeName,
                              [[maybe_unused]] const aiScene *p_Scene,
                              int &p_MtlIndex)
 {
-  std::vector<Texture> textures;
   for (uint32_t i = 0; i < p_Material->GetTextureCount (p_Type); i++)
     {
       aiString t_name;
       p_Material->GetTexture (p_Type, i, &t_name);
-      bool skip = false;
+
+      // TODO
+      // if embedded compressed texture type
+      std::string filename = std::string (t_name.C_Str ());
+      filename = "models/" + filename;
+      std::replace (filename.begin (), filename.end (), '\\', '/');
+
       // check if this material texture has already been loaded
-      for (uint32_t j = 0; j < loadedTextures->size (); j++)
+      auto loaded = std::find_if (
+          p_Data.textures.begin (), p_Data.textures.end (),
+          [&] (const TextureData &tex) { return tex.path == filename; });
+      if (loaded != p_Data.textures.end ())
         {
-          if (strcmp (loadedTextures->at (j).path.c_str (), t_name.C_Str ())
-              == 0)
-            {
-              textures.push_back (std::move (loadedTextures->at (j)));
-              skip = true;
-              break;
-            }
+          p_MtlIndex = loaded - p_Data.textures.begin ();
+          continue;
         }
 
-      // if not already loaded, load it
-      if (!skip)
-        {
-          Texture tex;
-          // TODO
-          // if embedded compressed texture type
-          std::string filename = std::string (t_name.C_Str ());
-          filename = "models/" + filename;
-          std::replace (filename.begin (), filename.end (), '\\', '/');
-
-          tex.path = filename;
-          tex.type = p_Type;
-          Image::ImageCreateInfo createInfo;
-          createInfo.format = vk::Format::eR8G8B8A8Srgb;
-          createInfo.memoryProperties
-              = vk::MemoryPropertyFlagBits::eDeviceLocal;
-          createInfo.tiling = vk::ImageTiling::eOptimal;
-          createInfo.usage = vk::ImageUsageFlagBits::eSampled
-                             | vk::ImageUsageFlagBits::eTransferDst;
-
-          // load texture
-          tex.mvImage.create (p_Engine, createInfo, filename);
-          // add to vector for return
-          textures.push_back (tex);
-          // add to loaded_textures to save processing time in event of
-          // duplicate
-          loadedTextures->push_back (tex);
-          vk::DescriptorSet descriptor;
-          textureDescriptors.push_back (std::make_pair (descriptor, tex));
-          p_MtlIndex = textureDescriptors.size () - 1;
-        }
+      TextureData tex;
+      tex.path = filename;
+      tex.type = p_Type;
+      p_Data.textures.push_back (std::move (tex));
+      p_MtlIndex = p_Data.textures.size () - 1;
     }
-  return textures;
+  return;
 }
 
 void
@@ -302,13 +551,10 @@ Model::cleanup (Engine *p_Engine)
       indexMemory = nullptr;
     }
 
-  if (!textureDescriptors.empty ())
-    {
-      for (auto &descriptor : textureDescriptors)
-        {
-          descriptor.second.mvImage.destroy ();
-        }
-    }
+  // shared textures outlive the model while others reference them
+  for (auto &descriptor : textureDescriptors)
+    p_Engine->textures->release (descriptor.second.shared);
+  textureDescriptors.clear ();
 
   // Cleaned up by previous loop
   // if (!loadedTextures->empty())
@@ -333,78 +579,3 @@ Mesh::bindBuffers (vk::CommandBuffer &p_CommandBuffer)
   p_CommandBuffer.bindIndexBuffer (indexBuffer, 0, vk::IndexType::eUint32);
   return;
 }
-
-std::ostream &
-operator<< (std::ostream &p_OutputStream, const Vertex &p_Vertex)
-{
-  p_OutputStream << p_Vertex.position.x << " " << p_Vertex.position.y << " "
-                 << p_Vertex.position.z << " " << p_Vertex.position.w << "|"
-                 << p_Vertex.color.r << " " << p_Vertex.color.g << " "
-                 << p_Vertex.color.b << " " << p_Vertex.color.a << "|"
-                 << p_Vertex.uv.x << " " << p_Vertex.uv.y << " " << 0.0f << " "
-                 << 0.0f << "\n";
-  return p_OutputStream;
-}
-
-std::istream &
-operator>> (std::istream &p_InputStream, Vertex &p_DestObject)
-{
-  std::string input;
-  std::getline (p_InputStream, input);
-
-  // If empty, disregard
-  if (input.empty ())
-    return p_InputStream;
-
-  // Grab each segment of line
-  // x y z w|r g b a|u v 0 0
-
-  size_t posDelimit = input.find ('|');
-  if (posDelimit == std::string::npos)
-    {
-      std::cout << "Current input : " << input << "\n";
-      throw std::runtime_error (
-          "Error reading position values, corrupted file");
-    }
-
-  size_t colorDelimit = input.find ('|', posDelimit + 1);
-  if (colorDelimit == std::string::npos)
-    {
-      std::cout << "Current input : " << input << "\n";
-      throw std::runtime_error ("Error reading color values, corrupted file");
-    }
-
-  std::string strPosition (input.substr (0, posDelimit));
-  std::string strColor (&input.at (posDelimit + 1), &input.at (colorDelimit));
-  std::string strUV (input.substr (colorDelimit + 1));
-
-  std::istringstream posStream (strPosition);
-  std::istringstream colorStream (strColor);
-  std::istringstream uvStream (strUV);
-
-  std::vector<std::string> position{
-    std::istream_iterator<std::string> (posStream), {}
-  };
-  std::vector<std::string> color{
-    std::istream_iterator<std::string> (colorStream), {}
-  };
-  std::vector<std::string> uv{ std::istream_iterator<std::string> (uvStream),
-                               {} };
-
-  p_DestObject.position.x = std::stof (position.at (0));
-  p_DestObject.position.y = std::stof (position.at (1));
-  p_DestObject.position.z = std::stof (position.at (2));
-  p_DestObject.position.w = std::stof (position.at (3));
-  p_DestObject.color.r = std::stof (color.at (0));
-  p_DestObject.color.g = std::stof (color.at (1));
-  p_DestObject.color.b = std::stof (color.at (2));
-  p_DestObject.color.a = std::stof (color.at (3));
-  p_DestObject.uv.x = std::stof (uv.at (0));
-  p_DestObject.uv.y = std::stof (uv.at (1));
-  // p_DestObject.uv.z = std::stof(uv.at(2));
-  // p_DestObject.uv.w = std::stof(uv.at(3));
-  p_DestObject.uv.z = 0.0f; // Last 2 values disregard
-  p_DestObject.uv.w = 0.0f;
-
-  return p_InputStream;
-}
\ No newline at end of file
@@ -0,0 +1,1195 @@
+#include "mvTerrain.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+// Image loading/decoding methods
+#include "stb_image.h"
+
+// Index & vertex reordering at bake time
+#include "mvMeshOpt.h"
+
+#include "mvWorker.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace Terrain
+{
+  void
+  Progress::setStage (const char *p_Stage) const
+  {
+    if (stage)
+      *stage = p_Stage;
+    return;
+  }
+
+  void
+  Progress::set (float p_Value) const
+  {
+    if (value)
+      *value = p_Value;
+    return;
+  }
+
+  void
+  Progress::add (float p_Value) const
+  {
+    if (value)
+      value->fetch_add (p_Value);
+    return;
+  }
+
+  std::vector<TileView>
+  BakedTerrain::views (void) const
+  {
+    std::vector<TileView> tiles;
+    tiles.reserve (regions.size ());
+    for (size_t idx = 0; idx < regions.size (); idx++)
+      {
+        if (reused.at (idx))
+          {
+            const auto &tile = cached.at (idx);
+            tiles.push_back ({
+                tile.vertices,
+                tile.header->vertexCount,
+                tile.indices,
+                tile.header->indexCount,
+                tile.renderChunks,
+                tile.header->renderChunkCount,
+            });
+          }
+        else
+          {
+            const auto &tile = generated.at (idx);
+            tiles.push_back ({
+                tile.vertices.data (),
+                tile.vertices.size (),
+                tile.indices.data (),
+                tile.indices.size (),
+                tile.renderChunks.data (),
+                tile.renderChunks.size (),
+            });
+          }
+      }
+    return tiles;
+  }
+
+  std::vector<uint8_t>
+  readHeights (const std::string &p_Filename, size_t &p_XLength,
+               size_t &p_ZLength)
+  {
+    // Check if file exists
+    if (!std::filesystem::exists (p_Filename))
+      throw std::runtime_error ("File " + p_Filename + " does not exist");
+
+    // Read the image in
+    int tXLength = 0;
+    int tZLength = 0;
+    int tChannels = 0;
+    stbi_uc *stbiRawImage
+        = stbi_load (p_Filename.c_str (), &tXLength, &tZLength, &tChannels,
+                     STBI_default);
+
+    if (!stbiRawImage)
+      throw std::runtime_error ("STBI failed to open file => " + p_Filename);
+
+    // validate return values
+    if (tXLength < 0 || tZLength < 0 || tChannels < 0)
+      throw std::runtime_error ("STBI returned invalid values :: width, "
+                                "height or color channels is < 0");
+
+    if (tXLength < 2 || tZLength < 2)
+      {
+        stbi_image_free (stbiRawImage);
+        throw std::runtime_error (
+            "Maps must be at least 2 texels wide on each side");
+      }
+
+    p_XLength = static_cast<size_t> (tXLength);
+    p_ZLength = static_cast<size_t> (tZLength);
+    size_t channels = static_cast<size_t> (tChannels);
+
+    // Height is the first channel; one byte per texel is all we keep
+    std::vector<uint8_t> heights (p_XLength * p_ZLength);
+    for (size_t t = 0; t < heights.size (); t++)
+      heights[t] = stbiRawImage[t * channels];
+
+    // cleanup raw c interface buf
+    stbi_image_free (stbiRawImage);
+
+    return heights;
+  }
+
+  std::string
+  getBaseFilename (const std::string &p_Filename)
+  {
+    // only the extension; directories may contain dots ("./maps/a.png")
+    return std::filesystem::path (p_Filename).replace_extension ().string ();
+  }
+
+  std::string
+  filenameToBinV (const std::string &p_Filename)
+  {
+    return getBaseFilename (p_Filename) + "_v.bin";
+  }
+
+  std::string
+  filenameToBinI (const std::string &p_Filename)
+  {
+    return getBaseFilename (p_Filename) + "_i.bin";
+  }
+
+  size_t
+  tilesPerSide (size_t p_Requested, size_t p_Workers, size_t p_XLength,
+                size_t p_ZLength)
+  {
+    size_t tiles = p_Requested;
+
+    // enough tiles to give every hardware thread at least one
+    if (tiles == 0)
+      {
+        size_t threads = std::max<size_t> (1, p_Workers);
+        tiles = static_cast<size_t> (
+            std::ceil (std::sqrt (static_cast<double> (threads))));
+      }
+
+    // every tile needs at least one render chunk on both axes
+    auto chunksOn = [] (size_t p_Length) {
+      return (p_Length - 1 + RENDER_CHUNK_QUADS - 1) / RENDER_CHUNK_QUADS;
+    };
+    size_t xChunks = chunksOn (p_XLength);
+    size_t zChunks = chunksOn (p_ZLength);
+    return std::clamp<size_t> (tiles, 1, std::min (xChunks, zChunks));
+  }
+
+  std::vector<TileRegion>
+  tileRegions (size_t p_XLength, size_t p_ZLength, size_t p_Tiles)
+  {
+    std::vector<TileRegion> regions;
+    regions.reserve (p_Tiles * p_Tiles);
+
+    // render chunks are distributed evenly; texel range is quad range + 1
+    auto quadStart = [&] (size_t p_Tile, size_t p_Length) {
+      size_t quads = p_Length - 1;
+      size_t chunks = (quads + RENDER_CHUNK_QUADS - 1) / RENDER_CHUNK_QUADS;
+      return std::min (quads,
+                       ((p_Tile * chunks) / p_Tiles) * RENDER_CHUNK_QUADS);
+    };
+    for (size_t tz = 0; tz < p_Tiles; tz++)
+      {
+        for (size_t tx = 0; tx < p_Tiles; tx++)
+          {
+            size_t x0 = quadStart (tx, p_XLength);
+            size_t z0 = quadStart (tz, p_ZLength);
+            regions.push_back ({
+                x0,
+                z0,
+                quadStart (tx + 1, p_XLength) - x0 + 1,
+                quadStart (tz + 1, p_ZLength) - z0 + 1,
+            });
+          }
+      }
+    return regions;
+  }
+
+  uint64_t
+  tileKey (const std::vector<uint8_t> &p_Heights, size_t p_XLength,
+           size_t p_ZLength, const TileRegion &p_Region, size_t p_Tiles,
+           float p_MaxError)
+  {
+    const uint64_t params[] = {
+      TERRAIN_GENERATOR_VERSION,
+      RENDER_CHUNK_QUADS,
+      LOD_LEVELS,
+      std::bit_cast<uint32_t> (p_MaxError),
+      p_XLength,
+      p_ZLength,
+      p_Tiles,
+      p_Region.x0,
+      p_Region.z0,
+      p_Region.xCount,
+      p_Region.zCount,
+    };
+    uint64_t key = Cache::checksum (params, sizeof (params));
+
+    // one texel past the region on every side feeds edge normals
+    size_t x0 = p_Region.x0 > 0 ? p_Region.x0 - 1 : 0;
+    size_t z0 = p_Region.z0 > 0 ? p_Region.z0 - 1 : 0;
+    size_t x1 = std::min (p_Region.x0 + p_Region.xCount + 1, p_XLength);
+    size_t z1 = std::min (p_Region.z0 + p_Region.zCount + 1, p_ZLength);
+
+    constexpr uint64_t prime = 0x100000001b3ULL;
+    for (size_t z = z0; z < z1; z++)
+      key = (key ^ Cache::checksum (&p_Heights[z * p_XLength + x0], x1 - x0))
+            * prime;
+    return key;
+  }
+
+  bool
+  readCachedTile (const std::string &p_BaseFilename, size_t p_Idx,
+                  size_t p_ChunkCount, uint64_t p_Key,
+                  Cache::TerrainChunk &p_Chunk)
+  {
+    auto name = Cache::terrainChunkFilename (p_BaseFilename, p_Idx);
+
+    // header alone rules out stale tiles without reading the payload
+    Cache::TerrainHeader header;
+    if (!Cache::peekTerrainHeader (name, sizeof (Vertex), header))
+      return false;
+
+    if (header.chunkIndex != p_Idx || header.chunkCount != p_ChunkCount
+        || header.sourceKey != p_Key)
+      return false;
+
+    try
+      {
+        Cache::readTerrainChunk (name, sizeof (Vertex), p_Chunk);
+      }
+    catch (std::exception &e)
+      {
+        std::cout << "Discarding terrain cache => " << e.what () << "\n";
+        return false;
+      }
+    return true;
+  }
+
+  bool
+  hasBinaryCache (const std::string &p_BaseFilename, size_t &p_ChunkCount)
+  {
+    Cache::TerrainHeader header;
+    if (!Cache::peekTerrainHeader (Cache::terrainChunkFilename (p_BaseFilename,
+                                                                0),
+                                   sizeof (Vertex), header))
+      return false;
+
+    if (header.chunkCount == 0)
+      return false;
+
+    for (size_t idx = 1; idx < header.chunkCount; idx++)
+      {
+        if (!std::filesystem::exists (
+                Cache::terrainChunkFilename (p_BaseFilename, idx)))
+          {
+            std::cout << "Terrain cache is missing chunk " << idx << "\n";
+            return false;
+          }
+      }
+
+    p_ChunkCount = header.chunkCount;
+    return true;
+  }
+
+  void
+  removeStaleCache (const std::string &p_BaseFilename, size_t p_ChunkCount)
+  {
+    for (size_t idx = p_ChunkCount;; idx++)
+      {
+        if (!std::filesystem::remove (
+                Cache::terrainChunkFilename (p_BaseFilename, idx)))
+          break;
+      }
+
+    // Built directly; filenameToBin* would strip a dotted base name
+    for (size_t idx = 0; idx < 4; idx++)
+      {
+        auto name = p_BaseFilename + std::to_string (idx);
+        std::filesystem::remove (name + "_v.bin");
+        std::filesystem::remove (name + "_i.bin");
+      }
+    return;
+  }
+
+  void
+  writeCache (WorkerPool &p_Workers, const std::string &p_BaseFilename,
+              std::vector<TileMesh> &p_Tiles,
+              const std::vector<size_t> &p_Stale,
+              const std::vector<uint64_t> &p_Keys, float p_MaxError)
+  {
+    p_Workers.parallelFor (p_Stale.size (), [&] (size_t s) {
+      size_t idx = p_Stale.at (s);
+      auto &tile = p_Tiles.at (idx);
+
+      Cache::TerrainHeader header;
+      header.chunkIndex = static_cast<uint32_t> (idx);
+      header.chunkCount = static_cast<uint32_t> (p_Tiles.size ());
+      header.maxError = p_MaxError;
+      header.sourceKey = p_Keys.at (idx);
+
+      auto [min, max]
+          = getBounds (tile.vertices.data (), tile.vertices.size ());
+      for (int c = 0; c < 3; c++)
+        {
+          header.boundsMin[c] = min[c];
+          header.boundsMax[c] = max[c];
+        }
+
+      Cache::writeTerrainChunk (
+          Cache::terrainChunkFilename (p_BaseFilename, idx), header,
+          tile.vertices.data (), tile.vertices.size (), sizeof (Vertex),
+          tile.indices.data (), tile.indices.size (),
+          tile.renderChunks.data (), tile.renderChunks.size ());
+    });
+
+    std::cout << "Wrote " << p_Stale.size () << " of " << p_Tiles.size ()
+              << " terrain cache chunks for " << p_BaseFilename << "\n";
+    return;
+  }
+
+  BakedTerrain
+  bake (WorkerPool &p_Workers, const std::string &p_BaseFilename,
+        const std::vector<uint8_t> &p_Heights, size_t p_XLength,
+        size_t p_ZLength, size_t p_TilesPerSide, float p_MaxError,
+        const Progress &p_Progress)
+  {
+    // automatic layout follows an existing cache; the tile count is part of
+    // every tile key
+    size_t tiles = p_TilesPerSide;
+    Cache::TerrainHeader header;
+    if (tiles == 0
+        && Cache::peekTerrainHeader (
+            Cache::terrainChunkFilename (p_BaseFilename, 0), sizeof (Vertex),
+            header))
+      {
+        auto side = static_cast<size_t> (
+            std::lround (std::sqrt (static_cast<double> (header.chunkCount))));
+        if (side * side == header.chunkCount)
+          tiles = side;
+      }
+    tiles = tilesPerSide (tiles, p_Workers.size (), p_XLength, p_ZLength);
+
+    BakedTerrain baked;
+    baked.regions = tileRegions (p_XLength, p_ZLength, tiles);
+    const size_t tileCount = baked.regions.size ();
+
+    // Reuse every tile whose source key matches its cache file
+    p_Progress.setStage ("Reading cache");
+    std::vector<uint64_t> keys (tileCount);
+    baked.cached.resize (tileCount);
+    baked.reused.assign (tileCount, 0);
+    p_Workers.parallelFor (tileCount, [&] (size_t idx) {
+      keys.at (idx) = tileKey (p_Heights, p_XLength, p_ZLength,
+                               baked.regions.at (idx), tiles, p_MaxError);
+      baked.reused.at (idx) = readCachedTile (p_BaseFilename, idx, tileCount,
+                                              keys.at (idx),
+                                              baked.cached.at (idx));
+    });
+    p_Progress.set (0.15f);
+
+    std::vector<size_t> stale;
+    for (size_t idx = 0; idx < tileCount; idx++)
+      if (!baked.reused.at (idx))
+        stale.push_back (idx);
+    baked.staleCount = stale.size ();
+
+    std::cout << "Terrain cache " << p_BaseFilename << " => reusing "
+              << tileCount - stale.size () << " of " << tileCount
+              << " tiles\n";
+
+    baked.generated.resize (tileCount);
+    if (!stale.empty ())
+      {
+        std::cout << "Generating " << stale.size () << " tiles of "
+                  << p_XLength << "x" << p_ZLength << " map as " << tiles
+                  << "x" << tiles << " tiles on " << p_Workers.size ()
+                  << " workers\n";
+
+        p_Progress.setStage ("Generating terrain");
+        const float tileProgress = 0.6f / static_cast<float> (stale.size ());
+        p_Workers.parallelFor (stale.size (), [&] (size_t s) {
+          size_t idx = stale.at (s);
+          const auto &region = baked.regions.at (idx);
+          baked.generated.at (idx) = generateGrid (
+              p_Heights, p_XLength, region.x0, region.z0, region.xCount,
+              region.zCount, p_MaxError);
+          p_Progress.add (tileProgress);
+        });
+
+        if (p_MaxError > 0.0f)
+          {
+            size_t gridTriangles = 0;
+            size_t bakedTriangles = 0;
+            for (size_t idx : stale)
+              {
+                gridTriangles += baked.generated.at (idx).gridTriangles;
+                bakedTriangles += baked.generated.at (idx).bakedTriangles;
+              }
+            std::cout << "Decimated level 0 to max error " << p_MaxError
+                      << " => " << gridTriangles << " -> " << bakedTriangles
+                      << " triangles\n";
+          }
+
+        size_t triangles = 0;
+        size_t missesBefore = 0;
+        size_t missesAfter = 0;
+        for (size_t idx : stale)
+          {
+            const auto &tile = baked.generated.at (idx);
+            triangles += tile.indices.size () / 3;
+            missesBefore += tile.cacheMissesBefore;
+            missesAfter += tile.cacheMissesAfter;
+          }
+        if (triangles > 0)
+          std::cout << "Vertex cache ACMR (" << MeshOpt::REPORT_CACHE_SIZE
+                    << " entry FIFO) => "
+                    << static_cast<float> (missesBefore) / triangles << " -> "
+                    << static_cast<float> (missesAfter) / triangles << "\n";
+
+        p_Progress.setStage ("Writing cache");
+        writeCache (p_Workers, p_BaseFilename, baked.generated, stale, keys,
+                    p_MaxError);
+      }
+    removeStaleCache (p_BaseFilename, tileCount);
+    p_Progress.set (0.75f);
+    return baked;
+  }
+
+  std::pair<glm::vec3, glm::vec3>
+  getBounds (const Vertex *p_Vertices, size_t p_VertexCount)
+  {
+    if (p_VertexCount == 0)
+      return { glm::vec3 (0.0f), glm::vec3 (0.0f) };
+
+    glm::vec3 min = glm::vec3 (p_Vertices[0].position);
+    glm::vec3 max = min;
+    for (size_t v = 1; v < p_VertexCount; v++)
+      {
+        min = glm::min (min, glm::vec3 (p_Vertices[v].position));
+        max = glm::max (max, glm::vec3 (p_Vertices[v].position));
+      }
+    return { min, max };
+  }
+
+  float
+  levelHeight (const std::vector<uint8_t> &p_Heights, size_t p_MapWidth,
+               const ChunkRegion &p_Region, size_t p_Step, size_t p_X,
+               size_t p_Z)
+  {
+    auto cell = [p_Step] (size_t p_Pos, size_t p_Quads) {
+      size_t lo = (p_Pos == p_Quads) ? ((p_Quads - 1) / p_Step) * p_Step
+                                     : (p_Pos / p_Step) * p_Step;
+      return std::pair<size_t, size_t> (lo, std::min (lo + p_Step, p_Quads));
+    };
+    auto [x0, x1] = cell (p_X, p_Region.xQuads);
+    auto [z0, z1] = cell (p_Z, p_Region.zQuads);
+    float u = static_cast<float> (p_X - x0) / static_cast<float> (x1 - x0);
+    float v = static_cast<float> (p_Z - z0) / static_cast<float> (z1 - z0);
+
+    auto height = [&] (size_t p_LocalX, size_t p_LocalZ) {
+      return static_cast<float> (
+          p_Heights[(p_Region.z0 + p_LocalZ) * p_MapWidth + p_Region.x0
+                    + p_LocalX]);
+    };
+    float tl = height (x0, z0);
+    float tr = height (x1, z0);
+    float bl = height (x0, z1);
+    float br = height (x1, z1);
+
+    // tl -> bl -> br below the diagonal, br -> tr -> tl above
+    if (v >= u)
+      return tl + v * (bl - tl) + u * (br - bl);
+    return tl + u * (tr - tl) + v * (br - tr);
+  }
+
+  void
+  levelErrors (const std::vector<uint8_t> &p_Heights, size_t p_MapWidth,
+               const ChunkRegion &p_Region, float *p_Errors)
+  {
+    p_Errors[0] = 0.0f;
+    for (uint32_t level = 1; level < LOD_LEVELS; level++)
+      {
+        // kept monotonic so switch distances increase with level
+        float error = p_Errors[level - 1];
+        for (size_t z = 0; z <= p_Region.zQuads; z++)
+          {
+            const uint8_t *row
+                = p_Heights.data () + (p_Region.z0 + z) * p_MapWidth
+                  + p_Region.x0;
+            for (size_t x = 0; x <= p_Region.xQuads; x++)
+              {
+                float coarse = levelHeight (p_Heights, p_MapWidth, p_Region,
+                                            size_t{ 1 } << level, x, z);
+                error = std::max (
+                    error, std::abs (static_cast<float> (row[x]) - coarse));
+              }
+          }
+        p_Errors[level] = error;
+      }
+    return;
+  }
+
+  std::vector<size_t>
+  levelSamples (size_t p_Step, size_t p_Quads)
+  {
+    // level keeps multiples of the step plus both chunk edges
+    std::vector<size_t> positions;
+    for (size_t p = 0; p < p_Quads; p += p_Step)
+      positions.push_back (p);
+    positions.push_back (p_Quads);
+    return positions;
+  }
+
+  namespace
+  {
+    // Edge skirt triangles of one chunk level only
+    template <typename Index, typename Surface, typename Skirt>
+    void
+    emitSkirts (std::vector<Index> &p_Indices, size_t p_Step, size_t p_XQuads,
+                size_t p_ZQuads, Surface &&p_Surface, Skirt &&p_Skirt)
+    {
+      auto xs = levelSamples (p_Step, p_XQuads);
+      auto zs = levelSamples (p_Step, p_ZQuads);
+
+      // p -> q runs the same way as the edge of the adjoining surface
+      // triangle so the skirt keeps its facing
+      auto skirtQuad = [&] (size_t p_PX, size_t p_PZ, size_t p_QX,
+                            size_t p_QZ) {
+        const Index p = p_Surface (p_PX, p_PZ);
+        const Index q = p_Surface (p_QX, p_QZ);
+        const Index skirtP = p_Skirt (p_PX, p_PZ);
+        const Index skirtQ = p_Skirt (p_QX, p_QZ);
+        p_Indices.insert (p_Indices.end (),
+                          { q, p, skirtP, skirtP, skirtQ, q });
+      };
+
+      for (size_t j = 0; j + 1 < zs.size (); j++)
+        {
+          // left edge runs +z, right edge runs -z
+          skirtQuad (0, zs[j], 0, zs[j + 1]);
+          skirtQuad (p_XQuads, zs[j + 1], p_XQuads, zs[j]);
+        }
+      for (size_t i = 0; i + 1 < xs.size (); i++)
+        {
+          // bottom edge runs +x, top edge runs -x
+          skirtQuad (xs[i], p_ZQuads, xs[i + 1], p_ZQuads);
+          skirtQuad (xs[i + 1], 0, xs[i], 0);
+        }
+      return;
+    }
+
+    // Appends the surface & edge skirt triangles of one chunk level
+    // p_Surface (x, z) & p_Skirt (x, z) map chunk local texels to vertices
+    template <typename Index, typename Surface, typename Skirt>
+    void
+    emitLevel (std::vector<Index> &p_Indices, size_t p_Step, size_t p_XQuads,
+               size_t p_ZQuads, Surface &&p_Surface, Skirt &&p_Skirt)
+    {
+      auto xs = levelSamples (p_Step, p_XQuads);
+      auto zs = levelSamples (p_Step, p_ZQuads);
+
+      // same winding generateMesh used, tl -> bl -> br, br -> tr -> tl
+      for (size_t j = 0; j + 1 < zs.size (); j++)
+        {
+          for (size_t i = 0; i + 1 < xs.size (); i++)
+            {
+              const Index topLeft = p_Surface (xs[i], zs[j]);
+              const Index topRight = p_Surface (xs[i + 1], zs[j]);
+              const Index bottomLeft = p_Surface (xs[i], zs[j + 1]);
+              const Index bottomRight = p_Surface (xs[i + 1], zs[j + 1]);
+
+              p_Indices.insert (p_Indices.end (),
+                                { topLeft, bottomLeft, bottomRight,
+                                  bottomRight, topRight, topLeft });
+            }
+        }
+
+      emitSkirts (p_Indices, p_Step, p_XQuads, p_ZQuads, p_Surface, p_Skirt);
+      return;
+    }
+
+    // Appends a right triangulated irregular network (RTIN) of a full size
+    // chunk in place of its level 0 surface. Every border texel is kept so
+    // edges match the full grid of any neighbour drawn at level 0
+    // Returns the largest vertical error of the emitted triangles
+    template <typename Index, typename Surface>
+    float
+    emitDecimated (std::vector<Index> &p_Indices,
+                   const std::vector<uint8_t> &p_Heights, size_t p_MapWidth,
+                   const ChunkRegion &p_Region, float p_MaxError,
+                   Surface &&p_Surface)
+    {
+      // RTIN needs 2^k + 1 texels per side
+      static_assert (std::has_single_bit (RENDER_CHUNK_QUADS));
+      constexpr int quads = static_cast<int> (RENDER_CHUNK_QUADS);
+      constexpr int side = quads + 1;
+      constexpr float pinned = std::numeric_limits<float>::infinity ();
+
+      auto height = [&] (int p_X, int p_Z) {
+        return static_cast<float> (
+            p_Heights[(p_Region.z0 + p_Z) * p_MapWidth + p_Region.x0 + p_X]);
+      };
+
+      // Largest vertical distance of any covered texel from the triangle
+      auto triangleError = [&] (int p_AX, int p_AZ, int p_BX, int p_BZ,
+                                int p_CX, int p_CZ) {
+        const int area
+            = (p_BX - p_AX) * (p_CZ - p_AZ) - (p_BZ - p_AZ) * (p_CX - p_AX);
+        const float ha = height (p_AX, p_AZ);
+        const float hb = height (p_BX, p_BZ);
+        const float hc = height (p_CX, p_CZ);
+
+        float worst = 0.0f;
+        for (int z = std::min ({ p_AZ, p_BZ, p_CZ });
+             z <= std::max ({ p_AZ, p_BZ, p_CZ }); z++)
+          {
+            for (int x = std::min ({ p_AX, p_BX, p_CX });
+                 x <= std::max ({ p_AX, p_BX, p_CX }); x++)
+              {
+                // barycentric weights scaled by area
+                int wa = (p_BX - x) * (p_CZ - z) - (p_BZ - z) * (p_CX - x);
+                int wb = (p_CX - x) * (p_AZ - z) - (p_CZ - z) * (p_AX - x);
+                int wc = area - wa - wb;
+                if ((area > 0) ? (wa < 0 || wb < 0 || wc < 0)
+                               : (wa > 0 || wb > 0 || wc > 0))
+                  continue;
+
+                float surface = (wa * ha + wb * hb + wc * hc) / area;
+                worst = std::max (worst, std::abs (surface - height (x, z)));
+              }
+          }
+        return worst;
+      };
+
+      // Error of a texel is the worst error of the triangles whose hypotenuse
+      // it splits, raised to the max of the texels below it in the hierarchy
+      // so refining one triangle pulls in every split it depends on. Border
+      // texels are pinned
+      std::vector<float> errors (side * side, 0.0f);
+      for (int t = 0; t < side; t++)
+        {
+          errors[t] = pinned;
+          errors[quads * side + t] = pinned;
+          errors[t * side] = pinned;
+          errors[t * side + quads] = pinned;
+        }
+
+      // Triangle ids form a binary tree under the two root halves; a & b span
+      // the hypotenuse, c is the right angle. The last quads^2 ids are the
+      // smallest triangles with a texel on their hypotenuse; their halves
+      // cover no texels besides vertices so carry no error
+      const int smallest = quads * quads;
+      const int triangles = smallest * 2 - 2;
+      const int lastLevel = triangles - smallest;
+      for (int i = triangles - 1; i >= 0; i--)
+        {
+          int id = i + 2;
+          int ax = 0, az = 0, bx = 0, bz = 0, cx = 0, cz = 0;
+          if (id & 1)
+            bx = bz = cx = quads;
+          else
+            ax = az = cz = quads;
+
+          while ((id >>= 1) > 1)
+            {
+              int mx = (ax + bx) >> 1;
+              int mz = (az + bz) >> 1;
+              if (id & 1)
+                {
+                  bx = ax;
+                  bz = az;
+                  ax = cx;
+                  az = cz;
+                }
+              else
+                {
+                  ax = bx;
+                  az = bz;
+                  bx = cx;
+                  bz = cz;
+                }
+              cx = mx;
+              cz = mz;
+            }
+
+          float &error = errors[((az + bz) >> 1) * side + ((ax + bx) >> 1)];
+          error = std::max (error, triangleError (ax, az, bx, bz, cx, cz));
+          if (i < lastLevel)
+            error = std::max ({ error,
+                                errors[((az + cz) >> 1) * side
+                                       + ((ax + cx) >> 1)],
+                                errors[((bz + cz) >> 1) * side
+                                       + ((bx + cx) >> 1)] });
+        }
+
+      struct Triangle
+      {
+        int ax, az, bx, bz, cx, cz;
+      };
+      std::vector<Triangle> pending = {
+        { 0, 0, quads, quads, quads, 0 },
+        { quads, quads, 0, 0, 0, quads },
+      };
+
+      float achieved = 0.0f;
+      while (!pending.empty ())
+        {
+          Triangle t = pending.back ();
+          pending.pop_back ();
+
+          const int mx = (t.ax + t.bx) >> 1;
+          const int mz = (t.az + t.bz) >> 1;
+          const bool isSmallest
+              = std::abs (t.ax - t.cx) + std::abs (t.az - t.cz) <= 1;
+          if (!isSmallest && errors[mz * side + mx] > p_MaxError)
+            {
+              pending.push_back ({ t.cx, t.cz, t.ax, t.az, mx, mz });
+              pending.push_back ({ t.bx, t.bz, t.cx, t.cz, mx, mz });
+              continue;
+            }
+          if (!isSmallest)
+            achieved = std::max (achieved, errors[mz * side + mx]);
+
+          // emitLevel triangles have negative area in x, z; match its winding
+          Index a = p_Surface (t.ax, t.az);
+          Index b = p_Surface (t.bx, t.bz);
+          Index c = p_Surface (t.cx, t.cz);
+          if ((t.bx - t.ax) * (t.cz - t.az) - (t.bz - t.az) * (t.cx - t.ax)
+              > 0)
+            std::swap (b, c);
+          p_Indices.insert (p_Indices.end (), { a, b, c });
+        }
+      return achieved;
+    }
+  }; // namespace
+
+  TileMesh
+  generateGrid (const std::vector<uint8_t> &p_Heights, size_t p_MapWidth,
+                size_t p_X0, size_t p_Z0, size_t p_XCount, size_t p_ZCount,
+                float p_MaxError)
+  {
+    TileMesh tile;
+    tile.vertices.resize (p_XCount * p_ZCount);
+
+    // One vertex per texel, row major within the region
+    // Normals use texels of neighbouring tiles so shared edges match
+    std::vector<uint32_t> normals (p_XCount);
+    for (size_t j = 0; j < p_ZCount; j++)
+      {
+        const uint8_t *row = p_Heights.data () + ((p_Z0 + j) * p_MapWidth);
+        packNormalRow (p_Heights, p_MapWidth, p_Z0 + j, p_X0, p_XCount,
+                       normals.data ());
+        Vertex *out = tile.vertices.data () + (j * p_XCount);
+        for (size_t i = 0; i < p_XCount; i++)
+          {
+            out[i].position = {
+              static_cast<float> (p_X0 + i),
+              static_cast<float> (row[p_X0 + i]) * -1.0f,
+              static_cast<float> (p_Z0 + j),
+            };
+            out[i].normal = normals[i];
+          }
+      }
+
+    struct Chunk
+    {
+      // tile local origin
+      size_t x0 = 0;
+      size_t z0 = 0;
+      // map texels
+      ChunkRegion region;
+      float minY = 0.0f;
+      float maxY = 0.0f;
+      // skirt vertex below each perimeter texel, row major over the chunk
+      std::vector<uint32_t> skirts;
+    };
+
+    const size_t xQuads = p_XCount - 1;
+    const size_t zQuads = p_ZCount - 1;
+
+    std::vector<Chunk> chunks;
+    for (size_t cz = 0; cz < zQuads; cz += RENDER_CHUNK_QUADS)
+      {
+        for (size_t cx = 0; cx < xQuads; cx += RENDER_CHUNK_QUADS)
+          {
+            Chunk chunk;
+            chunk.x0 = cx;
+            chunk.z0 = cz;
+            chunk.region = {
+              p_X0 + cx,
+              p_Z0 + cz,
+              std::min (RENDER_CHUNK_QUADS, xQuads - cx),
+              std::min (RENDER_CHUNK_QUADS, zQuads - cz),
+            };
+            chunks.push_back (std::move (chunk));
+          }
+      }
+
+    auto vertexIndex = [p_XCount] (const Chunk &p_Chunk, size_t p_X,
+                                   size_t p_Z) {
+      return static_cast<uint32_t> ((p_Chunk.z0 + p_Z) * p_XCount
+                                    + p_Chunk.x0 + p_X);
+    };
+
+    // Last level a chunk local coordinate is sampled on; level l keeps
+    // multiples of 2^l plus both chunk edges
+    auto axisLevel = [] (size_t p_Pos, size_t p_Quads) {
+      if (p_Pos == 0 || p_Pos == p_Quads)
+        return LOD_LEVELS - 1;
+      return std::min<uint32_t> (std::countr_zero (p_Pos), LOD_LEVELS - 1);
+    };
+
+    tile.renderChunks.resize (chunks.size ());
+
+    // Morph targets, height range, per level error & skirts
+    // Shared edge texels get identical morph data from both chunks as
+    // chunks on a row/column share their height/width
+    for (size_t c = 0; c < chunks.size (); c++)
+      {
+        auto &chunk = chunks[c];
+        const auto &region = chunk.region;
+        chunk.minY = std::numeric_limits<float>::max ();
+        chunk.maxY = std::numeric_limits<float>::lowest ();
+
+        for (size_t z = 0; z <= region.zQuads; z++)
+          {
+            for (size_t x = 0; x <= region.xQuads; x++)
+              {
+                auto &vertex = tile.vertices[vertexIndex (chunk, x, z)];
+                uint32_t level = std::min (axisLevel (x, region.xQuads),
+                                           axisLevel (z, region.zQuads));
+
+                // uv.x => y offset once morphed into the next level; an
+                // offset keeps half precision & follows skirts down
+                // uv.y => level after which the vertex is dropped
+                float morphY
+                    = (level + 1 < LOD_LEVELS)
+                          ? -levelHeight (p_Heights, p_MapWidth, region,
+                                          size_t{ 2 } << level, x, z)
+                          : vertex.position.y;
+                vertex.setUV ({ morphY - vertex.position.y,
+                                static_cast<float> (level) });
+
+                chunk.minY = std::min (chunk.minY, vertex.position.y);
+                chunk.maxY = std::max (chunk.maxY, vertex.position.y);
+              }
+          }
+
+        auto &renderChunk = tile.renderChunks[c];
+        levelErrors (p_Heights, p_MapWidth, region, renderChunk.error);
+
+        // Skirts hang below every chunk edge far enough to hide the gap to
+        // a neighbour drawn at any other level
+        const float depth = (chunk.maxY - chunk.minY) + 1.0f;
+        chunk.skirts.assign ((region.xQuads + 1) * (region.zQuads + 1), 0);
+        for (size_t z = 0; z <= region.zQuads; z++)
+          {
+            for (size_t x = 0; x <= region.xQuads; x++)
+              {
+                if (x != 0 && x != region.xQuads && z != 0
+                    && z != region.zQuads)
+                  continue;
+
+                Vertex skirt = tile.vertices[vertexIndex (chunk, x, z)];
+                skirt.position.y += depth;
+                tile.vertices.push_back (skirt);
+                chunk.skirts[z * (region.xQuads + 1) + x]
+                    = static_cast<uint32_t> (tile.vertices.size () - 1);
+              }
+          }
+
+        renderChunk.boundsMin[0] = static_cast<float> (region.x0);
+        renderChunk.boundsMin[1] = chunk.minY;
+        renderChunk.boundsMin[2] = static_cast<float> (region.z0);
+        renderChunk.boundsMax[0]
+            = static_cast<float> (region.x0 + region.xQuads);
+        renderChunk.boundsMax[1] = chunk.maxY + depth;
+        renderChunk.boundsMax[2]
+            = static_cast<float> (region.z0 + region.zQuads);
+      }
+
+    // Level major so neighbouring chunks drawn at the same level are one
+    // contiguous range
+    tile.indices.reserve ((xQuads * zQuads * 6 * 4) / 3);
+    for (uint32_t level = 0; level < LOD_LEVELS; level++)
+      {
+        for (size_t c = 0; c < chunks.size (); c++)
+          {
+            const auto &chunk = chunks[c];
+            auto &renderChunk = tile.renderChunks[c];
+            renderChunk.firstIndex[level]
+                = static_cast<uint32_t> (tile.indices.size ());
+
+            auto surface = [&] (size_t p_X, size_t p_Z) {
+              return vertexIndex (chunk, p_X, p_Z);
+            };
+            auto skirt = [&] (size_t p_X, size_t p_Z) {
+              return chunk.skirts[p_Z * (chunk.region.xQuads + 1) + p_X];
+            };
+
+            // partial chunks on the map edge keep the full grid
+            bool isDecimated = level == 0 && p_MaxError > 0.0f
+                               && chunk.region.xQuads == RENDER_CHUNK_QUADS
+                               && chunk.region.zQuads == RENDER_CHUNK_QUADS;
+            size_t surfaceStart = tile.indices.size ();
+            if (isDecimated)
+              {
+                float error
+                    = emitDecimated (tile.indices, p_Heights, p_MapWidth,
+                                     chunk.region, p_MaxError, surface);
+
+                // coarser levels are never better than the baked level 0
+                renderChunk.error[0] = error;
+                for (uint32_t l = 1; l < LOD_LEVELS; l++)
+                  renderChunk.error[l]
+                      = std::max (renderChunk.error[l], error);
+
+                tile.bakedTriangles
+                    += (tile.indices.size () - surfaceStart) / 3;
+                emitSkirts (tile.indices, 1, chunk.region.xQuads,
+                            chunk.region.zQuads, surface, skirt);
+              }
+            else
+              {
+                emitLevel (tile.indices, size_t{ 1 } << level,
+                           chunk.region.xQuads, chunk.region.zQuads, surface,
+                           skirt);
+                if (level == 0)
+                  tile.bakedTriangles
+                      += chunk.region.xQuads * chunk.region.zQuads * 2;
+              }
+            if (level == 0)
+              tile.gridTriangles
+                  += chunk.region.xQuads * chunk.region.zQuads * 2;
+
+            renderChunk.indexCount[level] = static_cast<uint32_t> (
+                tile.indices.size () - renderChunk.firstIndex[level]);
+          }
+      }
+
+    // Every level range is drawn on its own so each is reordered for the
+    // vertex cache separately
+    const size_t vertexCount = tile.vertices.size ();
+    tile.cacheMissesBefore = MeshOpt::cacheMisses (
+        tile.indices.data (), tile.indices.size (), vertexCount);
+    for (const auto &renderChunk : tile.renderChunks)
+      for (uint32_t level = 0; level < LOD_LEVELS; level++)
+        MeshOpt::optimizeVertexCache (
+            tile.indices.data () + renderChunk.firstIndex[level],
+            renderChunk.indexCount[level], vertexCount);
+
+    // Vertices in order of first use; texels only the full grid used are
+    // dropped when decimated
+    auto remap = MeshOpt::optimizeVertexFetch (
+        tile.indices.data (), tile.indices.size (), vertexCount);
+    MeshOpt::remapVertices (tile.vertices, remap);
+    tile.cacheMissesAfter = MeshOpt::cacheMisses (
+        tile.indices.data (), tile.indices.size (), tile.vertices.size ());
+
+    splitVertexBlocks (tile);
+    return tile;
+  }
+
+  void
+  splitVertexBlocks (TileMesh &p_Tile)
+  {
+    auto &chunks = p_Tile.renderChunks;
+    const size_t vertexCount = p_Tile.vertices.size ();
+
+    // block a vertex was last counted into / placed into, counting pass it
+    // was last seen by & its slot in the placed block
+    std::vector<uint32_t> member (vertexCount, MeshOpt::UNUSED);
+    std::vector<uint32_t> placed (vertexCount, MeshOpt::UNUSED);
+    std::vector<uint32_t> counted (vertexCount, MeshOpt::UNUSED);
+    std::vector<uint32_t> slot (vertexCount, 0);
+
+    std::vector<Vertex> blocked;
+    blocked.reserve (vertexCount);
+
+    // Level major like the draws so vertices stay in order of first use
+    auto place = [&] (uint32_t p_Block, size_t p_First, size_t p_End) {
+      const auto firstVertex = static_cast<uint32_t> (blocked.size ());
+      for (uint32_t level = 0; level < LOD_LEVELS; level++)
+        {
+          for (size_t c = p_First; c < p_End; c++)
+            {
+              uint32_t *indices
+                  = p_Tile.indices.data () + chunks[c].firstIndex[level];
+              for (uint32_t i = 0; i < chunks[c].indexCount[level]; i++)
+                {
+                  uint32_t v = indices[i];
+                  if (placed[v] != p_Block)
+                    {
+                      placed[v] = p_Block;
+                      slot[v] = static_cast<uint32_t> (blocked.size ())
+                                - firstVertex;
+                      blocked.push_back (p_Tile.vertices[v]);
+                    }
+                  indices[i] = slot[v];
+                }
+            }
+        }
+      for (size_t c = p_First; c < p_End; c++)
+        {
+          chunks[c].firstVertex = firstVertex;
+          chunks[c].vertexCount
+              = static_cast<uint32_t> (blocked.size ()) - firstVertex;
+        }
+    };
+
+    uint32_t block = 0;
+    uint32_t pass = 0;
+    size_t blockFirst = 0;
+    size_t blockVertices = 0;
+    for (size_t c = 0; c < chunks.size ();)
+      {
+        size_t added = 0;
+        for (uint32_t level = 0; level < LOD_LEVELS; level++)
+          {
+            const uint32_t *indices
+                = p_Tile.indices.data () + chunks[c].firstIndex[level];
+            for (uint32_t i = 0; i < chunks[c].indexCount[level]; i++)
+              {
+                uint32_t v = indices[i];
+                if (member[v] != block && counted[v] != pass)
+                  {
+                    counted[v] = pass;
+                    added++;
+                  }
+              }
+          }
+        pass++;
+
+        // a chunk too large on its own still gets a block; the map then
+        // falls back to 32 bit indices
+        if (c > blockFirst && blockVertices + added > VERTEX_BLOCK_SIZE)
+          {
+            place (block, blockFirst, c);
+            block++;
+            blockFirst = c;
+            blockVertices = 0;
+            continue;
+          }
+
+        for (uint32_t level = 0; level < LOD_LEVELS; level++)
+          {
+            const uint32_t *indices
+                = p_Tile.indices.data () + chunks[c].firstIndex[level];
+            for (uint32_t i = 0; i < chunks[c].indexCount[level]; i++)
+              member[indices[i]] = block;
+          }
+        blockVertices += added;
+        c++;
+      }
+    if (blockFirst < chunks.size ())
+      place (block, blockFirst, chunks.size ());
+
+    p_Tile.vertices = std::move (blocked);
+    return;
+  }
+
+  uint32_t
+  packTerrainNormal (float p_Gx, float p_Gz)
+  {
+    // The L1 projection of a normal with y < 0 needs no octahedral fold
+    float l1 = (std::abs (p_Gx) + 1.0f) + std::abs (p_Gz);
+    auto snorm = [] (float p_Value) {
+      return static_cast<uint32_t> (
+                 static_cast<int32_t> (std::nearbyint (p_Value * 32767.0f)))
+             & 0xFFFF;
+    };
+    return snorm (-p_Gx / l1) | (snorm (-p_Gz / l1) << 16);
+  }
+
+  void
+  packNormalRow (const std::vector<uint8_t> &p_Heights, size_t p_MapWidth,
+                 size_t p_Z, size_t p_X0, size_t p_Count, uint32_t *p_Out)
+  {
+    const size_t mapDepth = p_Heights.size () / p_MapWidth;
+    const size_t zAbove = (p_Z > 0) ? p_Z - 1 : p_Z;
+    const size_t zBelow = (p_Z + 1 < mapDepth) ? p_Z + 1 : p_Z;
+    const uint8_t *row = p_Heights.data () + p_Z * p_MapWidth;
+    const uint8_t *above = p_Heights.data () + zAbove * p_MapWidth;
+    const uint8_t *below = p_Heights.data () + zBelow * p_MapWidth;
+    const float zScale = 1.0f / static_cast<float> (zBelow - zAbove);
+
+    auto normalAt = [&] (size_t p_X) {
+      size_t left = (p_X > 0) ? p_X - 1 : p_X;
+      size_t right = (p_X + 1 < p_MapWidth) ? p_X + 1 : p_X;
+      float gx = (static_cast<float> (row[right])
+                  - static_cast<float> (row[left]))
+                 * (1.0f / static_cast<float> (right - left));
+      float gz = (static_cast<float> (below[p_X])
+                  - static_cast<float> (above[p_X]))
+                 * zScale;
+      return packTerrainNormal (gx, gz);
+    };
+
+    size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool hasAvx2 = __builtin_cpu_supports ("avx2");
+    if (hasAvx2)
+      {
+        // left map edge is one sided
+        if (p_X0 == 0 && p_Count > 0)
+          p_Out[i++] = normalAt (0);
+        size_t interior
+            = std::min (p_Count - i, (p_MapWidth - 1) - (p_X0 + i));
+        i += packNormalsAvx2 (row, above, below, zScale, p_X0 + i, interior,
+                              p_Out + i);
+      }
+#endif
+
+    for (; i < p_Count; i++)
+      p_Out[i] = normalAt (p_X0 + i);
+    return;
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  // Eight heights as floats
+  __attribute__ ((target ("avx2"))) static inline __m256
+  loadHeights (const uint8_t *p_Texels)
+  {
+    __m128i bytes
+        = _mm_loadl_epi64 (reinterpret_cast<const __m128i *> (p_Texels));
+    return _mm256_cvtepi32_ps (_mm256_cvtepu8_epi32 (bytes));
+  }
+
+  // Same operations as packTerrainNormal in the same order
+  __attribute__ ((target ("avx2"))) size_t
+  packNormalsAvx2 (const uint8_t *p_Row, const uint8_t *p_Above,
+                   const uint8_t *p_Below, float p_ZScale, size_t p_X,
+                   size_t p_Count, uint32_t *p_Out)
+  {
+    const __m256 half = _mm256_set1_ps (0.5f);
+    const __m256 zScale = _mm256_set1_ps (p_ZScale);
+    const __m256 one = _mm256_set1_ps (1.0f);
+    const __m256 sign = _mm256_set1_ps (-0.0f);
+    const __m256 snorm = _mm256_set1_ps (32767.0f);
+    const __m256i low = _mm256_set1_epi32 (0xFFFF);
+
+    const size_t count = p_Count & ~size_t (7);
+    for (size_t i = 0; i < count; i += 8)
+      {
+        const size_t x = p_X + i;
+        __m256 gx = _mm256_mul_ps (
+            _mm256_sub_ps (loadHeights (p_Row + x + 1),
+                           loadHeights (p_Row + x - 1)),
+            half);
+        __m256 gz = _mm256_mul_ps (
+            _mm256_sub_ps (loadHeights (p_Below + x),
+                           loadHeights (p_Above + x)),
+            zScale);
+
+        __m256 l1 = _mm256_add_ps (
+            _mm256_add_ps (_mm256_andnot_ps (sign, gx), one),
+            _mm256_andnot_ps (sign, gz));
+        __m256 px = _mm256_div_ps (_mm256_xor_ps (gx, sign), l1);
+        __m256 pz = _mm256_div_ps (_mm256_xor_ps (gz, sign), l1);
+
+        __m256i sx = _mm256_cvtps_epi32 (_mm256_mul_ps (px, snorm));
+        __m256i sz = _mm256_cvtps_epi32 (_mm256_mul_ps (pz, snorm));
+        __m256i packed = _mm256_or_si256 (_mm256_and_si256 (sx, low),
+                                          _mm256_slli_epi32 (sz, 16));
+        _mm256_storeu_si256 (reinterpret_cast<__m256i *> (p_Out + i), packed);
+      }
+    return count;
+  }
+#endif
+}; // namespace Terrain
@@ -0,0 +1,225 @@
+#include "mvTextures.h"
+#include "mvAllocator.h"
+#include "mvCache.h"
+#include "mvKtx.h"
+
+#include <filesystem>
+
+TextureRegistry::TextureRegistry (Engine *p_Engine)
+{
+  if (!p_Engine)
+    throw std::runtime_error ("Invalid engine handle passed to texture "
+                              "registry");
+  engine = p_Engine;
+  return;
+}
+
+TextureRegistry::~TextureRegistry () { return; }
+
+std::string
+TextureRegistry::canonicalPath (const std::string &p_Path)
+{
+  std::error_code error;
+  auto canonical = std::filesystem::weakly_canonical (p_Path, error);
+  return error ? p_Path : canonical.string ();
+}
+
+uint64_t
+TextureRegistry::contentChecksum (const std::string &p_Path)
+{
+  for (const auto &filename : { p_Path, Ktx::textureFilename (p_Path) })
+    {
+      try
+        {
+          Cache::MappedFile file (filename);
+          return Cache::checksum (file.data (), file.size ());
+        }
+      catch (std::exception &)
+        {
+          // try the bake
+        }
+    }
+  return 0;
+}
+
+SharedTexture *
+TextureRegistry::acquire (const std::string &p_Path,
+                          Image::ImageCreateInfo &p_ImageCreateInfo)
+{
+  // a path hit needs no file access
+  std::string canonical = canonicalPath (p_Path);
+  if (SharedTexture *texture
+      = findPath (pathKey (canonical, p_ImageCreateInfo)))
+    {
+      texture->references++;
+      return texture;
+    }
+
+  return acquire (canonical, contentChecksum (canonical), p_ImageCreateInfo,
+                  [&] (Image &p_Image) {
+                    p_Image.create (engine, p_ImageCreateInfo, canonical);
+                  });
+}
+
+SharedTexture *
+TextureRegistry::acquire (const std::string &p_Path, uint64_t p_Checksum,
+                          Image::ImageCreateInfo &p_ImageCreateInfo,
+                          const std::function<void (Image &)> &p_Create)
+{
+  // create may alter the info; keys are of what was asked for
+  std::string canonical = canonicalPath (p_Path);
+  std::string byPath = pathKey (canonical, p_ImageCreateInfo);
+  const uint64_t keyParts[2] = { p_Checksum, settingsKey (p_ImageCreateInfo) };
+  uint64_t key = Cache::checksum (keyParts, sizeof (keyParts));
+
+  SharedTexture *texture = findPath (byPath);
+  if (!texture)
+    {
+      auto existing = textures.find (key);
+      if (existing != textures.end ())
+        texture = existing->second.get ();
+    }
+
+  if (!texture)
+    {
+      auto created = std::make_unique<SharedTexture> ();
+      created->path = canonical;
+      created->key = key;
+      try
+        {
+          p_Create (created->image);
+        }
+      catch (...)
+        {
+          created->image.destroy ();
+          throw;
+        }
+
+      if (!spareSets.empty ())
+        {
+          created->descriptor = spareSets.back ();
+          spareSets.pop_back ();
+        }
+      else
+        {
+          vk::DescriptorSetLayout layout = engine->allocator->getLayout (
+              vk::DescriptorType::eCombinedImageSampler);
+          engine->allocator->allocateSet (layout, created->descriptor);
+        }
+      engine->allocator->updateSet (created->image.descriptor,
+                                    created->descriptor, 0);
+
+      texture = created.get ();
+      textures.emplace (key, std::move (created));
+    }
+
+  paths[byPath] = texture->key;
+  texture->references++;
+  return texture;
+}
+
+bool
+TextureRegistry::contains (
+    const std::string &p_Path, uint64_t p_Checksum,
+    const Image::ImageCreateInfo &p_ImageCreateInfo) const
+{
+  if (findPath (pathKey (canonicalPath (p_Path), p_ImageCreateInfo)))
+    return true;
+
+  const uint64_t keyParts[2] = { p_Checksum, settingsKey (p_ImageCreateInfo) };
+  return textures.contains (Cache::checksum (keyParts, sizeof (keyParts)));
+}
+
+void
+TextureRegistry::release (SharedTexture *p_Texture)
+{
+  if (!p_Texture)
+    return;
+  if (p_Texture->references == 0)
+    throw std::runtime_error ("Released texture with no references => "
+                              + p_Texture->path);
+
+  if (--p_Texture->references == 0)
+    p_Texture->releasedFrame = engine->submittedFrames;
+  return;
+}
+
+void
+TextureRegistry::collect (void)
+{
+  for (auto it = textures.begin (); it != textures.end ();)
+    {
+      SharedTexture &texture = *it->second;
+      if (texture.references > 0
+          || engine->completedFrames < texture.releasedFrame)
+        {
+          ++it;
+          continue;
+        }
+
+      std::erase_if (paths, [&] (const auto &path) {
+        return path.second == texture.key;
+      });
+      destroy (texture);
+      it = textures.erase (it);
+    }
+  return;
+}
+
+void
+TextureRegistry::cleanup (void)
+{
+  for (auto &texture : textures)
+    destroy (*texture.second);
+  textures.clear ();
+  paths.clear ();
+
+  // freed with their pools
+  spareSets.clear ();
+  return;
+}
+
+uint64_t
+TextureRegistry::settingsKey (const Image::ImageCreateInfo &p_Info)
+{
+  const uint64_t settings[7] = {
+    static_cast<uint64_t> (p_Info.format),
+    static_cast<uint64_t> (p_Info.tiling),
+    static_cast<uint64_t> (p_Info.filter),
+    static_cast<uint64_t> (p_Info.addressMode),
+    static_cast<VkImageUsageFlags> (p_Info.usage),
+    static_cast<VkMemoryPropertyFlags> (p_Info.memoryProperties),
+    p_Info.generateMipmaps,
+  };
+  return Cache::checksum (settings, sizeof (settings));
+}
+
+std::string
+TextureRegistry::pathKey (const std::string &p_CanonicalPath,
+                          const Image::ImageCreateInfo &p_Info)
+{
+  return p_CanonicalPath + "|" + std::to_string (settingsKey (p_Info));
+}
+
+SharedTexture *
+TextureRegistry::findPath (const std::string &p_PathKey) const
+{
+  auto path = paths.find (p_PathKey);
+  if (path == paths.end ())
+    return nullptr;
+
+  auto texture = textures.find (path->second);
+  return texture == textures.end () ? nullptr : texture->second.get ();
+}
+
+void
+TextureRegistry::destroy (SharedTexture &p_Texture)
+{
+  p_Texture.image.destroy ();
+  if (p_Texture.descriptor)
+    {
+      spareSets.push_back (p_Texture.descriptor);
+      p_Texture.descriptor = nullptr;
+    }
+  return;
+}
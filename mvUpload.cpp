@@ -0,0 +1,422 @@
+#include "mvUpload.h"
+#include "mvEngine.h"
+
+#include <algorithm>
+#include <cstring>
+
+UploadBatcher::UploadBatcher (Engine *p_Engine, vk::DeviceSize p_RingSize)
+{
+  if (!p_Engine)
+    throw std::runtime_error ("Invalid engine handle passed to uploader");
+  engine = p_Engine;
+  ringSize = p_RingSize;
+
+  auto &device = engine->logicalDevice;
+
+  // Own pool so swapchain recreation never frees batches in flight
+  vk::CommandPoolCreateInfo poolInfo;
+  poolInfo.queueFamilyIndex = engine->queueIdx.graphics;
+  poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+  commandPool = device.createCommandPool (poolInfo);
+
+  vk::BufferCreateInfo bufferInfo;
+  bufferInfo.size = ringSize;
+  bufferInfo.sharingMode = vk::SharingMode::eExclusive;
+  bufferInfo.usage = vk::BufferUsageFlagBits::eTransferSrc;
+  ring = device.createBuffer (bufferInfo);
+
+  vk::MemoryRequirements requirements
+      = device.getBufferMemoryRequirements (ring);
+
+  vk::MemoryAllocateInfo allocInfo;
+  allocInfo.allocationSize = requirements.size;
+  allocInfo.memoryTypeIndex = engine->getMemoryType (
+      requirements.memoryTypeBits,
+      vk::MemoryPropertyFlagBits::eHostVisible
+          | vk::MemoryPropertyFlagBits::eHostCoherent);
+  ringMemory = device.allocateMemory (allocInfo);
+  device.bindBufferMemory (ring, ringMemory, 0);
+
+  // mapped for the lifetime of the ring
+  mapped = static_cast<std::byte *> (
+      device.mapMemory (ringMemory, 0, ringSize));
+  return;
+}
+
+UploadBatcher::~UploadBatcher () {}
+
+void
+UploadBatcher::uploadImage (vk::Image p_Image, uint32_t p_Width,
+                            uint32_t p_Height, size_t p_BytesPerTexel,
+                            const void *p_Texels, uint32_t p_MipLevels)
+{
+  if (p_MipLevels == 0)
+    throw std::runtime_error ("Attempted to upload an image without levels");
+
+  barrier (p_Image, 0, p_MipLevels, vk::ImageLayout::eUndefined,
+           vk::ImageLayout::eTransferDstOptimal);
+  stageLevel (p_Image, 0, p_Width, p_Height, p_BytesPerTexel, p_Texels);
+
+  // Each level is read once written, then left as a blit source
+  int32_t width = static_cast<int32_t> (p_Width);
+  int32_t height = static_cast<int32_t> (p_Height);
+  for (uint32_t level = 1; level < p_MipLevels; level++)
+    {
+      barrier (p_Image, level - 1, 1, vk::ImageLayout::eTransferDstOptimal,
+               vk::ImageLayout::eTransferSrcOptimal);
+
+      vk::ImageBlit blit;
+      blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+      blit.srcSubresource.mipLevel = level - 1;
+      blit.srcSubresource.baseArrayLayer = 0;
+      blit.srcSubresource.layerCount = 1;
+      blit.srcOffsets[1] = vk::Offset3D{ width, height, 1 };
+      width = std::max (width / 2, 1);
+      height = std::max (height / 2, 1);
+      blit.dstSubresource = blit.srcSubresource;
+      blit.dstSubresource.mipLevel = level;
+      blit.dstOffsets[1] = vk::Offset3D{ width, height, 1 };
+
+      record ().blitImage (p_Image, vk::ImageLayout::eTransferSrcOptimal,
+                           p_Image, vk::ImageLayout::eTransferDstOptimal,
+                           blit, vk::Filter::eLinear);
+    }
+
+  if (p_MipLevels > 1)
+    barrier (p_Image, 0, p_MipLevels - 1,
+             vk::ImageLayout::eTransferSrcOptimal,
+             vk::ImageLayout::eShaderReadOnlyOptimal);
+  barrier (p_Image, p_MipLevels - 1, 1, vk::ImageLayout::eTransferDstOptimal,
+           vk::ImageLayout::eShaderReadOnlyOptimal);
+  return;
+}
+
+void
+UploadBatcher::uploadImage (vk::Image p_Image, size_t p_BytesPerBlock,
+                            const std::vector<MipLevel> &p_Levels,
+                            uint32_t p_BlockDim)
+{
+  uint32_t levelCount = static_cast<uint32_t> (p_Levels.size ());
+  if (levelCount == 0)
+    throw std::runtime_error ("Attempted to upload an image without levels");
+
+  barrier (p_Image, 0, levelCount, vk::ImageLayout::eUndefined,
+           vk::ImageLayout::eTransferDstOptimal);
+  for (uint32_t level = 0; level < levelCount; level++)
+    stageLevel (p_Image, level, p_Levels.at (level).width,
+                p_Levels.at (level).height, p_BytesPerBlock,
+                p_Levels.at (level).texels, p_BlockDim);
+  barrier (p_Image, 0, levelCount, vk::ImageLayout::eTransferDstOptimal,
+           vk::ImageLayout::eShaderReadOnlyOptimal);
+  return;
+}
+
+void
+UploadBatcher::submit (void)
+{
+  while (!inFlight.empty ()
+         && engine->logicalDevice.getFenceStatus (inFlight.front ().fence)
+                == vk::Result::eSuccess)
+    release ();
+
+  if (!recording.commandBuffer)
+    return;
+
+  recording.commandBuffer.end ();
+  recording.fence = engine->logicalDevice.createFence (vk::FenceCreateInfo ());
+  recording.end = head;
+
+  vk::SubmitInfo submitInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &recording.commandBuffer;
+  engine->graphicsQueue.submit (submitInfo, recording.fence);
+
+  inFlight.push_back (recording);
+  recording = {};
+  return;
+}
+
+void
+UploadBatcher::flush (void)
+{
+  submit ();
+  while (!inFlight.empty ())
+    {
+      vk::Result res = engine->logicalDevice.waitForFences (
+          inFlight.front ().fence, VK_TRUE, UINT64_MAX);
+      if (res != vk::Result::eSuccess)
+        throw std::runtime_error ("Error occurred while waiting for fence");
+      release ();
+    }
+  return;
+}
+
+void
+UploadBatcher::cleanup (void)
+{
+  auto &device = engine->logicalDevice;
+  if (!device)
+    return;
+
+  // recorded work references images that may already be gone
+  if (recording.commandBuffer)
+    {
+      device.freeCommandBuffers (commandPool, recording.commandBuffer);
+      recording = {};
+    }
+  flush ();
+
+  if (mapped)
+    {
+      device.unmapMemory (ringMemory);
+      mapped = nullptr;
+    }
+  if (ring)
+    {
+      device.destroyBuffer (ring);
+      ring = nullptr;
+    }
+  if (ringMemory)
+    {
+      device.freeMemory (ringMemory);
+      ringMemory = nullptr;
+    }
+  if (commandPool)
+    {
+      device.destroyCommandPool (commandPool);
+      commandPool = nullptr;
+    }
+  return;
+}
+
+void
+UploadBatcher::barrier (vk::Image p_Image, uint32_t p_BaseLevel,
+                        uint32_t p_LevelCount, vk::ImageLayout p_OldLayout,
+                        vk::ImageLayout p_NewLayout)
+{
+  vk::ImageMemoryBarrier imageBarrier;
+  imageBarrier.oldLayout = p_OldLayout;
+  imageBarrier.newLayout = p_NewLayout;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.image = p_Image;
+  imageBarrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+  imageBarrier.subresourceRange.baseMipLevel = p_BaseLevel;
+  imageBarrier.subresourceRange.levelCount = p_LevelCount;
+  imageBarrier.subresourceRange.baseArrayLayer = 0;
+  imageBarrier.subresourceRange.layerCount = 1;
+
+  vk::PipelineStageFlags sourceStage;
+  vk::PipelineStageFlags destinationStage;
+
+  if (p_OldLayout == vk::ImageLayout::eUndefined)
+    {
+      imageBarrier.srcAccessMask = vk::AccessFlagBits::eNoneKHR;
+      sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
+    }
+  else if (p_OldLayout == vk::ImageLayout::eTransferDstOptimal)
+    {
+      imageBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+      sourceStage = vk::PipelineStageFlagBits::eTransfer;
+    }
+  else if (p_OldLayout == vk::ImageLayout::eTransferSrcOptimal)
+    {
+      imageBarrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+      sourceStage = vk::PipelineStageFlagBits::eTransfer;
+    }
+  else
+    {
+      throw std::runtime_error ("Layout transition requested is unsupported");
+    }
+
+  if (p_NewLayout == vk::ImageLayout::eTransferDstOptimal)
+    {
+      imageBarrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+      destinationStage = vk::PipelineStageFlagBits::eTransfer;
+    }
+  else if (p_NewLayout == vk::ImageLayout::eTransferSrcOptimal)
+    {
+      imageBarrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+      destinationStage = vk::PipelineStageFlagBits::eTransfer;
+    }
+  else if (p_NewLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
+    {
+      // heightfield terrain samples in the vertex stage
+      imageBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+      destinationStage = vk::PipelineStageFlagBits::eVertexShader
+                         | vk::PipelineStageFlagBits::eFragmentShader;
+    }
+  else
+    {
+      throw std::runtime_error ("Layout transition requested is unsupported");
+    }
+
+  record ().pipelineBarrier (sourceStage, destinationStage,
+                             vk::DependencyFlags (), nullptr, nullptr,
+                             imageBarrier);
+  return;
+}
+
+void
+UploadBatcher::stageLevel (vk::Image p_Image, uint32_t p_MipLevel,
+                           uint32_t p_Width, uint32_t p_Height,
+                           size_t p_BytesPerBlock, const void *p_Texels,
+                           uint32_t p_BlockDim)
+{
+  if (p_BlockDim == 0)
+    throw std::runtime_error ("Attempted to upload with an empty block");
+
+  // a row is one row of blocks; partial edge blocks are stored whole
+  uint32_t blockRows = (p_Height + p_BlockDim - 1) / p_BlockDim;
+  vk::DeviceSize rowBytes
+      = static_cast<vk::DeviceSize> ((p_Width + p_BlockDim - 1) / p_BlockDim)
+        * p_BytesPerBlock;
+  if (rowBytes == 0 || p_Height == 0)
+    throw std::runtime_error ("Attempted to upload an empty image");
+  if (rowBytes > ringSize)
+    throw std::runtime_error ("Image row does not fit the staging ring");
+
+  const auto *texels = static_cast<const std::byte *> (p_Texels);
+  uint32_t row = 0;
+  while (row < blockRows)
+    {
+      vk::DeviceSize offset = 0;
+      vk::DeviceSize span = available (rowBytes, offset);
+      if (span == 0)
+        {
+          makeRoom ();
+          continue;
+        }
+
+      uint32_t rows = static_cast<uint32_t> (
+          std::min<vk::DeviceSize> (blockRows - row, span / rowBytes));
+      vk::DeviceSize bytes = rows * rowBytes;
+      std::memcpy (mapped + offset, texels + row * rowBytes, bytes);
+      commit (offset, bytes);
+
+      // extents of compressed images stop at the image edge, not the block
+      uint32_t firstTexelRow = row * p_BlockDim;
+      vk::BufferImageCopy region;
+      region.bufferOffset = offset;
+      region.bufferRowLength = 0;
+      region.bufferImageHeight = 0;
+      region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+      region.imageSubresource.mipLevel = p_MipLevel;
+      region.imageSubresource.baseArrayLayer = 0;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset
+          = vk::Offset3D{ 0, static_cast<int32_t> (firstTexelRow), 0 };
+      region.imageExtent = vk::Extent3D{
+        p_Width, std::min (rows * p_BlockDim, p_Height - firstTexelRow), 1
+      };
+      record ().copyBufferToImage (
+          ring, p_Image, vk::ImageLayout::eTransferDstOptimal, region);
+
+      row += rows;
+    }
+  return;
+}
+
+vk::CommandBuffer
+UploadBatcher::record (void)
+{
+  if (recording.commandBuffer)
+    return recording.commandBuffer;
+
+  vk::CommandBufferAllocateInfo allocInfo;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = vk::CommandBufferLevel::ePrimary;
+  allocInfo.commandBufferCount = 1;
+  recording.commandBuffer
+      = engine->logicalDevice.allocateCommandBuffers (allocInfo).at (0);
+
+  vk::CommandBufferBeginInfo beginInfo;
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+  recording.commandBuffer.begin (beginInfo);
+  return recording.commandBuffer;
+}
+
+vk::DeviceSize
+UploadBatcher::available (vk::DeviceSize p_MinBytes,
+                          vk::DeviceSize &p_Offset) const
+{
+  if (used == 0)
+    {
+      p_Offset = 0;
+      return ringSize >= p_MinBytes ? ringSize : 0;
+    }
+
+  vk::DeviceSize aligned
+      = (head + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+
+  // free space is [head, tail)
+  if (head < tail)
+    {
+      p_Offset = aligned;
+      return aligned < tail && tail - aligned >= p_MinBytes ? tail - aligned
+                                                            : 0;
+    }
+
+  // full
+  if (head == tail)
+    return 0;
+
+  // free space is [head, ringSize) & [0, tail)
+  if (aligned < ringSize && ringSize - aligned >= p_MinBytes)
+    {
+      p_Offset = aligned;
+      return ringSize - aligned;
+    }
+  p_Offset = 0;
+  return tail >= p_MinBytes ? tail : 0;
+}
+
+void
+UploadBatcher::commit (vk::DeviceSize p_Offset, vk::DeviceSize p_Bytes)
+{
+  // padding up to p_Offset is held until the batch completes too
+  vk::DeviceSize skipped
+      = p_Offset >= head ? p_Offset - head : ringSize - head + p_Offset;
+  if (used == 0)
+    {
+      skipped = 0;
+      tail = p_Offset;
+    }
+
+  used += skipped + p_Bytes;
+  recording.bytes += skipped + p_Bytes;
+  head = p_Offset + p_Bytes;
+  return;
+}
+
+void
+UploadBatcher::makeRoom (void)
+{
+  if (inFlight.empty ())
+    submit ();
+  if (inFlight.empty ())
+    throw std::runtime_error ("Upload does not fit the staging ring");
+
+  vk::Result res = engine->logicalDevice.waitForFences (
+      inFlight.front ().fence, VK_TRUE, UINT64_MAX);
+  if (res != vk::Result::eSuccess)
+    throw std::runtime_error ("Error occurred while waiting for fence");
+  release ();
+  return;
+}
+
+void
+UploadBatcher::release (void)
+{
+  Batch &batch = inFlight.front ();
+  engine->logicalDevice.destroyFence (batch.fence);
+  engine->logicalDevice.freeCommandBuffers (commandPool, batch.commandBuffer);
+
+  used -= batch.bytes;
+  tail = batch.end;
+  if (used == 0)
+    head = tail = 0;
+
+  inFlight.pop_front ();
+  return;
+}
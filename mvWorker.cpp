@@ -0,0 +1,124 @@
+#include "mvWorker.h"
+
+#include <algorithm>
+#include <atomic>
+
+WorkerPool::WorkerPool (size_t p_ThreadCount)
+{
+  if (p_ThreadCount == 0)
+    p_ThreadCount = std::max (1u, std::thread::hardware_concurrency ());
+
+  threads.reserve (p_ThreadCount);
+  for (size_t i = 0; i < p_ThreadCount; i++)
+    threads.emplace_back (&WorkerPool::workerLoop, this);
+  return;
+}
+
+WorkerPool::~WorkerPool ()
+{
+  {
+    std::lock_guard<std::mutex> lock (mtx);
+    stopping = true;
+  }
+  wake.notify_all ();
+
+  for (auto &thread : threads)
+    {
+      if (thread.joinable ())
+        thread.join ();
+    }
+}
+
+void
+WorkerPool::enqueue (std::function<void ()> p_Job)
+{
+  {
+    std::lock_guard<std::mutex> lock (mtx);
+    jobs.push (std::move (p_Job));
+  }
+  wake.notify_one ();
+  return;
+}
+
+void
+WorkerPool::workerLoop (void)
+{
+  while (true)
+    {
+      std::function<void ()> job;
+      {
+        std::unique_lock<std::mutex> lock (mtx);
+        wake.wait (lock, [this] () { return stopping || !jobs.empty (); });
+
+        if (jobs.empty ())
+          return; // stopping & drained
+
+        job = std::move (jobs.front ());
+        jobs.pop ();
+      }
+      job ();
+    }
+}
+
+void
+WorkerPool::parallelFor (size_t p_Count,
+                         const std::function<void (size_t)> &p_Job)
+{
+  if (p_Count == 0)
+    return;
+
+  // Shared with helpers so a helper dequeued after we return finds no
+  // work instead of dangling references
+  struct State
+  {
+    std::function<void (size_t)> job;
+    size_t count = 0;
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> done = 0;
+    std::mutex mtx;
+    std::condition_variable finished;
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State> ();
+  state->job = p_Job;
+  state->count = p_Count;
+
+  // Every participant claims indices until none remain
+  auto drain = [state] () {
+    size_t idx;
+    while ((idx = state->next.fetch_add (1)) < state->count)
+      {
+        try
+          {
+            state->job (idx);
+          }
+        catch (...)
+          {
+            std::lock_guard<std::mutex> lock (state->mtx);
+            if (!state->error)
+              state->error = std::current_exception ();
+          }
+
+        if (state->done.fetch_add (1) + 1 == state->count)
+          {
+            std::lock_guard<std::mutex> lock (state->mtx);
+            state->finished.notify_all ();
+          }
+      }
+  };
+
+  size_t helperCount = std::min (p_Count - 1, threads.size ());
+  for (size_t i = 0; i < helperCount; i++)
+    enqueue (drain);
+
+  drain ();
+
+  // Indices claimed by helpers may still be running
+  std::unique_lock<std::mutex> lock (state->mtx);
+  state->finished.wait (lock,
+                        [&] () { return state->done.load () == p_Count; });
+
+  if (state->error)
+    std::rethrow_exception (state->error);
+  return;
+}
@@ -0,0 +1,200 @@
+// Image decoding for source textures; the engine gets it from mvImage
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "mvBlockCompress.h"
+#include "mvKtx.h"
+#include "mvMipmap.h"
+#include "mvWorker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+  Offline texture bake
+
+  Writes <base>.ktx2 beside every image given or found in a given
+  directory: the full mip chain block compressed, BC1 when every texel is
+  opaque & BC3 otherwise. Images whose bake matches their current texels are
+  skipped
+
+  texbake [--linear] [--threads n] <image|directory>...
+*/
+
+static void
+usage (void)
+{
+  std::cout << "usage: texbake [--linear] [--threads n] "
+               "<image|directory>...\n"
+               "  --linear   texels are not colour (normals, masks); "
+               "default is sRGB\n"
+               "  --threads  worker threads (default one per hardware "
+               "thread)\n";
+  return;
+}
+
+// Extensions stb_image reads
+static bool
+isImage (const std::filesystem::path &p_Path)
+{
+  auto extension = p_Path.extension ().string ();
+  std::transform (extension.begin (), extension.end (), extension.begin (),
+                  [] (unsigned char c) { return std::tolower (c); });
+  return extension == ".png" || extension == ".jpg" || extension == ".jpeg"
+         || extension == ".bmp" || extension == ".tga";
+}
+
+// false => bake was current & skipped
+static bool
+bakeTexture (WorkerPool &p_Workers, const std::string &p_Filename,
+             bool p_Srgb)
+{
+  std::string outFilename = Ktx::textureFilename (p_Filename);
+  uint64_t key = Ktx::sourceKey (p_Filename);
+
+  try
+    {
+      Ktx::Texture existing;
+      Ktx::readTexture (outFilename, existing);
+      if (key != 0 && existing.sourceKey == key
+          && Ktx::isSrgb (existing.vkFormat) == p_Srgb)
+        return false;
+    }
+  catch (std::exception &)
+    {
+      // missing or unreadable; rebaked below
+    }
+
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  stbi_uc *rawImage = stbi_load (p_Filename.c_str (), &width, &height,
+                                 &channels, STBI_rgb_alpha);
+  if (!rawImage)
+    throw std::runtime_error ("Failed to load image => " + p_Filename);
+
+  std::vector<uint8_t> texels (rawImage,
+                               rawImage + size_t (width) * height * 4);
+  stbi_image_free (rawImage);
+
+  auto chain = Mipmap::generate (p_Workers, texels.data (), width, height, 4,
+                                 p_Srgb);
+
+  // Alpha of every level; box filtering never makes opaque texels
+  // transparent
+  BlockCompress::Format format
+      = BlockCompress::isOpaque (texels.data (), size_t (width) * height)
+            ? BlockCompress::Format::eBC1
+            : BlockCompress::Format::eBC3;
+
+  std::vector<std::vector<uint8_t>> levels (chain.size () + 1);
+  p_Workers.parallelFor (levels.size (), [&] (size_t idx) {
+    if (idx == 0)
+      levels.at (0) = BlockCompress::encode (p_Workers, format, texels.data (),
+                                             width, height);
+    else
+      levels.at (idx) = BlockCompress::encode (
+          p_Workers, format, chain.at (idx - 1).texels.data (),
+          chain.at (idx - 1).width, chain.at (idx - 1).height);
+  });
+
+  Ktx::writeTexture (outFilename, Ktx::compressedFormat (format, p_Srgb),
+                     width, height, levels, key);
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool srgb = true;
+  size_t threads = 0;
+  std::vector<std::filesystem::path> inputs;
+
+  try
+    {
+      for (int a = 1; a < argc; a++)
+        {
+          std::string arg = argv[a];
+          bool hasValue = a + 1 < argc;
+          if (arg == "--linear")
+            srgb = false;
+          else if (arg == "--threads" && hasValue)
+            threads = std::stoul (argv[++a]);
+          else if (arg.starts_with ("--"))
+            {
+              usage ();
+              return 1;
+            }
+          else
+            inputs.push_back (arg);
+        }
+    }
+  catch (std::exception &e)
+    {
+      std::cout << "Invalid argument => " << e.what () << "\n";
+      usage ();
+      return 1;
+    }
+
+  if (inputs.empty ())
+    {
+      usage ();
+      return 1;
+    }
+
+  // Directories are searched recursively
+  std::vector<std::filesystem::path> images;
+  for (const auto &input : inputs)
+    {
+      std::error_code error;
+      if (std::filesystem::is_directory (input, error))
+        {
+          for (const auto &entry :
+               std::filesystem::recursive_directory_iterator (input))
+            if (entry.is_regular_file () && isImage (entry.path ()))
+              images.push_back (entry.path ());
+        }
+      else
+        {
+          images.push_back (input);
+        }
+    }
+  std::sort (images.begin (), images.end ());
+
+  WorkerPool workers (threads);
+  std::cout << "Baking " << images.size () << " textures on "
+            << workers.size () << " workers\n";
+
+  // Images bake side by side; each image's levels & block rows nest on the
+  // same pool
+  auto start = std::chrono::steady_clock::now ();
+  std::atomic<size_t> failed = 0;
+  std::atomic<size_t> skipped = 0;
+  workers.parallelFor (images.size (), [&] (size_t idx) {
+    const std::string filename = images.at (idx).string ();
+    try
+      {
+        if (!bakeTexture (workers, filename, srgb))
+          skipped++;
+      }
+    catch (std::exception &e)
+      {
+        std::cout << "Failed to bake " << filename << " => " << e.what ()
+                  << "\n";
+        failed++;
+      }
+  });
+
+  std::chrono::duration<double, std::milli> elapsed
+      = std::chrono::steady_clock::now () - start;
+  std::cout << "Baked " << images.size () - failed - skipped << " of "
+            << images.size () << " textures (" << skipped
+            << " current) in " << elapsed.count () << " ms\n";
+  return failed == 0 ? 0 : 1;
+}